@@ -0,0 +1,253 @@
+/*
+ * card.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#define _POSIX_C_SOURCE  200809L
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "card.h"
+#include "debug.h"
+
+
+#define HLL_REGS (1 << IFWR_CARD_HLL_BITS)
+
+//Bloom filter probes per series
+#define BLOOM_K 4
+
+struct card_measure
+{
+    char* name;
+    uint64_t hash;
+    uint64_t admitted;      //Series let in so far (give or take false positives)
+    uint64_t* bloom;
+    uint64_t* refused;      //Series turned away, in the other half of bloom
+    uint8_t regs[HLL_REGS];
+};
+
+
+//FNV-1a is cheap on short keys, but its low bits are weak, so everything that
+//leaves here goes through the MurmurHash3 finaliser first
+#define FNV_OFFSET  0xcbf29ce484222325ULL
+#define FNV_PRIME   0x100000001b3ULL
+
+static uint64_t fnv1a(uint64_t h, const char* s)
+{
+    for(; *s; s++){
+        h ^= (uint8_t)*s;
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static uint64_t fmix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+uint64_t ifwr_card_hash(const char* measurement, const char* tags, uint64_t* measure_hash)
+{
+    uint64_t h = fnv1a(FNV_OFFSET, measurement);
+    *measure_hash = fmix64(h);
+
+    h ^= ',';
+    h *= FNV_PRIME;
+    return fmix64(fnv1a(h, tags));
+}
+
+
+int ifwr_card_init(ifwr_card_t* card, uint64_t limit)
+{
+    memset(card, 0, sizeof(*card));
+
+    card->table = calloc(IFWR_CARD_MAX_MEASURE, sizeof(struct card_measure*));
+    if(!card->table){
+        IFWR_DBG("Could not allocate cardinality table\n");
+        return -1;
+    }
+
+    //16 bits per series keeps false positives (new series let in) near 0.2%
+    card->limit = limit;
+    card->bloom_bits = 10;
+    while(limit && (1ULL << card->bloom_bits) < limit * 16 && card->bloom_bits < 30){
+        card->bloom_bits++;
+    }
+
+    IFWR_DBG("Success! Tracking series cardinality, limit %lu\n", (unsigned long)limit);
+    return 0;
+}
+
+
+static struct card_measure* card_lookup(ifwr_card_t* card, const char* measurement, uint64_t hash,
+        bool create)
+{
+    const int mask = IFWR_CARD_MAX_MEASURE - 1;
+    for(int i = 0; i < IFWR_CARD_MAX_MEASURE; i++){
+        struct card_measure** slot = &card->table[(hash + i) & mask];
+        struct card_measure* m = *slot;
+        if(m && m->hash == hash && strcmp(m->name, measurement) == 0){
+            return m;
+        }
+        if(m){
+            continue;
+        }
+
+        if(!create){
+            return NULL;
+        }
+
+        m = calloc(1, sizeof(struct card_measure));
+        if(!m || !(m->name = strdup(measurement))){
+            free(m);
+            return NULL;
+        }
+        if(card->limit){
+            const uint64_t words = (1ULL << card->bloom_bits) / 64;
+            m->bloom = calloc(2 * words, sizeof(uint64_t));
+            m->refused = m->bloom + words;
+            if(!m->bloom){
+                free(m->name);
+                free(m);
+                return NULL;
+            }
+        }
+        m->hash = hash;
+        *slot = m;
+        return m;
+    }
+
+    return NULL;
+}
+
+
+//Probe positions come from a second hash, so they don't line up with the
+//HyperLogLog register index
+static bool bloom_test_set(ifwr_card_t* card, uint64_t* bloom, uint64_t hash, bool set)
+{
+    const uint64_t mask = (1ULL << card->bloom_bits) - 1;
+    const uint64_t a = fmix64(hash ^ 0x9e3779b97f4a7c15ULL);
+    const uint64_t b = (a >> 32) | 1;
+
+    bool found = true;
+    for(int i = 0; i < BLOOM_K; i++){
+        const uint64_t bit = (a + i * b) & mask;
+        found &= (bloom[bit / 64] >> (bit % 64)) & 1;
+        if(set){
+            bloom[bit / 64] |= 1ULL << (bit % 64);
+        }
+    }
+
+    return found;
+}
+
+
+ifwr_card_e ifwr_card_check(ifwr_card_t* card, const char* measurement, uint64_t measure_hash,
+        uint64_t hash, bool admit)
+{
+    struct card_measure* m = card_lookup(card, measurement, measure_hash, true);
+    if(!m){
+        return IFWR_CARD_KNOWN;
+    }
+
+    //Register index from the top bits, leading zeros of the rest
+    const int idx = hash >> (64 - IFWR_CARD_HLL_BITS);
+    const uint64_t rest = (hash << IFWR_CARD_HLL_BITS) | (1ULL << (IFWR_CARD_HLL_BITS - 1));
+    const uint8_t rho = __builtin_clzll(rest) + 1;
+    if(rho > m->regs[idx]){
+        m->regs[idx] = rho;
+    }
+
+    if(!card->limit || bloom_test_set(card, m->bloom, hash, false)){
+        return IFWR_CARD_KNOWN;
+    }
+
+    if(m->admitted >= card->limit && !admit){
+        return bloom_test_set(card, m->refused, hash, true) ? IFWR_CARD_REFUSED : IFWR_CARD_OVER;
+    }
+
+    bloom_test_set(card, m->bloom, hash, true);
+    m->admitted++;
+    return IFWR_CARD_ADDED;
+}
+
+
+//Natural log for the small range correction, without dragging in libm
+static double card_ln(double x)
+{
+    int k = 0;
+    while(x >= 2){
+        x /= 2;
+        k++;
+    }
+
+    const double y = (x - 1) / (x + 1);
+    const double y2 = y * y;
+    double term = y;
+    double sum = 0;
+    for(int n = 1; n < 40; n += 2){
+        sum += term / n;
+        term *= y2;
+    }
+
+    return 2 * sum + k * 0.6931471805599453;
+}
+
+
+int64_t ifwr_card_estimate(ifwr_card_t* card, const char* measurement)
+{
+    uint64_t measure_hash = 0;
+    ifwr_card_hash(measurement, "", &measure_hash);
+    struct card_measure* m = card_lookup(card, measurement, measure_hash, false);
+    if(!m){
+        return -1;
+    }
+
+    double sum = 0;
+    int zeros = 0;
+    for(int i = 0; i < HLL_REGS; i++){
+        sum += 1.0 / (double)(1ULL << m->regs[i]);
+        zeros += !m->regs[i];
+    }
+
+    const double regs = HLL_REGS;
+    const double alpha = 0.7213 / (1 + 1.079 / regs);
+    double estimate = alpha * regs * regs / sum;
+
+    //Linear counting is much better while most registers are still empty
+    if(estimate <= 2.5 * regs && zeros){
+        estimate = regs * card_ln(regs / zeros);
+    }
+
+    return (int64_t)(estimate + 0.5);
+}
+
+
+void ifwr_card_free(ifwr_card_t* card)
+{
+    for(int i = 0; card->table && i < IFWR_CARD_MAX_MEASURE; i++){
+        struct card_measure* m = card->table[i];
+        if(m){
+            free(m->bloom);
+            free(m->name);
+            free(m);
+        }
+    }
+
+    free(card->table);
+    memset(card, 0, sizeof(*card));
+}
@@ -0,0 +1,91 @@
+/*
+ * card.h
+ *
+ * Keeps an eye on series cardinality. Every series key (measurement and
+ * tagset) is hashed into a HyperLogLog for its measurement, which estimates
+ * how many distinct series have been seen in fixed memory. With a limit set,
+ * a Bloom filter remembers which series were let in, so that series beyond
+ * the limit can be told apart from ones that are already known. A second one
+ * remembers which were turned away, so that each is only reported once.
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#ifndef IFWR_CARD_H_
+#define IFWR_CARD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//Most measurements tracked per connection. Others are let through untracked.
+#define IFWR_CARD_MAX_MEASURE 256
+
+//HyperLogLog register bits. 4096 registers, about 1.6% standard error.
+#define IFWR_CARD_HLL_BITS 12
+
+struct card_measure;
+
+/**
+ * @struct Cardinality state for one connection
+ */
+typedef struct ifwr_card
+{
+    uint64_t limit;         //Series allowed per measurement, 0 for no limit
+    int bloom_bits;         //log2 of the Bloom filter size
+    struct card_measure** table;
+} ifwr_card_t;
+
+/**
+ * @enum What ifwr_card_check() made of a series
+ */
+typedef enum
+{
+    IFWR_CARD_KNOWN = 0,    /**< Seen before (or not tracked) */
+    IFWR_CARD_ADDED,        /**< New, and there was room for it */
+    IFWR_CARD_OVER,         /**< New, and the measurement is at its limit */
+    IFWR_CARD_REFUSED,      /**< Turned away before, and still over the limit */
+} ifwr_card_e;
+
+
+/**
+ * @brief Set up cardinality tracking.
+ *
+ * @param[in]	limit
+ * 		Distinct series allowed per measurement, 0 to only track
+ *
+ * @return 0 on success, -1 on failure
+ */
+int ifwr_card_init(ifwr_card_t* card, uint64_t limit);
+
+/**
+ * @brief Hash a series key. Cheap enough to do for every point.
+ *
+ * @param[out]	measure_hash
+ * 		Hash of just the measurement name, for ifwr_card_check()
+ */
+uint64_t ifwr_card_hash(const char* measurement, const char* tags, uint64_t* measure_hash);
+
+/**
+ * @brief Count a series, and find out if it is new.
+ *
+ * @param[in]	admit
+ * 		Let the series in even if the measurement is at its limit
+ */
+ifwr_card_e ifwr_card_check(ifwr_card_t* card, const char* measurement, uint64_t measure_hash,
+        uint64_t hash, bool admit);
+
+/**
+ * @brief Estimated distinct series seen for a measurement, including any that
+ * 		were turned away. Costs a pass over the registers.
+ *
+ * @return The estimate, or -1 if the measurement is not tracked
+ */
+int64_t ifwr_card_estimate(ifwr_card_t* card, const char* measurement);
+
+/**
+ * @brief Free all tracking memory
+ */
+void ifwr_card_free(ifwr_card_t* card);
+
+#endif /* IFWR_CARD_H_ */
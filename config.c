@@ -0,0 +1,454 @@
+/*
+ * config.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#define _POSIX_C_SOURCE  200809L
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "config.h"
+#include "inih/ini.h"
+#include "debug.h"
+
+
+//Where the handler puts what it finds
+struct config_parse
+{
+    ifwr_config_t* cfg;
+    ifwr_conn_t* conn;
+    ifwr_endpoint_t* endpoints;
+    int nendpoints;
+};
+
+
+//Copies are kept until ifwr_config_free(), since the connection points at them
+static int config_str(ifwr_config_t* cfg, const char* value, char** out)
+{
+    if(cfg->nstrings == cfg->strings_cap){
+        const int cap = cfg->strings_cap ? cfg->strings_cap * 2 : 16;
+        char** strings = realloc(cfg->strings, cap * sizeof(char*));
+        if(!strings){
+            return 0;
+        }
+        cfg->strings = strings;
+        cfg->strings_cap = cap;
+    }
+
+    char* copy = strdup(value);
+    if(!copy){
+        return 0;
+    }
+
+    cfg->strings[cfg->nstrings++] = copy;
+    *out = copy;
+    return 1;
+}
+
+
+static void config_strs_trim(ifwr_config_t* cfg, int keep)
+{
+    while(cfg->nstrings > keep){
+        free(cfg->strings[--cfg->nstrings]);
+    }
+}
+
+
+//A non-negative int, with an optional k, m or g (times 1024) suffix
+static int config_int(const char* value, int* out)
+{
+    char* end = NULL;
+    errno = 0;
+    long long v = strtoll(value, &end, 10);
+    if(errno || end == value || v < 0){
+        return 0;
+    }
+
+    switch(*end){
+    case 'k': case 'K': v <<= 10; end++; break;
+    case 'm': case 'M': v <<= 20; end++; break;
+    case 'g': case 'G': v <<= 30; end++; break;
+    default: break;
+    }
+
+    if(*end || v > INT_MAX){
+        return 0;
+    }
+
+    *out = (int)v;
+    return 1;
+}
+
+
+static int config_bool(const char* value, bool* out)
+{
+    if(!strcasecmp(value, "true") || !strcasecmp(value, "yes") || !strcasecmp(value, "on") ||
+            !strcmp(value, "1")){
+        *out = true;
+        return 1;
+    }
+
+    if(!strcasecmp(value, "false") || !strcasecmp(value, "no") || !strcasecmp(value, "off") ||
+            !strcmp(value, "0")){
+        *out = false;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+//Names are in enum order, from 0
+static int config_enum(const char* value, const char* const* names, int count, int* out)
+{
+    for(int i = 0; i < count; i++){
+        if(!strcasecmp(value, names[i])){
+            *out = i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+#define CONFIG_ENUM(value, names, out) config_enum(value, names, sizeof(names) / sizeof(names[0]), out)
+
+static const char* const transports[] = { "http", "udp", "unix", "unixgram", "shm" };
+static const char* const ios[] = { "blocking", "uring", "reactor" };
+static const char* const lbs[] = { "failover", "round_robin", "least_outstanding" };
+static const char* const overflows[] = { "drop_newest", "drop_oldest", "block", "spill" };
+static const char* const clocks[] = { "realtime", "coarse", "tsc", "batch" };
+
+
+//"host:port", the host may not be empty
+static int config_endpoint(struct config_parse* parse, const char* value)
+{
+    if(parse->nendpoints == IFWR_MAX_ENDPOINTS){
+        return 0;
+    }
+
+    const char* colon = strrchr(value, ':');
+    ifwr_endpoint_t* ep = &parse->endpoints[parse->nendpoints];
+    if(!colon || colon == value || !config_int(colon + 1, &ep->port)){
+        return 0;
+    }
+
+    char host[INI_MAX_LINE];
+    const int len = colon - value;
+    memcpy(host, value, len);
+    host[len] = 0;
+    if(!config_str(parse->cfg, host, &ep->hostname)){
+        return 0;
+    }
+
+    parse->nendpoints++;
+    return 1;
+}
+
+
+//Ini file parsing with inih
+#define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
+static int config_handler(void* user, const char* section, const char* name,
+                   const char* value)
+{
+    struct config_parse* parse = user;
+    ifwr_config_t* cfg = parse->cfg;
+    ifwr_conn_t* conn = parse->conn;
+
+    int e = 0;
+    int ok = 0;
+
+    if (MATCH("influxdb", "hostname")) {
+        ok = config_str(cfg, value, &conn->hostname);
+    }
+    else if (MATCH("influxdb", "port")) {
+        ok = config_int(value, &conn->port);
+    }
+    else if (MATCH("influxdb", "organization")) {
+        ok = config_str(cfg, value, &conn->org);
+    }
+    else if (MATCH("influxdb", "bucket")) {
+        ok = config_str(cfg, value, &conn->bucket);
+    }
+    else if (MATCH("influxdb", "token")) {
+        ok = config_str(cfg, value, &conn->token);
+    }
+    else if (MATCH("influxdb", "sockpath")) {
+        ok = config_str(cfg, value, &conn->sockpath);
+    }
+    else if (MATCH("influxdb", "shmname")) {
+        ok = config_str(cfg, value, &conn->shmname);
+    }
+    else if (MATCH("influxdb", "transport")) {
+        ok = CONFIG_ENUM(value, transports, &e);
+        conn->transport = ok ? (ifwr_transport_e)e : conn->transport;
+    }
+    else if (MATCH("influxdb", "io")) {
+        ok = CONFIG_ENUM(value, ios, &e);
+        conn->io = ok ? (ifwr_io_e)e : conn->io;
+    }
+    else if (MATCH("influxdb", "mtu")) {
+        ok = config_int(value, &conn->mtu);
+    }
+    else if (MATCH("endpoints", "endpoint")) {
+        ok = config_endpoint(parse, value);
+    }
+    else if (MATCH("endpoints", "lb")) {
+        ok = CONFIG_ENUM(value, lbs, &e);
+        conn->lb = ok ? (ifwr_lb_e)e : conn->lb;
+    }
+    else if (MATCH("endpoints", "max_latency_ms")) {
+        ok = config_int(value, &conn->lb_max_latency_ms);
+    }
+    else if (MATCH("batch", "max")) {
+        ok = config_int(value, &conn->batch_max);
+    }
+    else if (MATCH("batch", "sort")) {
+        ok = config_bool(value, &conn->batch_sort);
+    }
+    else if (MATCH("batch", "coalesce")) {
+        ok = config_bool(value, &conn->batch_coalesce);
+    }
+    else if (MATCH("batch", "lazy_queue")) {
+        ok = config_int(value, &conn->lazy_queue);
+    }
+    else if (MATCH("batch", "prio_delay_us")) {
+        ok = config_int(value, &conn->prio_delay_us);
+    }
+    else if (MATCH("memory", "budget")) {
+        ok = config_int(value, &conn->mem_budget);
+    }
+    else if (MATCH("memory", "overflow")) {
+        ok = CONFIG_ENUM(value, overflows, &e);
+        conn->overflow = ok ? (ifwr_overflow_e)e : conn->overflow;
+    }
+    else if (MATCH("memory", "block_timeout_ms")) {
+        ok = config_int(value, &conn->block_timeout_ms);
+    }
+    else if (MATCH("memory", "spill_path")) {
+        ok = config_str(cfg, value, &conn->spill_path);
+    }
+    else if (MATCH("clock", "source")) {
+        ok = CONFIG_ENUM(value, clocks, &e);
+        conn->clock = ok ? (ifwr_clock_e)e : conn->clock;
+    }
+    else if (strcmp(section, "influxdb") && strcmp(section, "endpoints") && strcmp(section, "batch") &&
+            strcmp(section, "memory") && strcmp(section, "clock")) {
+        ok = 1;  /* someone else's section */
+    }
+
+    if(!ok){
+        IFWR_ERR("Bad setting [%s] %s = %s\n", section, name, value);
+    }
+    return ok;
+}
+#undef MATCH
+
+
+static int config_parse(ifwr_config_t* cfg, ifwr_conn_t* conn, ifwr_endpoint_t* endpoints,
+        const char* path, const char* ini)
+{
+    struct config_parse parse = {
+        .cfg = cfg,
+        .conn = conn,
+        .endpoints = endpoints,
+    };
+
+    const int ret = path ? ini_parse(path, config_handler, &parse) : ini_parse_string(ini, config_handler, &parse);
+    if(ret < 0){
+        IFWR_ERR("Could not read settings from %s\n", path ? path : "string");
+        return -1;
+    }
+    if(ret > 0){
+        IFWR_ERR("Settings on line %i of %s could not be used\n", ret, path ? path : "string");
+        return -1;
+    }
+
+    if(parse.nendpoints){
+        conn->endpoints = endpoints;
+        conn->nendpoints = parse.nendpoints;
+    }
+
+    return 0;
+}
+
+
+static int config_init(ifwr_config_t* cfg, ifwr_conn_t* conn)
+{
+    if(!cfg || !conn){
+        IFWR_DBG("No config or connection supplied\n");
+        return -1;
+    }
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->inotify_fd = -1;
+    cfg->base = *conn;
+    memset(&cfg->base.__private, 0, sizeof(cfg->base.__private));
+    return 0;
+}
+
+
+int ifwr_config_load(ifwr_config_t* cfg, const char* path, ifwr_conn_t* conn)
+{
+    if(config_init(cfg, conn)){
+        return -1;
+    }
+
+    if(!path || !(cfg->path = strdup(path))){
+        IFWR_DBG("No config file supplied\n");
+        return -1;
+    }
+
+    if(config_parse(cfg, conn, cfg->endpoints, path, NULL)){
+        ifwr_config_free(cfg);
+        return -1;
+    }
+
+    IFWR_DBG("Success! Loaded settings from %s\n", path);
+    return 0;
+}
+
+
+int ifwr_config_load_string(ifwr_config_t* cfg, const char* ini, ifwr_conn_t* conn)
+{
+    if(config_init(cfg, conn)){
+        return -1;
+    }
+
+    if(!ini || config_parse(cfg, conn, cfg->endpoints, NULL, ini)){
+        ifwr_config_free(cfg);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int ifwr_config_watch(ifwr_config_t* cfg)
+{
+    if(!cfg || !cfg->path){
+        IFWR_DBG("Settings didn't come from a file, there is nothing to watch\n");
+        return -1;
+    }
+
+    if(cfg->inotify_fd >= 0){
+        return cfg->inotify_fd;
+    }
+
+    //The directory, not the file, or a rename over it would end the watch
+    const char* slash = strrchr(cfg->path, '/');
+    cfg->dir = slash ? strndup(cfg->path, slash == cfg->path ? 1 : slash - cfg->path) : strdup(".");
+    cfg->name = strdup(slash ? slash + 1 : cfg->path);
+    if(!cfg->dir || !cfg->name){
+        IFWR_DBG("Could not allocate watch names\n");
+        return -1;
+    }
+
+    cfg->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(cfg->inotify_fd < 0){
+        IFWR_ERR("Could not start inotify. Error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if(inotify_add_watch(cfg->inotify_fd, cfg->dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0){
+        IFWR_ERR("Could not watch %s. Error: %s\n", cfg->dir, strerror(errno));
+        close(cfg->inotify_fd);
+        cfg->inotify_fd = -1;
+        return -1;
+    }
+
+    IFWR_DBG("Success! Watching %s for changes\n", cfg->path);
+    return cfg->inotify_fd;
+}
+
+
+//Soak up every event waiting, and see if any were for the file
+static bool config_changed(ifwr_config_t* cfg)
+{
+    char buff[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    bool changed = false;
+    ssize_t len = 0;
+    while((len = read(cfg->inotify_fd, buff, sizeof(buff))) > 0){
+        for(char* p = buff; p < buff + len; ){
+            const struct inotify_event* ev = (const struct inotify_event*)p;
+            changed |= (ev->mask & IN_Q_OVERFLOW) || (ev->len && !strcmp(ev->name, cfg->name));
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    return changed;
+}
+
+
+int ifwr_config_reload(ifwr_config_t* cfg, ifwr_conn_t* conn)
+{
+    if(!cfg || !conn){
+        IFWR_DBG("No config or connection supplied\n");
+        return -1;
+    }
+
+    if(cfg->inotify_fd < 0 || !config_changed(cfg)){
+        return 0;
+    }
+
+    //Big, because of the buffers in its private state
+    ifwr_conn_t* next = malloc(sizeof(ifwr_conn_t));
+    if(!next){
+        IFWR_ERR("Could not allocate space to reload settings\n");
+        return -1;
+    }
+    *next = cfg->base;
+
+    //Nothing from here is kept, ifwr_reconfigure() doesn't take any strings
+    ifwr_endpoint_t endpoints[IFWR_MAX_ENDPOINTS];
+    const int nstrings = cfg->nstrings;
+    int ret = config_parse(cfg, next, endpoints, cfg->path, NULL);
+    if(!ret && ifwr_reconfigure(conn, next)){
+        IFWR_ERR("Could not apply settings from %s: %s\n", cfg->path, ifwr_lasterr_str(conn));
+        ret = -1;
+    }
+
+    config_strs_trim(cfg, nstrings);
+    free(next);
+
+    if(ret){
+        return -1;
+    }
+
+    IFWR_DBG("Success! Reloaded settings from %s\n", cfg->path);
+    return 1;
+}
+
+
+void ifwr_config_free(ifwr_config_t* cfg)
+{
+    if(!cfg){
+        return;
+    }
+
+    if(cfg->inotify_fd >= 0){
+        close(cfg->inotify_fd);
+    }
+
+    config_strs_trim(cfg, 0);
+    free(cfg->strings);
+    free(cfg->path);
+    free(cfg->dir);
+    free(cfg->name);
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->inotify_fd = -1;
+}
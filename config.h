@@ -0,0 +1,99 @@
+/*
+ * config.h
+ *
+ * Loads connection settings from an INI file (or string) with inih, and can
+ * watch the file with inotify so that tunables are applied to a running
+ * connection as soon as the file changes. Sections other than the ones below
+ * are left alone, so applications can keep their own settings in the same
+ * file. Unknown keys in these sections, or values that don't parse, fail the
+ * whole load.
+ *
+ *   [influxdb]  hostname, port, organization, bucket, token, sockpath,
+ *               shmname, transport (http, udp, unix, unixgram, shm),
+ *               io (blocking, uring, reactor), mtu
+ *   [endpoints] endpoint = host:port (once per endpoint),
+ *               lb (failover, round_robin, least_outstanding), max_latency_ms
+ *   [batch]     max, sort, coalesce, lazy_queue, prio_delay_us
+ *   [memory]    budget, overflow (drop_newest, drop_oldest, block, spill),
+ *               block_timeout_ms, spill_path
+ *   [clock]     source (realtime, coarse, tsc, batch)
+ *
+ * Sizes are in bytes and can have a k, m or g suffix.
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#ifndef IFWR_CONFIG_H_
+#define IFWR_CONFIG_H_
+
+#include <stdbool.h>
+
+#include "influx-writer.h"
+
+/**
+ * @struct Where settings came from, and the strings they point to. Must
+ * 		outlive any connection it filled in.
+ */
+typedef struct ifwr_config
+{
+    char* path;             //NULL if loaded from a string
+    char* dir;              //Watched for the file being written or replaced
+    char* name;
+    int inotify_fd;         //-1 if not watching
+    ifwr_conn_t base;       //Settings from before the file, reloads start here
+    char** strings;         //Copies of every string value handed out
+    int nstrings;
+    int strings_cap;
+    ifwr_endpoint_t endpoints[IFWR_MAX_ENDPOINTS];
+} ifwr_config_t;
+
+
+/**
+ * @brief Fill in a connection from an INI file. Fields the file doesn't
+ * 		mention keep their values, so set defaults first.
+ *
+ * @param[out]	cfg
+ * 		Config state, to free with ifwr_config_free() after conn is closed
+ * @param[in,out]	conn
+ * 		Connection to fill in, not yet connected
+ *
+ * @return 0 on success, -1 on failure
+ */
+int ifwr_config_load(ifwr_config_t* cfg, const char* path, ifwr_conn_t* conn);
+
+/**
+ * @brief As ifwr_config_load(), from the contents of an INI file. There is
+ * 		nothing to watch afterwards.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int ifwr_config_load_string(ifwr_config_t* cfg, const char* ini, ifwr_conn_t* conn);
+
+/**
+ * @brief Start watching the file given to ifwr_config_load() for changes.
+ * 		Editors that write a new file and rename it over the old one are
+ * 		caught too.
+ *
+ * @return A non-blocking descriptor that becomes readable when the file may
+ * 		have changed, for poll() or epoll, or -1 on failure
+ */
+int ifwr_config_watch(ifwr_config_t* cfg);
+
+/**
+ * @brief If the file changed since the last call, read it again and apply
+ * 		the tunables (see ifwr_reconfigure()) to a connected conn. Settings
+ * 		that need a new connection are ignored. Cheap enough to call on every
+ * 		pass of an event loop.
+ *
+ * @return 1 if new settings were applied, 0 if the file hasn't changed, -1
+ * 		if it couldn't be read or applied. The old settings stay in place.
+ */
+int ifwr_config_reload(ifwr_config_t* cfg, ifwr_conn_t* conn);
+
+/**
+ * @brief Stop watching and free every string handed out
+ */
+void ifwr_config_free(ifwr_config_t* cfg);
+
+#endif /* IFWR_CONFIG_H_ */
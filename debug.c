@@ -20,12 +20,302 @@
 #include <string.h>
 #include <errno.h>
 #include <libgen.h>
+#include <time.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
 
 
 #include "debug.h"
 
 
+//Messages waiting to be written. A power of two.
+#define LOG_SLOTS 1024
+
+//Longer messages are cut short
+#define LOG_MSG_MAX 256
+
+//How long the logging thread naps when there is nothing to write
+#define LOG_IDLE_NS (10 * 1000 * 1000)
+
+#define LOG_WINDOW_NS (1000 * 1000 * 1000LL)
+
+/*
+ * A bounded multi-producer ring. Each slot's sequence number says whose turn
+ * it is: 2 * lap when it is free for the producer at that position, 2 * lap + 1
+ * once the message is in. Zeroed memory is a ring of free slots.
+ */
+struct log_slot
+{
+    uint64_t seq;
+    ifwr_dbg_mode_e mode;
+    int len;
+    char msg[LOG_MSG_MAX];
+};
+
+static struct log_slot log_ring[LOG_SLOTS];
+static uint64_t log_head;       //Next position to fill
+static uint64_t log_tail;       //Next position to write out
+static uint64_t log_dropped;    //Messages that found the ring full
+static bool log_draining;       //Someone is writing messages out
+
+static ifwr_dbg_site_t* log_held;  //Sites holding messages back
+
+static ifwr_log_sink_t log_sink_fn;
+static void* log_sink_user;
+
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+
+
+static void log_stderr(ifwr_dbg_mode_e mode, const char* msg, int len, void* user)
+{
+    (void)mode;
+    (void)user;
+
+    while(len > 0){
+        const ssize_t ret = write(OUTPUT_TO, msg, len);
+        if(ret < 0 && errno == EINTR){
+            continue;
+        }
+        if(ret <= 0){
+            return;
+        }
+        msg += ret;
+        len -= ret;
+    }
+}
+
+
+static void log_write(ifwr_dbg_mode_e mode, const char* msg, int len)
+{
+    const ifwr_log_sink_t sink = __atomic_load_n(&log_sink_fn, __ATOMIC_ACQUIRE);
+    if(sink){
+        sink(mode, msg, len, __atomic_load_n(&log_sink_user, __ATOMIC_RELAXED));
+        return;
+    }
+
+    log_stderr(mode, msg, len, NULL);
+}
+
+
+static const char* log_mode_str(ifwr_dbg_mode_e mode)
+{
+    switch(mode){
+        case IFWR_ERR:   return "Error";
+        case IFWR_FAT:   return "Fatal";
+        case IFWR_DBG:   return "Debug";
+        case IFWR_WARN:  return "Warning:";
+    }
+
+    return "";
+}
+
+
+static int64_t log_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * LOG_WINDOW_NS + ts.tv_nsec;
+}
+
+
+static void log_hold(ifwr_dbg_site_t* site)
+{
+    ifwr_dbg_site_t* head = __atomic_load_n(&log_held, __ATOMIC_RELAXED);
+    do{
+        site->next = head;
+    } while(!__atomic_compare_exchange_n(&log_held, &head, site, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+//Say how many messages were held back by sites that have gone quiet since, or
+//by every site if all is set. A site that is still in its window is left
+//for next time, it may yet report them itself.
+static void log_report_held(bool all)
+{
+    ifwr_dbg_site_t* site = __atomic_exchange_n(&log_held, NULL, __ATOMIC_ACQUIRE);
+    const int64_t now = log_now();
+
+    while(site){
+        ifwr_dbg_site_t* const next = site->next;
+
+        if(!all && now - __atomic_load_n(&site->window_ns, __ATOMIC_RELAXED) < LOG_WINDOW_NS){
+            log_hold(site);
+            site = next;
+            continue;
+        }
+
+        //Unlisted first, so that anything held back from here on lists it again
+        __atomic_store_n(&site->listed, false, __ATOMIC_RELEASE);
+        const uint32_t suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_ACQ_REL);
+        if(suppressed){
+            char fn[LOG_MSG_MAX];
+            snprintf(fn, sizeof(fn), "%s", site->filename);
+            char msg[LOG_MSG_MAX];
+            const int len = snprintf(msg, sizeof(msg), "[%s - %s:%i:%s()]  %u more like this held back\n",
+                    log_mode_str(site->mode), basename(fn), site->line_num, site->function, suppressed);
+            log_write(site->mode, msg, len < (int)sizeof(msg) ? len : (int)sizeof(msg) - 1);
+        }
+
+        site = next;
+    }
+}
+
+
+//Write out everything in the ring, unless another thread already is. Returns
+//the number of messages written.
+static int log_drain(bool all)
+{
+    if(__atomic_exchange_n(&log_draining, true, __ATOMIC_ACQUIRE)){
+        return 0;
+    }
+
+    int written = 0;
+    for(;; written++){
+        struct log_slot* const slot = &log_ring[log_tail & (LOG_SLOTS - 1)];
+        const uint64_t lap = log_tail / LOG_SLOTS;
+        if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != 2 * lap + 1){
+            break;
+        }
+
+        log_write(slot->mode, slot->msg, slot->len);
+        __atomic_store_n(&slot->seq, 2 * (lap + 1), __ATOMIC_RELEASE);
+        __atomic_store_n(&log_tail, log_tail + 1, __ATOMIC_RELEASE);
+    }
+
+    const uint64_t dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+    if(dropped){
+        char msg[LOG_MSG_MAX];
+        const int len = snprintf(msg, sizeof(msg), "[Warning: - debug.c]  %lu log messages dropped, the log ring was full\n",
+                (unsigned long)dropped);
+        log_write(IFWR_WARN, msg, len);
+    }
+
+    log_report_held(all);
+
+    __atomic_store_n(&log_draining, false, __ATOMIC_RELEASE);
+    return written;
+}
+
+
+void ifwr_log_flush(void)
+{
+    //Wait out the logging thread if it is mid drain, then finish the job
+    const uint64_t head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+    for(int tries = 0; tries < 1000; tries++){
+        const bool done = __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE) >= head;
+        if(done && !__atomic_load_n(&log_held, __ATOMIC_ACQUIRE)){
+            break;
+        }
+        if(!log_drain(true) && !done){
+            struct timespec nap = { .tv_sec = 0, .tv_nsec = 1000 * 1000 };
+            nanosleep(&nap, NULL);
+        }
+    }
+}
+
+
+static void* log_thread(void* arg)
+{
+    (void)arg;
+
+    for(;;){
+        if(!log_drain(false)){
+            struct timespec nap = { .tv_sec = 0, .tv_nsec = LOG_IDLE_NS };
+            nanosleep(&nap, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+
+//The thread only starts once there is something to say
+static void log_start(void)
+{
+    atexit(ifwr_log_flush);
+
+    //Keep signals away from the logging thread
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if(pthread_create(&thread, &attr, log_thread, NULL)){
+        //Messages pile up until a flush, or drop once the ring is full
+        const char* msg = "[Warning: - debug.c]  Could not start the logging thread\n";
+        log_stderr(IFWR_WARN, msg, strlen(msg), NULL);
+    }
+    pthread_attr_destroy(&attr);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+
+void ifwr_log_sink(ifwr_log_sink_t sink, void* user)
+{
+    __atomic_store_n(&log_sink_user, user, __ATOMIC_RELAXED);
+    __atomic_store_n(&log_sink_fn, sink, __ATOMIC_RELEASE);
+}
+
+
+//Claim the next free slot, or NULL if the ring is full
+static struct log_slot* log_claim(uint64_t* lap_out)
+{
+    uint64_t pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+    for(;;){
+        struct log_slot* const slot = &log_ring[pos & (LOG_SLOTS - 1)];
+        const uint64_t lap = pos / LOG_SLOTS;
+        const uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        if(seq == 2 * lap){
+            if(__atomic_compare_exchange_n(&log_head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+                *lap_out = lap;
+                return slot;
+            }
+        }
+        else if(seq < 2 * lap){
+            return NULL;    //Still holds a message from the lap before
+        }
+        else{
+            pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+
+//Whether a message from this site gets through, and how many were held back
+//since the last one that did
+static bool log_allow(ifwr_dbg_site_t* site, uint32_t* suppressed)
+{
+    const int64_t now = log_now();
+
+    int64_t window = __atomic_load_n(&site->window_ns, __ATOMIC_RELAXED);
+    *suppressed = 0;
+    if(now - window >= LOG_WINDOW_NS &&
+            __atomic_compare_exchange_n(&site->window_ns, &window, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+        __atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+        *suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+    }
+
+    if(__atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED) >= IFWR_LOG_BURST){
+        __atomic_fetch_add(&site->suppressed, 1, __ATOMIC_ACQ_REL);
+        if(!__atomic_exchange_n(&site->listed, true, __ATOMIC_ACQ_REL)){
+            log_hold(site);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+
 int ifwr_dbg_out_(
+        ifwr_dbg_site_t* site,
         bool info,
         ifwr_dbg_mode_e mode,
         int line_num,
@@ -33,23 +323,65 @@ int ifwr_dbg_out_(
         const char* function,
         const char* format, ... ) //Intentionally using char* here as these are passed in as constants
 {
-    va_list args;
-    va_start(args,format);
+    //Every thread writes the same, for the logging thread's note
+    if(site && !__atomic_load_n(&site->filename, __ATOMIC_ACQUIRE)){
+        site->mode = mode;
+        site->line_num = line_num;
+        site->function = function;
+        __atomic_store_n(&site->filename, filename, __ATOMIC_RELEASE);
+    }
+
+    uint32_t suppressed = 0;
+    if(site && !log_allow(site, &suppressed)){
+        return 0;
+    }
+
+    pthread_once(&log_once, log_start);
+
+    uint64_t lap = 0;
+    struct log_slot* slot = NULL;
+    while(!(slot = log_claim(&lap))){
+        //Debug builds want every message, and fatal ones must get out
+        if(mode != IFWR_DBG && mode != IFWR_FAT){
+            __atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        if(!log_drain(false)){
+            sched_yield();
+        }
+    }
+
     char* fn =  (char*)filename;
-    char* mode_str = NULL;
-    switch(mode){
-        case IFWR_ERR:   mode_str = "Error"; break;
-        case IFWR_FAT:   mode_str = "Fatal"; break;
-        case IFWR_DBG:   mode_str = "Debug"; break;
-        case IFWR_WARN:  mode_str = "Warning:"; break;
+    const char* mode_str = log_mode_str(mode);
+
+    int len = 0;
+    if(info){
+        len = snprintf(slot->msg, LOG_MSG_MAX, "[%s - %s:%i:%s()]  ", mode_str, basename(fn), (int)line_num, function);
+    }
+    if(suppressed && len < LOG_MSG_MAX){
+        len += snprintf(slot->msg + len, LOG_MSG_MAX - len, "(%u more like this held back) ", suppressed);
+    }
+    if(len < LOG_MSG_MAX){
+        va_list args;
+        va_start(args,format);
+        len += vsnprintf(slot->msg + len, LOG_MSG_MAX - len, format, args);
+        va_end(args);
     }
-    if(info) dprintf(OUTPUT_TO,"[%s - %s:%i:%s()]  ", mode_str, basename(fn), (int)line_num, function);
-    int result = vdprintf(OUTPUT_TO,format,args);
-    va_end(args);
+
+    //Cut short, but still ends the line
+    if(len >= LOG_MSG_MAX){
+        len = LOG_MSG_MAX - 1;
+        slot->msg[len - 1] = '\n';
+    }
+
+    slot->mode = mode;
+    slot->len = len;
+    __atomic_store_n(&slot->seq, 2 * lap + 1, __ATOMIC_RELEASE);
 
     if(mode == IFWR_FAT){
+        ifwr_log_flush();
         exit(-1);
     }
 
-    return result;
+    return len;
 }
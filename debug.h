@@ -8,10 +8,17 @@
 #ifndef IFWR_DEBUG_H_
 #define IFWR_DEBUG_H_
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /*
  * A little bit of self contained debugging help from
  * https://github.com/mgrosvenor/libchaste/blob/master/utils/debug.c
+ *
+ * Messages are formatted by the caller into a lock-free ring, and written out
+ * by a logging thread, so logging never blocks on stderr. Errors and warnings
+ * are rate limited per call site, and a note says how many were held back,
+ * either on the site's next message or once its window is over.
  */
 
 typedef enum {
@@ -23,32 +30,81 @@ typedef enum {
 
 #define OUTPUT_TO STDERR_FILENO
 
+//Errors and warnings let through per call site, per second
+#define IFWR_LOG_BURST 10
+
+/**
+ * @struct Rate limiting state, one per call site
+ */
+typedef struct ifwr_dbg_site
+{
+    int64_t window_ns;      //Start of the current second
+    uint32_t count;         //Messages in this window
+    uint32_t suppressed;    //... of which were held back
+
+    //While it is holding messages back, the site is on a list for the logging
+    //thread, which reports them once the window is over
+    bool listed;
+    struct ifwr_dbg_site* next;
+    ifwr_dbg_mode_e mode;
+    int line_num;
+    const char* filename;
+    const char* function;
+} ifwr_dbg_site_t;
 
-#define IFWR_ERR( /*format, args*/...)  ifwr_err_helper(__VA_ARGS__, "")
-#define ifwr_err_helper(format, ...) ifwr_dbg_out_(true, IFWR_ERR, __LINE__, __FILE__, __func__, format, __VA_ARGS__ )
-#define IFWR_ERR2( /*format, args*/...)  ifwr_err_helper2(__VA_ARGS__, "")
-#define ifwr_err_helper2(format, ...) ifwr_dbg_out_(false, IFWR_ERR, __LINE__, __FILE__, __func__, format, __VA_ARGS__ )
+/**
+ * @brief Where log messages go. Called from the logging thread (or from
+ * 		ifwr_log_flush()), one whole message at a time, with the
+ * 		"[Error - file:line:function()]" prefix and newline included.
+ */
+typedef void (*ifwr_log_sink_t)(ifwr_dbg_mode_e mode, const char* msg, int len, void* user);
+
+
+//IFWR_QUIET drops error messages as well. Errors are still reported through
+//return values and ifwr_lasterr().
+#ifndef IFWR_QUIET
+    #define IFWR_ERR( /*format, args*/...)  ifwr_err_helper(__VA_ARGS__, "")
+    #define ifwr_err_helper(format, ...) do { static ifwr_dbg_site_t ifwr_site_; \
+        ifwr_dbg_out_(&ifwr_site_, true, IFWR_ERR, __LINE__, __FILE__, __func__, format, __VA_ARGS__ ); } while(0)
+    #define IFWR_ERR2( /*format, args*/...)  ifwr_err_helper2(__VA_ARGS__, "")
+    #define ifwr_err_helper2(format, ...) ifwr_dbg_out_(NULL, false, IFWR_ERR, __LINE__, __FILE__, __func__, format, __VA_ARGS__ )
+#else
+    #define IFWR_ERR( /*format, args*/...)
+    #define IFWR_ERR2( /*format, args*/...)
+#endif
 
 #define IFWR_FAT( /*format, args*/...)  ifwr_fat_helper(__VA_ARGS__, "")
-#define ifwr_fat_helper(format, ...) ifwr_dbg_out_(true, IFWR_FAT, __LINE__, __FILE__, __func__, format, __VA_ARGS__ )
+#define ifwr_fat_helper(format, ...) ifwr_dbg_out_(NULL, true, IFWR_FAT, __LINE__, __FILE__, __func__, format, __VA_ARGS__ )
 #define IFWR_FAT2( /*format, args*/...)  ifwr_fat_helper2(__VA_ARGS__, "")
-#define ifwr_fat_helper2(format, ...) ifwr_dbg_out_(false, IFWR_FAT, __LINE__, __FILE__, __func__, format, __VA_ARGS__ )
+#define ifwr_fat_helper2(format, ...) ifwr_dbg_out_(NULL, false, IFWR_FAT, __LINE__, __FILE__, __func__, format, __VA_ARGS__ )
 
 #ifndef NDEBUG
-    //int ifwr_dbg_out_(ch_bool info, int line_num, const char* filename, const char* function,  const char* format, ... );
+    //Debug messages are never dropped or rate limited, the caller waits for room
     #define IFWR_DBG( /*format, args*/...)  ifwr_dbg_helper(__VA_ARGS__, "")
-    #define ifwr_dbg_helper(format, ...) ifwr_dbg_out_(true,IFWR_DBG,__LINE__, __FILE__, __func__, format, __VA_ARGS__ )
+    #define ifwr_dbg_helper(format, ...) ifwr_dbg_out_(NULL, true,IFWR_DBG,__LINE__, __FILE__, __func__, format, __VA_ARGS__ )
     #define IFWR_DBG2( /*format, args*/...)  ifwr_dbg_helper2(__VA_ARGS__, "")
-    #define ifwr_dbg_helper2(format, ...) ifwr_dbg_out_(false,IFWR_DBG,__LINE__, __FILE__, __func__, format, __VA_ARGS__ )
+    #define ifwr_dbg_helper2(format, ...) ifwr_dbg_out_(NULL, false,IFWR_DBG,__LINE__, __FILE__, __func__, format, __VA_ARGS__ )
     #define IFWR_WARN( /*format, args*/...)  ifwr_dbg_helper3(__VA_ARGS__, "")
-    #define ifwr_dbg_helper3(format, ...) ifwr_dbg_out_(true,IFWR_WARN,__LINE__, __FILE__, __func__, format, __VA_ARGS__ )
+    #define ifwr_dbg_helper3(format, ...) do { static ifwr_dbg_site_t ifwr_site_; \
+        ifwr_dbg_out_(&ifwr_site_, true,IFWR_WARN,__LINE__, __FILE__, __func__, format, __VA_ARGS__ ); } while(0)
 #else
     #define IFWR_DBG( /*format, args*/...)
     #define IFWR_DBG2( /*format, args*/...)
     #define IFWR_WARN( /*format, args*/...)
 #endif
 
+/**
+ * @brief Queue a message. Never blocks for errors and warnings: if the ring is
+ * 		full the message is dropped and counted. Fatal messages are written out
+ * 		before the process exits.
+ *
+ * @param[in]	site
+ * 		Rate limiting state for the call site, NULL for no limit
+ *
+ * @return Length of the message queued, 0 if it was held back or dropped
+ */
 int ifwr_dbg_out_(
+        ifwr_dbg_site_t* site,
         bool info,
         ifwr_dbg_mode_e mode,
         int line_num,
@@ -56,6 +112,18 @@ int ifwr_dbg_out_(
         const char* function,
         const char* format, ... );
 
+/**
+ * @brief Send log messages somewhere other than stderr, e.g. into your own
+ * 		logger. NULL goes back to stderr. Best set before anything is logged.
+ */
+void ifwr_log_sink(ifwr_log_sink_t sink, void* user);
+
+/**
+ * @brief Write out every message queued so far, from this thread. Waits if
+ * 		the logging thread is already at it.
+ */
+void ifwr_log_flush(void);
+
 
 
 #endif /* IFWR_DEBUG_H_ */
@@ -0,0 +1,224 @@
+/*
+ * example-batch.c
+ *
+ * Cost of ifwr_flush() on one batch as it comes in, with conn->batch_sort,
+ * and with conn->batch_coalesce. The batch is the same every time: points
+ * from a few hundred series, out of time order, with most timestamps split
+ * over two sends. A tiny HTTP server thread of our own answers the POSTs, so
+ * no InfluxDB is needed and only the flush differs.
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#define _POSIX_C_SOURCE  200809L
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "influx-writer.h"
+
+#define SERIES 256
+#define STEPS  32
+#define ROUNDS 50
+
+static const char reply[] = "HTTP/1.1 204 No Content\r\n\r\n";
+
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000 * 1000LL + ts.tv_nsec;
+}
+
+
+//Answer every request on the first connection with a 204, until it closes.
+//Bodies are skipped rather than kept, a batch can be bigger than the buffer.
+static void* sink_serve(void* arg)
+{
+    const int lfd = (int)(intptr_t)arg;
+    const int fd = accept(lfd, NULL, NULL);
+    if(fd < 0){
+        return NULL;
+    }
+
+    char buff[IFWR_MAX_MSG];
+    int len = 0;
+    int64_t skip = 0;
+    for(;;){
+        const ssize_t ret = read(fd, buff + len, sizeof(buff) - len);
+        if(ret <= 0){
+            break;
+        }
+        len += ret;
+
+        for(;;){
+            if(skip){
+                const int n = skip < len ? (int)skip : len;
+                skip -= n;
+                len -= n;
+                memmove(buff, buff + n, len);
+                if(skip){
+                    break;
+                }
+                if(write(fd, reply, sizeof(reply) - 1) < 0){
+                    goto done;
+                }
+            }
+
+            const char* hdr_end = memmem(buff, len, "\r\n\r\n", 4);
+            if(!hdr_end){
+                break;
+            }
+            const char* cl = memmem(buff, hdr_end - buff, "Content-Length: ", 16);
+            const int hdr_len = hdr_end + 4 - buff;
+            skip = cl ? atoll(cl + 16) : 0;
+            len -= hdr_len;
+            memmove(buff, buff + hdr_len, len);
+            if(!skip && write(fd, reply, sizeof(reply) - 1) < 0){
+                goto done;
+            }
+        }
+    }
+
+done:
+    close(fd);
+    return NULL;
+}
+
+
+static int sink_tcp(int* port)
+{
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if(fd < 0 || bind(fd, (struct sockaddr*)&addr, len) || listen(fd, 1) ||
+            getsockname(fd, (struct sockaddr*)&addr, &len)){
+        return -1;
+    }
+
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+
+//Queue the batch. Steps go out in a shuffled order, and each step is split
+//into two sends, one per field, so that coalescing has something to fold.
+static int fill(ifwr_conn_t* conn)
+{
+    static const int order[STEPS] = {
+        17, 3, 29, 8, 0, 21, 12, 31, 5, 26, 14, 1, 19, 9, 24, 30,
+        6, 15, 27, 2, 11, 22, 18, 4, 28, 10, 16, 25, 7, 20, 13, 23
+    };
+
+    char host[16];
+    ifwr_ktv_t tagset[] = {
+        { .type=IFWR_TYPE_STRING, .key = "host",   .value.s = host     },
+        { .type=IFWR_TYPE_STRING, .key = "region", .value.s = "ap-se-2" },
+        { .type=IFWR_TYPE_STOP }
+    };
+    ifwr_ktv_t temp[] = {
+        { .type=IFWR_TYPE_INT,   .key = "temperature", .value.i = 0   },
+        { .type=IFWR_TYPE_STOP }
+    };
+    ifwr_ktv_t pres[] = {
+        { .type=IFWR_TYPE_FLOAT, .key = "pressure",    .value.f = 0.0 },
+        { .type=IFWR_TYPE_STOP }
+    };
+
+    for(int s = 0; s < STEPS; s++){
+        const int64_t ts = 1600000000000000000LL + order[s] * 1000LL;
+        for(int i = 0; i < SERIES; i++){
+            snprintf(host, sizeof(host), "host%03i", (i * 97) % SERIES);
+            temp[0].value.i = i + s;
+            pres[0].value.f = (i + s) * 0.25;
+            if(ifwr_send(conn, "weather", tagset, temp, IFWR_TS_NANOS, ts) < 0 ||
+                    ifwr_send(conn, "weather", tagset, pres, IFWR_TS_NANOS, ts) < 0){
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+//Flush the same batch ROUNDS times, and return the mean ns per flush
+static double run(const char* name, bool sort, bool coalesce, uint64_t* folded)
+{
+    int port = 0;
+    const int lfd = sink_tcp(&port);
+    pthread_t thread;
+    if(lfd < 0 || pthread_create(&thread, NULL, sink_serve, (void*)(intptr_t)lfd)){
+        fprintf(stderr, "Could not start the server for %s\n", name);
+        return -1;
+    }
+
+    ifwr_conn_t conn = {0};
+    conn.hostname = "127.0.0.1";
+    conn.port = port;
+    conn.org = "org";
+    conn.bucket = "bucket";
+    conn.token = "token";
+    conn.batch_max = IFWR_MAX_BATCH;
+    conn.batch_sort = sort;
+    conn.batch_coalesce = coalesce;
+    if(ifwr_connect(&conn)){
+        fprintf(stderr, "Could not connect for %s. Error: %s\n", name, ifwr_lasterr_str(&conn));
+        return -1;
+    }
+
+    int64_t ns = 0;
+    for(int r = 0; r < ROUNDS; r++){
+        if(fill(&conn)){
+            fprintf(stderr, "Could not batch for %s. Error: %s\n", name, ifwr_lasterr_str(&conn));
+            return -1;
+        }
+
+        const int64_t start = now_ns();
+        if(ifwr_flush(&conn)){
+            fprintf(stderr, "Could not flush for %s. Error: %s\n", name, ifwr_lasterr_str(&conn));
+            return -1;
+        }
+        ns += now_ns() - start;
+    }
+
+    ifwr_stats_t stats;
+    ifwr_stats(&conn, &stats);
+    *folded = stats.lines_coalesced / ROUNDS;
+
+    ifwr_close(&conn);
+    pthread_join(thread, NULL);
+    close(lfd);
+    return (double)ns / ROUNDS;
+}
+
+
+int main(int argc, char** argv)
+{
+    uint64_t folded = 0;
+    const double plain_ns = run("plain", false, false, &folded);
+    const double sort_ns = run("batch_sort", true, false, &folded);
+    const double coalesce_ns = run("batch_coalesce", false, true, &folded);
+    if(plain_ns < 0 || sort_ns < 0 || coalesce_ns < 0){
+        return -1;
+    }
+
+    printf("%i lines per batch\n", SERIES * STEPS * 2);
+    printf("As queued:      %8.1f us/flush\n", plain_ns / 1000);
+    printf("batch_sort:     %8.1f us/flush\n", sort_ns / 1000);
+    printf("batch_coalesce: %8.1f us/flush (%" PRIu64 " lines folded)\n", coalesce_ns / 1000, folded);
+    return 0;
+}
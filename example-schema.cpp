@@ -0,0 +1,144 @@
+/*
+ * example-schema.cpp
+ *
+ * Typed schemas from influx-writer.hpp, checked and timed against ifwr_send().
+ * Points go over UDP to a socket of our own, so no InfluxDB is needed, and the
+ * transport costs the same both ways.
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <cinttypes>
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "influx-writer.hpp"
+
+static constexpr char weather[] = "weather";
+static constexpr char city[] = "city";
+static constexpr char temperature[] = "temperature";
+static constexpr char pressure[] = "pressure";
+static constexpr char raining[] = "raining";
+
+using weather_t = ifwr::measurement<weather,
+        ifwr::tag<city>,
+        ifwr::field<temperature, int64_t>,
+        ifwr::field<pressure, double>,
+        ifwr::field<raining, bool>>;
+
+#define POINTS (1000 * 1000)
+
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+
+//Somewhere for the datagrams to go
+static int sink_open(int* port)
+{
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if(fd < 0 || bind(fd, (struct sockaddr*)&addr, len) || getsockname(fd, (struct sockaddr*)&addr, &len)){
+        return -1;
+    }
+
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+
+int main(int argc, char** argv)
+{
+    int port = 0;
+    const int sink = sink_open(&port);
+    if(sink < 0){
+        fprintf(stderr, "Could not open a UDP socket\n");
+        return -1;
+    }
+
+    char hostname[] = "127.0.0.1";
+    ifwr_conn_t conn = {};
+    conn.hostname = hostname;
+    conn.port = port;
+    conn.transport = IFWR_TRANSPORT_UDP;
+    if(ifwr_connect(&conn)){
+        fprintf(stderr, "Could not connect %s\n", ifwr_lasterr_str(&conn));
+        return -1;
+    }
+
+    char city_name[] = "Perth";
+    ifwr_ktv_t tagset[] = {
+        { (char*)city, IFWR_TYPE_STRING, {} },
+        { NULL, IFWR_TYPE_STOP, {} }
+    };
+    tagset[0].value.s = city_name;
+
+    ifwr_ktv_t fieldset[] = {
+        { (char*)temperature, IFWR_TYPE_INT,   {} },
+        { (char*)pressure,    IFWR_TYPE_FLOAT, {} },
+        { (char*)raining,     IFWR_TYPE_BOOL,  {} },
+        { NULL, IFWR_TYPE_STOP, {} }
+    };
+    fieldset[0].value.i = 31;
+    fieldset[1].value.f = 1013.25;
+    fieldset[2].value.b = false;
+
+    //Datagrams are packed, so flush to get each line on its own
+    char c_line[IFWR_MAX_MSG];
+    char cpp_line[IFWR_MAX_MSG];
+    if(ifwr_send(&conn, weather, tagset, fieldset, IFWR_TS_NANOS, 1) < 0 || ifwr_flush(&conn)){
+        fprintf(stderr, "Could not send. Error: %s\n", ifwr_lasterr_str(&conn));
+        return -1;
+    }
+    const ssize_t c_len = recv(sink, c_line, sizeof(c_line), 0);
+
+    if(weather_t::send(&conn, IFWR_TS_NANOS, 1, city_name, 31, 1013.25, false) < 0 || ifwr_flush(&conn)){
+        fprintf(stderr, "Could not send. Error: %s\n", ifwr_lasterr_str(&conn));
+        return -1;
+    }
+    const ssize_t cpp_len = recv(sink, cpp_line, sizeof(cpp_line), 0);
+
+    if(c_len != cpp_len || memcmp(c_line, cpp_line, c_len)){
+        fprintf(stderr, "Lines differ:\n%.*s%.*s", (int)c_len, c_line, (int)cpp_len, cpp_line);
+        return -1;
+    }
+    printf("Both send %.*s", (int)cpp_len, cpp_line);
+
+    //The sink is never read again, so the kernel drops the rest for free
+    int64_t start = now_ns();
+    for(int i = 0; i < POINTS; i++){
+        fieldset[0].value.i = i;
+        fieldset[1].value.f = i * 0.25;
+        ifwr_send(&conn, weather, tagset, fieldset, IFWR_TS_NANOS, 1600000000000000000LL + i);
+    }
+    ifwr_flush(&conn);
+    const int64_t c_ns = now_ns() - start;
+
+    start = now_ns();
+    for(int i = 0; i < POINTS; i++){
+        weather_t::send(&conn, IFWR_TS_NANOS, 1600000000000000000LL + i, city_name, i, i * 0.25, false);
+    }
+    ifwr_flush(&conn);
+    const int64_t cpp_ns = now_ns() - start;
+
+    printf("ifwr_send():       %6.1f ns/point\n", (double)c_ns / POINTS);
+    printf("weather_t::send(): %6.1f ns/point\n", (double)cpp_ns / POINTS);
+
+    ifwr_close(&conn);
+    close(sink);
+    return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * example-transports.c
+ *
+ * Per point cost of an unbatched ifwr_send() and ifwr_response() over loopback
+ * TCP and over a UNIX domain socket. Each is answered by a tiny HTTP server
+ * thread of our own, so no InfluxDB is needed and only the transport differs.
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#define _POSIX_C_SOURCE  200809L
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "influx-writer.h"
+
+#define POINTS (20 * 1000)
+
+static const char reply[] = "HTTP/1.1 204 No Content\r\n\r\n";
+
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000 * 1000LL + ts.tv_nsec;
+}
+
+
+//Answer every request on the first connection with a 204, until it closes
+static void* sink_serve(void* arg)
+{
+    const int lfd = (int)(intptr_t)arg;
+    const int fd = accept(lfd, NULL, NULL);
+    if(fd < 0){
+        return NULL;
+    }
+
+    char buff[IFWR_MAX_MSG * 2];
+    int len = 0;
+    for(;;){
+        const ssize_t ret = read(fd, buff + len, sizeof(buff) - len);
+        if(ret <= 0){
+            break;
+        }
+        len += ret;
+
+        //Whole requests only, the body is as long as the header says
+        for(;;){
+            const char* hdr_end = memmem(buff, len, "\r\n\r\n", 4);
+            if(!hdr_end){
+                break;
+            }
+            const char* cl = memmem(buff, hdr_end - buff, "Content-Length: ", 16);
+            const int req_len = hdr_end + 4 - buff + (cl ? atoi(cl + 16) : 0);
+            if(req_len > len){
+                break;
+            }
+            if(write(fd, reply, sizeof(reply) - 1) < 0){
+                goto done;
+            }
+            len -= req_len;
+            memmove(buff, buff + req_len, len);
+        }
+    }
+
+done:
+    close(fd);
+    return NULL;
+}
+
+
+static int sink_tcp(int* port)
+{
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if(fd < 0 || bind(fd, (struct sockaddr*)&addr, len) || listen(fd, 1) ||
+            getsockname(fd, (struct sockaddr*)&addr, &len)){
+        return -1;
+    }
+
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+
+static int sink_unix(const char* path)
+{
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, 1)){
+        return -1;
+    }
+
+    return fd;
+}
+
+
+//Send POINTS points one request at a time, and return the ns per point
+static double run(const char* name, ifwr_conn_t* conn, int lfd)
+{
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, sink_serve, (void*)(intptr_t)lfd)){
+        fprintf(stderr, "Could not start the %s server\n", name);
+        return -1;
+    }
+
+    conn->org = "org";
+    conn->bucket = "bucket";
+    conn->token = "token";
+    if(ifwr_connect(conn)){
+        fprintf(stderr, "Could not connect over %s. Error: %s\n", name, ifwr_lasterr_str(conn));
+        return -1;
+    }
+
+    ifwr_ktv_t tagset[] = {
+        { .type=IFWR_TYPE_STRING, .key = "city", .value.s = "Perth" },
+        { .type=IFWR_TYPE_STOP }
+    };
+    ifwr_ktv_t fieldset[] = {
+        { .type=IFWR_TYPE_INT,   .key = "temperature", .value.i = 0   },
+        { .type=IFWR_TYPE_FLOAT, .key = "pressure",    .value.f = 0.0 },
+        { .type=IFWR_TYPE_STOP }
+    };
+
+    const int64_t start = now_ns();
+    for(int i = 0; i < POINTS; i++){
+        fieldset[0].value.i = i;
+        fieldset[1].value.f = i * 0.25;
+        if(ifwr_send(conn, "weather", tagset, fieldset, IFWR_TS_NANOS, 1600000000000000000LL + i) < 0 ||
+                ifwr_response(conn)){
+            fprintf(stderr, "Could not send over %s. Error: %s\n", name, ifwr_lasterr_str(conn));
+            return -1;
+        }
+    }
+    const int64_t ns = now_ns() - start;
+
+    ifwr_close(conn);
+    pthread_join(thread, NULL);
+    close(lfd);
+    return (double)ns / POINTS;
+}
+
+
+int main(int argc, char** argv)
+{
+    int port = 0;
+    const int tcp_fd = sink_tcp(&port);
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/ifwr-bench-%i.sock", (int)getpid());
+    const int unix_fd = sink_unix(path);
+    if(tcp_fd < 0 || unix_fd < 0){
+        fprintf(stderr, "Could not open the listening sockets\n");
+        return -1;
+    }
+
+    ifwr_conn_t tcp = {0};
+    tcp.hostname = "127.0.0.1";
+    tcp.port = port;
+    const double tcp_ns = run("TCP", &tcp, tcp_fd);
+
+    ifwr_conn_t local = {0};
+    local.transport = IFWR_TRANSPORT_UNIX;
+    local.sockpath = path;
+    const double unix_ns = run("UNIX", &local, unix_fd);
+
+    unlink(path);
+    if(tcp_ns < 0 || unix_ns < 0){
+        return -1;
+    }
+
+    printf("Loopback TCP: %7.2f us/point\n", tcp_ns / 1000);
+    printf("UNIX socket:  %7.2f us/point\n", unix_ns / 1000);
+    return 0;
+}
@@ -15,46 +15,8 @@
 #include <string.h>
 
 #include "debug.h"
-#include "inih/ini.h"
 #include "influx-writer.h"
-
-//Not a C99 function
-static char* strdup2(const char* src)
-{
-	const int len = strlen(src);
-	char* new = calloc(1,len+1);
-	strcpy(new,src);
-	return new;
-}
-
-
-//Ini file parsing with inih
-#define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
-static int handler(void* user, const char* section, const char* name,
-                   const char* value)
-{
-    ifwr_conn_t* conn = (ifwr_conn_t*)user;
-
-    if (MATCH("influxdb", "hostname")) {
-        conn->hostname = strdup2(value);
-    }
-    else if (MATCH("influxdb", "port")) {
-        conn->port = atoi(value);
-    }
-    else if (MATCH("influxdb", "organization")) {
-        conn->org = strdup2(value);
-    }
-    else if (MATCH("influxdb", "bucket")) {
-        conn->bucket = strdup2(value);
-    }
-    else if (MATCH("influxdb", "token")) {
-        conn->token = strdup2(value);
-    }
-    else {
-        return 0;  /* unknown section/name, error */
-    }
-    return 1;
-}
+#include "config.h"
 
 
 
@@ -62,9 +24,10 @@ int main(int argc, char** argv)
 {
     //Set up the connection parameters
     ifwr_conn_t conn = {0};
+    ifwr_config_t cfg;
 
-    if (ini_parse("example.ini", handler, &conn) < 0) {
-        printf("Can't load 'test.ini'\n");
+    if (ifwr_config_load(&cfg, "example.ini", &conn)) {
+        printf("Can't load 'example.ini'\n");
         return 1;
     }
 
@@ -146,4 +109,5 @@ int main(int argc, char** argv)
 
     // close the connection
     ifwr_close(&conn);
+    ifwr_config_free(&cfg);
 }
@@ -0,0 +1,159 @@
+/*
+ * hist.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#define _POSIX_C_SOURCE  200809L
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "hist.h"
+#include "debug.h"
+
+
+/*
+ * Values below 2^precision get a bucket each. Above that, the bucket index is
+ * the power of two range followed by the top precision bits below the leading
+ * one, so the indices run on without gaps.
+ */
+static int hist_index(int precision, uint64_t value)
+{
+    const uint64_t sub = 1ULL << precision;
+    if(value < sub){
+        return (int)value;
+    }
+
+    const int msb = 63 - __builtin_clzll(value);
+    const int exp = msb - precision;
+    return (int)(((uint64_t)(exp + 1) << precision) | ((value >> exp) & (sub - 1)));
+}
+
+
+//Middle of the range of values that land in this bucket
+static int64_t hist_value(int precision, int idx, int64_t* low_out)
+{
+    const int64_t sub = 1LL << precision;
+    if(idx < sub){
+        *low_out = idx;
+        return idx;
+    }
+
+    const int exp = (idx >> precision) - 1;
+    const int64_t low = ((idx & (sub - 1)) | sub) << exp;
+    *low_out = low;
+    return low + ((1LL << exp) - 1) / 2;
+}
+
+
+int ifwr_hist_init(ifwr_hist_t* hist, int precision, const double* quantiles, int nquantiles,
+        bool buckets)
+{
+    memset(hist, 0, sizeof(*hist));
+
+    precision = precision ? precision : IFWR_HIST_PRECISION;
+    if(precision < 1 || precision > 7){
+        IFWR_DBG("Histogram precision should be in the range [1..7]\n");
+        return -1;
+    }
+
+    if(nquantiles < 0 || nquantiles > IFWR_HIST_MAX_Q || (nquantiles && !quantiles)){
+        IFWR_DBG("Histograms can report up to %i quantiles\n", IFWR_HIST_MAX_Q);
+        return -1;
+    }
+
+    for(int i = 0; i < nquantiles; i++){
+        if(quantiles[i] < 0 || quantiles[i] > 1){
+            IFWR_DBG("Quantile %lf is not in the range [0..1]\n", quantiles[i]);
+            return -1;
+        }
+        hist->quantiles[i] = quantiles[i];
+    }
+
+    //Non-negative int64_t values have their leading one at bit 62 at most
+    hist->nbuckets = (64 - precision) << precision;
+    hist->counts = calloc(hist->nbuckets, sizeof(uint64_t));
+    hist->snap = calloc(hist->nbuckets, sizeof(uint64_t));
+    if(!hist->counts || !hist->snap){
+        IFWR_DBG("Could not allocate %i histogram buckets\n", hist->nbuckets);
+        ifwr_hist_free(hist);
+        return -1;
+    }
+
+    hist->precision = precision;
+    hist->nquantiles = nquantiles;
+    hist->buckets = buckets;
+
+    IFWR_DBG("Success! Histogram with %i buckets\n", hist->nbuckets);
+    return 0;
+}
+
+
+void ifwr_hist_record(ifwr_hist_t* hist, int64_t value)
+{
+    const int idx = hist_index(hist->precision, value < 0 ? 0 : (uint64_t)value);
+    __atomic_fetch_add(&hist->counts[idx], 1, __ATOMIC_RELAXED);
+}
+
+
+int ifwr_hist_fmt(ifwr_hist_t* hist, const char* key, char* buff, int buff_len)
+{
+    //Each bucket is swapped out on its own, so a concurrent record lands
+    //either in this snapshot or the next one, never in neither
+    uint64_t total = 0;
+    for(int i = 0; i < hist->nbuckets; i++){
+        hist->snap[i] = __atomic_exchange_n(&hist->counts[i], 0, __ATOMIC_RELAXED);
+        total += hist->snap[i];
+    }
+
+    int written = snprintf(buff, buff_len, "%s_count=%" PRIu64 "i,", key, total);
+
+    for(int q = 0; q < hist->nquantiles && total && written < buff_len; q++){
+        uint64_t rank = (uint64_t)(hist->quantiles[q] * total + 0.5);
+        rank = rank ? rank : 1;
+
+        int64_t low = 0;
+        int64_t value = 0;
+        uint64_t seen = 0;
+        for(int i = 0; i < hist->nbuckets; i++){
+            seen += hist->snap[i];
+            if(seen >= rank){
+                value = hist_value(hist->precision, i, &low);
+                break;
+            }
+        }
+
+        written += snprintf(buff + written, buff_len - written, "%s_p%g=%" PRIi64 "i,",
+                key, hist->quantiles[q] * 100, value);
+    }
+
+    for(int i = 0; hist->buckets && i < hist->nbuckets && written < buff_len; i++){
+        if(!hist->snap[i]){
+            continue;
+        }
+
+        int64_t low = 0;
+        hist_value(hist->precision, i, &low);
+        written += snprintf(buff + written, buff_len - written, "%s_b%" PRIi64 "=%" PRIu64 "i,",
+                key, low, hist->snap[i]);
+    }
+
+    return written < buff_len ? written : buff_len;
+}
+
+
+void ifwr_hist_free(ifwr_hist_t* hist)
+{
+    free(hist->counts);
+    free(hist->snap);
+    memset(hist, 0, sizeof(*hist));
+}
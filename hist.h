@@ -0,0 +1,79 @@
+/*
+ * hist.h
+ *
+ * A fixed size, log-linear (HDR style) histogram of integer samples, e.g.
+ * latencies in nanoseconds. Every power of two range is split into 2^precision
+ * equal buckets, so the relative error is at most 2^-precision. Recording is
+ * a single atomic increment, so any number of threads can record at once.
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#ifndef IFWR_HIST_H_
+#define IFWR_HIST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//Most quantiles a histogram can report
+#define IFWR_HIST_MAX_Q 16
+
+//Sub-bucket bits used when precision is given as 0. About 3% error.
+#define IFWR_HIST_PRECISION 5
+
+/**
+ * @struct Histogram state. Use it as the value of an IFWR_TYPE_HIST field.
+ */
+typedef struct ifwr_hist
+{
+    int precision;
+    int nbuckets;
+    uint64_t* counts;   //Recorded since the last time it was formatted
+    uint64_t* snap;     //Scratch space for the formatter
+
+    int nquantiles;
+    double quantiles[IFWR_HIST_MAX_Q];
+    bool buckets;       //Also send the count in every non-empty bucket
+} ifwr_hist_t;
+
+
+/**
+ * @brief Set up a histogram. This is the only call that allocates.
+ *
+ * @param[in]	precision
+ * 		Sub-bucket bits in the range [1..7], 0 for IFWR_HIST_PRECISION
+ * @param[in]	quantiles
+ * 		Quantiles to report, each in the range [0..1], e.g. 0.5 and 0.999
+ * @param[in]	nquantiles
+ * 		How many quantiles, up to IFWR_HIST_MAX_Q
+ * @param[in]	buckets
+ * 		Also report the count in every non-empty bucket
+ *
+ * @return 0 on success, -1 on failure
+ */
+int ifwr_hist_init(ifwr_hist_t* hist, int precision, const double* quantiles, int nquantiles,
+        bool buckets);
+
+/**
+ * @brief Record one sample. Negative values are counted as 0. Never blocks,
+ * 		never allocates, safe to call from many threads at once.
+ */
+void ifwr_hist_record(ifwr_hist_t* hist, int64_t value);
+
+/**
+ * @brief Format everything recorded since the last call as line protocol
+ * 		fields ("<key>_count", "<key>_p50", ... "<key>_b<lowest value>"), each
+ * 		followed by a ",", and start counting afresh. Only one thread may
+ * 		format a histogram at a time.
+ *
+ * @return Number of bytes written, or buff_len if the fields don't fit
+ */
+int ifwr_hist_fmt(ifwr_hist_t* hist, const char* key, char* buff, int buff_len);
+
+/**
+ * @brief Free the bucket memory
+ */
+void ifwr_hist_free(ifwr_hist_t* hist);
+
+#endif /* IFWR_HIST_H_ */
@@ -0,0 +1,194 @@
+/*
+ * ifwr-daemon.c
+ *
+ * Drains the shared memory ring that IFWR_TRANSPORT_SHM connections write
+ * into, and sends everything to InfluxDB through one batched connection. Many
+ * producer processes, one socket.
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#define _POSIX_C_SOURCE  200809L
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include "debug.h"
+#include "inih/ini.h"
+#include "influx-writer.h"
+#include "config.h"
+#include "shmring.h"
+
+//Don't hog the writer for too long between linger checks
+#define DRAIN_MAX 4096
+
+//How long to nap when the ring is empty
+#define IDLE_NS (50 * 1000)
+
+typedef struct
+{
+    ifwr_conn_t conn;
+    char* ring_name;
+    uint64_t ring_size;
+    int64_t linger_ns;
+} daemon_cfg_t;
+
+
+//Not a C99 function
+static char* strdup2(const char* src)
+{
+	const int len = strlen(src);
+	char* new = calloc(1,len+1);
+	strcpy(new,src);
+	return new;
+}
+
+
+//Ini file parsing with inih, just the [daemon] section
+#define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
+static int handler(void* user, const char* section, const char* name,
+                   const char* value)
+{
+    daemon_cfg_t* cfg = (daemon_cfg_t*)user;
+    ifwr_conn_t* conn = &cfg->conn;
+
+    if (MATCH("daemon", "ring")) {
+        cfg->ring_name = strdup2(value);
+    }
+    else if (MATCH("daemon", "ring_size")) {
+        cfg->ring_size = strtoull(value, NULL, 10);
+    }
+    else if (MATCH("daemon", "batch_size")) {
+        conn->batch_max = atoi(value);
+    }
+    else if (MATCH("daemon", "linger_ms")) {
+        cfg->linger_ns = atoll(value) * 1000 * 1000;
+    }
+    else if (strcmp(section, "daemon") == 0) {
+        return 0;  /* unknown name, error */
+    }
+    return 1;  /* the rest is for ifwr_config_load() */
+}
+
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+
+int main(int argc, char** argv)
+{
+    const char* ini = argc > 1 ? argv[1] : "ifwr-daemon.ini";
+
+    daemon_cfg_t cfg = {
+        .ring_name = "/ifwr",
+        .ring_size = 16 * 1024 * 1024,
+        .linger_ns = 100 * 1000 * 1000,
+        .conn.batch_max = 1024 * 1024,
+    };
+
+    //Daemon settings first, so batch_size is the default for [batch] max
+    ifwr_config_t ifwr_cfg;
+    if (ini_parse(ini, handler, &cfg) || ifwr_config_load(&ifwr_cfg, ini, &cfg.conn)) {
+        fprintf(stderr, "Can't load '%s'\n", ini);
+        return 1;
+    }
+
+    //Tunables such as [batch] and [memory] can be changed while running
+    if(ifwr_config_watch(&ifwr_cfg) < 0){
+        fprintf(stderr, "Not watching '%s' for changes\n", ini);
+    }
+
+    if(ifwr_connect(&cfg.conn)){
+        fprintf(stderr,"Could not connect to IFDB %s\n",ifwr_lasterr_str(&cfg.conn));
+        ifwr_config_free(&ifwr_cfg);
+        return -1;
+    }
+
+    ifwr_shmring_t ring = {0};
+    if(ifwr_shmring_create(&ring, cfg.ring_name, cfg.ring_size)){
+        fprintf(stderr, "Could not create shared memory ring \"%s\"\n", cfg.ring_name);
+        ifwr_close(&cfg.conn);
+        ifwr_config_free(&ifwr_cfg);
+        return -1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    printf("Draining ring \"%s\" into %s:%i\n", cfg.ring_name, cfg.conn.hostname, cfg.conn.port);
+
+    uint64_t lines = 0;
+    uint64_t failed = 0;
+    int64_t batch_start = 0; //When the oldest unflushed line arrived, 0 if none
+    for(;;){
+        int drained = 0;
+        const void* rec = NULL;
+        uint32_t len = 0;
+        uint16_t tag = 0;
+        while(drained < DRAIN_MAX && (rec = ifwr_shmring_peek(&ring, &len, &tag))){
+            const char* prec = ifwr_shm_prec(tag);
+            if(!prec || ifwr_write_line(&cfg.conn, prec, rec, len) < 0){
+                failed++;
+                fprintf(stderr, "Could not write line. Error: %s\n", ifwr_lasterr_str(&cfg.conn));
+            }
+            ifwr_shmring_release(&ring);
+            drained++;
+        }
+        lines += drained;
+
+        const int64_t now = now_ns();
+        if(drained && !batch_start){
+            batch_start = now;
+        }
+
+        if(batch_start && now - batch_start >= cfg.linger_ns){
+            if(ifwr_flush(&cfg.conn)){
+                char* json_msg = NULL;
+                int http_error = ifwr_http_err(&cfg.conn, &json_msg);
+                fprintf(stderr,"InfluxDB Failure with error code %i, and this message \"%s\"\n", http_error, json_msg);
+            }
+            batch_start = 0;
+        }
+
+        //Once asked to stop, keep going until the ring is empty
+        if(stop && !drained){
+            break;
+        }
+
+        if(!drained && ifwr_config_reload(&ifwr_cfg, &cfg.conn) > 0){
+            printf("Reloaded settings from '%s'\n", ini);
+        }
+
+        if(!drained){
+            struct timespec idle = { .tv_sec = 0, .tv_nsec = IDLE_NS };
+            nanosleep(&idle, NULL);
+        }
+    }
+
+    printf("Stopping after %lu lines (%lu failed)\n", (unsigned long)lines, (unsigned long)failed);
+
+    //ifwr_close() flushes whatever is left in the batch
+    ifwr_close(&cfg.conn);
+    ifwr_shmring_close(&ring, cfg.ring_name);
+    ifwr_config_free(&ifwr_cfg);
+    return 0;
+}
@@ -17,6 +17,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include <stdarg.h>
 #include <libgen.h>
 #include <unistd.h>
@@ -25,17 +27,52 @@
 #include <errno.h>
 #include <time.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <inttypes.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <strings.h>
 
 #include "influx-writer.h"
 #include "debug.h"
+#include "uring.h"
+#include "shmring.h"
+#include "hist.h"
+#include "card.h"
+#include "tsc.h"
+#include "lines.h"
+#include "probe.h"
 
 
 
+//USDT probes, see probe.h. Arguments in brackets.
+IFWR_PROBE_DEFINE(point);       //A point was handed to us (bytes, high priority)
+IFWR_PROBE_DEFINE(batch);       //A batch was sealed to go out (bytes, points, ns the oldest waited)
+IFWR_PROBE_DEFINE(request);     //A POST is about to go out (bytes, port)
+IFWR_PROBE_DEFINE(write_done);  //A blocking http_write() finished (bytes, result, ns taken)
+IFWR_PROBE_DEFINE(response);    //A response was parsed (HTTP status, bytes)
+IFWR_PROBE_DEFINE(response_wait); //A blocking ifwr_response() finished (result, ns taken)
+IFWR_PROBE_DEFINE(reconnect);   //A peer or replica tried to reconnect (port, 0 if it worked)
+IFWR_PROBE_DEFINE(drop);        //Points were thrown away (ifwr_drop_e, how many)
+
+static int64_t mono_ns(void);
+
+
 #define IFWR_SET_ERROR(errno) do { \
 		conn->__private.last_err = errno; \
 } while (0)
 
+//Argument checks on the send path. Build with IFWR_NO_ARG_CHECKS to trust the
+//caller and drop them.
+#ifdef IFWR_NO_ARG_CHECKS
+    #define IFWR_BADARG(x) 0
+#else
+    #define IFWR_BADARG(x) __builtin_expect(!!(x), 0)
+#endif
+
 
 
 
@@ -63,6 +100,8 @@ static char* ifwr_errs_en[] = {
     "No timestamp format type set",
     "Could not get the time from the local Linux clock",
     "Bad HTTP response message",
+    "Outgoing queue is full, try again later",
+    "Dropped a new series beyond the cardinality limit",
 
 	"An unknown error occurred"
 };
@@ -88,15 +127,17 @@ char* ifwr_err2str(ifwr_err_e err)
         case IFWR_ERR_NOTSFMT:      return ifwr_errs_en[14];
         case IFWR_ERR_NOTIME:       return ifwr_errs_en[15];
         case IFWR_ERR_BADHTTP:      return ifwr_errs_en[16];
+        case IFWR_ERR_QFULL:        return ifwr_errs_en[17];
+        case IFWR_ERR_CARDINALITY:  return ifwr_errs_en[18];
 
-		case IFWR_ERR_UNKNOWN: return ifwr_errs_en[17];
+		case IFWR_ERR_UNKNOWN: return ifwr_errs_en[19];
 
 		/* default: Deliberately no default case, let the compiler complain if
 		 * we forget to add new error codes here!
 		 */
 	}
 
-	return ifwr_errs_en[17];
+	return ifwr_errs_en[19];
 }
 
 
@@ -136,511 +177,4662 @@ static int resolve_host(const char* hostname, struct in_addr* out)
 
 
 
-int ifwr_connect(ifwr_conn_t* conn )
+static int http_write(ifwr_conn_t* conn, const char* type, const char* buff, int len)
 {
-	if(!conn){
-		IFWR_DBG("No connection supplied\n");
-		IFWR_SET_ERROR(IFWR_ERR_NULLARG);
-		return -1;
-	}
-
-	if(!conn->hostname){
-		IFWR_DBG("No hostname supplied\n");
-		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
-		return -1;
-	}
+    ifwr_priv_t* const priv = &conn->__private;
 
-	if(conn->port < 0 || conn->port > 65536){
-		IFWR_DBG("Port number should be in the range [0..65536]\n");
-		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
-		return -1;
-	}
+    //Only time the write if someone is watching
+    const int64_t start = IFWR_PROBE_ENABLED(write_done) ? mono_ns() : 0;
 
-	if(!conn->org){
-		IFWR_DBG("No organization ID supplied\n");
-		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
-		return -1;
-	}
+    int written = 0;
+    int attempts_remaing = 1000;
+    IFWR_DBG("Trying to write %i bytes of HTTP %s \"%s\"", len, type, buff);
+    for(;len - written > 0 && attempts_remaing; attempts_remaing--){
+        //A dead server is an error to report, not a signal to die on
+        int ret = send(priv->sockfd, buff + written, len - written, MSG_NOSIGNAL);
+        if(ret < 0){
+            IFWR_ERR("Could not write %s. Error: %s", type, strerror(errno));
+            IFWR_SET_ERROR(IFWR_ERR_WRITEFAIL);
+            written = -1;
+            break;
+        }
+        written += ret;
+    }
 
-	if(!conn->bucket){
-		IFWR_DBG("No bucket ID supplied\n");
-		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
-		return -1;
-	}
+    if(written >= 0 && (written != len || attempts_remaing <= 0)){
+        IFWR_DBG("Error could not write values! Tried 1000 times but failed\n");
+        IFWR_SET_ERROR(IFWR_ERR_WRITEFAIL);
+        written = -1;
+    }
 
-	if(!conn->token){
-		IFWR_DBG("No authorization token supplied\n");
-		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
-		return -1;
-	}
+    if(start){
+        IFWR_PROBE3(write_done, len, written, mono_ns() - start);
+    }
 
-	ifwr_priv_t* const priv = &conn->__private;
+    IFWR_DBG("%s wrote %i of %i bytes of HTTP %s\n", written < 0 ? "Error" : "Success!", written, len, type);
+    return written;
+}
 
-	priv->sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (priv->sockfd == -1) {
-		IFWR_DBG("Socket creation failed...\n");
-		IFWR_SET_ERROR(IFWR_ERR_SOCKET);
-		return -1;
-	}
 
-	IFWR_DBG("Socket successfully created..\n");
+//Fixed buffer slots. The sender's batch is in the first, then every
+//connection on the ring has a pair for its header and its response.
+enum {
+    URING_BUF_BATCH = 0,
+    URING_BUF_HDR,
+    URING_BUF_RX,
+};
 
-	struct sockaddr_in servaddr = {0};
-	if(resolve_host(conn->hostname,&servaddr.sin_addr)){
-		IFWR_DBG("Error, could not resolve hostname %s\n", conn->hostname);
-		IFWR_SET_ERROR(IFWR_ERR_HOSTNAME);
-		return -1;
-	}
+#define URING_BUFS (1 + 2 * (IFWR_MAX_ENDPOINTS + 1))
 
-	servaddr.sin_family         = AF_INET;
-	servaddr.sin_port           = htons(conn->port);
+//The op goes in the low bits of a completion's user_data, and the connection
+//it belongs to in the rest
+enum {
+    URING_UD_TIMEOUT = 0,   //Nothing to do, the receive says what happened
+    URING_UD_HDR,
+    URING_UD_BODY,
+    URING_UD_RX,
+    URING_UD_MASK = 3,
+};
 
-	// connect the client socket to server socket
-	if (connect(priv->sockfd, (struct sockaddr*)&servaddr, sizeof(servaddr)) != 0) {
-		IFWR_DBG("connection with the server failed...\n");
-		IFWR_SET_ERROR(IFWR_ERR_CONNECT);
-		return -1;
-	}
+//Enough for every connection on the ring to have a request and a response
+//outstanding without the completion queue overflowing
+#define URING_ENTRIES 32
 
-	IFWR_DBG("Success! Connected to the server %s:%i..\n",
-			conn->hostname,
-			conn->port);
+//One io_uring for a sender and all of its load balanced endpoints. Whichever
+//of them is waiting reaps completions for all of them.
+struct ifwr_ring
+{
+    ifwr_uring_t uring;
+    int refs;
+    bool fixed;             //Fixed buffer slots are available
+    unsigned pairs;         //Header and response slot pairs in use, one bit each
+    const char* batch;      //The sender's batch, NULL if none
+    int batch_len;
+    bool batch_fixed;       //... and it is in URING_BUF_BATCH
+};
 
-	return 0;
-}
+#define REACTOR_EVENTS 64
 
-void ifwr_close(ifwr_conn_t* conn)
+struct ifwr_reactor
 {
-    if(!conn){
-        IFWR_DBG("No connection state supplied\n");
-        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
-        return;
-    }
+    int epfd;
+    struct epoll_event events[REACTOR_EVENTS];
+    int ready; //Events collected by ifwr_poll() waiting for ifwr_process()
+};
 
+//Make a ring for conn, with its batch registered, for its endpoints to share
+static struct ifwr_ring* uring_new(ifwr_conn_t* conn)
+{
     ifwr_priv_t* const priv = &conn->__private;
-    close(priv->sockfd);
 
-    IFWR_DBG("Success! Closed the socket!\n");
+    struct ifwr_ring* ring = calloc(1, sizeof(struct ifwr_ring));
+    if(!ring){
+        IFWR_WARN("Could not allocate io_uring state, using blocking I/O\n");
+        return NULL;
+    }
 
-}
+    if(ifwr_uring_init(&ring->uring, URING_ENTRIES)){
+        IFWR_WARN("io_uring is not available, using blocking I/O\n");
+        free(ring);
+        return NULL;
+    }
 
+    //Older kernels can still do plain reads and writes
+    ring->fixed = !ifwr_uring_register_sparse(&ring->uring, URING_BUFS);
+    if(!ring->fixed){
+        IFWR_WARN("Could not register io_uring buffers, using unregistered ones\n");
+    }
 
-int ifwr_set_measurement(ifwr_conn_t* conn, char* measurement)
-{
-	if(!conn){
-		IFWR_DBG("No connection supplied\n");
-		IFWR_SET_ERROR(IFWR_ERR_NULLARG);
-		return -1;
-	}
+    ring->batch = priv->batch;
+    ring->batch_len = priv->batch_cap;
+    const struct iovec iov = { .iov_base = priv->batch, .iov_len = priv->batch_cap };
+    ring->batch_fixed = ring->fixed && priv->batch &&
+            !ifwr_uring_update_buffers(&ring->uring, URING_BUF_BATCH, &iov, 1);
 
-	if(!measurement){
-		IFWR_DBG("No measurement name supplied\n");
-		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
-		return -1;
-	}
+    ring->refs = 1;
+    return ring;
+}
 
-	ifwr_priv_t* const priv = &conn->__private;
 
-	priv->default_measurement = measurement;
+static void uring_put(struct ifwr_ring* ring)
+{
+    if(--ring->refs){
+        return;
+    }
 
-	IFWR_DBG("Success! Set the default measuremt to \"%s\"\n", measurement);
-	return 0;
+    ifwr_uring_free(&ring->uring);
+    free(ring);
 }
 
 
-static int ifwr_fmt_set(
-		ifwr_conn_t* conn,
-		ifwr_ktv_t* values,
-		int len,
-		char* buff,
-		const char* settype //"tag"set or "field"set
-)
+//Join the ring (a new one if share is NULL), and register our own buffers
+static void uring_setup(ifwr_conn_t* conn, struct ifwr_ring* share)
 {
-	if(!conn){
-		IFWR_DBG("No connection state supplied\n");
-		IFWR_SET_ERROR(IFWR_ERR_NULLARG);
-		return -1;
-	}
-
-	if(!buff){
-		IFWR_DBG("No outut buffer supplied\n");
-		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
-		return -1;
-	}
-
-	if(len < 0){
-		IFWR_DBG("No output buffer supplied\n");
-		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
-		return -1;
-	}
+    ifwr_priv_t* const priv = &conn->__private;
 
-	if(len > IFWR_MAX_MSG){
-		IFWR_DBG("Buffer is too big\n");
-		IFWR_SET_ERROR(IFWR_ERR_MSGTOOBIG);
-		return -1;
-	}
+    struct ifwr_ring* ring = share;
+    if(ring){
+        ring->refs++;
+    }
+    else if(!(ring = uring_new(conn))){
+        return;
+    }
 
-	int off = 0;
-	for(ifwr_ktv_t* v = values;  v->type != IFWR_TYPE_STOP; v++){
-		switch(v->type){
-		case IFWR_TYPE_INT:
-			off += snprintf(buff + off, len - off, "%s=%" PRIu64 "i,", v->key, v->value.i);
-			continue;
-		case IFWR_TYPE_FLOAT:
-			off += snprintf(buff + off, len - off, "%s=%lf,", v->key, v->value.f);
-			continue;
-		case IFWR_TYPE_STRING:
-			off += snprintf(buff + off, len - off, "%s=\"%s\",", v->key, v->value.s);
-			continue;
-		case IFWR_TYPE_BOOL:
-			if(v->value.b)
-				off += snprintf(buff + off, len - off, "%s=True,", v->key);
-			else
-				off += snprintf(buff + off, len - off, "%s=False,", v->key);
-			continue;
-		default:
-			IFWR_DBG("Unexpected type %i\n", v->type);
-			IFWR_SET_ERROR(IFWR_ERR_UNKNOWN);
-			return -1;
-		}
-	}
+    priv->uring = ring;
+    priv->uring_buf = -1;
+    priv->uring_writes = 0;
+    priv->uring_hdr_len = 0;
+    priv->uring_rx_pending = false;
+    priv->uring_rx_done = false;
 
-	/*
-	 * As we exit this function, we have one too many trailing commas, remove
-	 * and terminate the string properly.
-	 */
-	buff[off] = 0;
-	off--;
+    const int pair = ring->fixed ? __builtin_ffs(~ring->pairs) - 1 : -1;
+    if(pair < 0 || pair > IFWR_MAX_ENDPOINTS){
+        IFWR_DBG("Using io_uring with unregistered buffers\n");
+        return;
+    }
 
-	IFWR_DBG("Successfully formatted %sset \"%s\"\n", settype, buff);
-	return off;
+    const int slot = URING_BUF_HDR + 2 * pair;
+    const struct iovec iovs[] = {
+        { .iov_base = priv->tx_hdr,  .iov_len = IFWR_MAX_HDR },
+        { .iov_base = priv->rx_buff, .iov_len = IFWR_MAX_MSG },
+    };
+    if(ifwr_uring_update_buffers(&ring->uring, slot, iovs, 2)){
+        IFWR_WARN("Could not register io_uring buffers, using unregistered ones\n");
+        return;
+    }
 
+    ring->pairs |= 1u << pair;
+    priv->uring_buf = slot;
+    IFWR_DBG("Success! Using io_uring for I/O\n");
 }
 
-int ifwr_fmt_tagset(ifwr_conn_t* conn, ifwr_ktv_t* values, int len, char* buff)
-{
-	return ifwr_fmt_set(conn, values, len, buff, "tag");
-}
 
+//Datagrams handed to the kernel per sendmmsg() call
+#define DGRAM_VLEN 64
 
-int ifwr_set_tagset(ifwr_conn_t* conn, char* tagset)
+struct ifwr_dgram
 {
-	if(!conn){
-		IFWR_DBG("No connection supplied\n");
-		IFWR_SET_ERROR(IFWR_ERR_NULLARG);
-		return -1;
-	}
-
-	if(!tagset){
-		IFWR_DBG("No tagset name supplied\n");
-		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
-		return -1;
-	}
+    int mtu;
+    int count; //Datagrams holding data, the last one is still being filled
+    struct mmsghdr msgs[DGRAM_VLEN];
+    struct iovec iovs[DGRAM_VLEN];
+    char buff[];
+};
 
-	ifwr_priv_t* const priv = &conn->__private;
+static int dgram_setup(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
 
-	priv->default_tagset = tagset;
+    if(conn->io != IFWR_IO_BLOCKING){
+        IFWR_WARN("I/O backends only apply to HTTP, sending datagrams with sendmmsg()\n");
+    }
 
-	IFWR_DBG("Success! Set the default tagset to \"%s\"\n", tagset);
-	return 0;
-}
+    if(conn->batch_max){
+        IFWR_WARN("Datagrams are packed up to the MTU, batch_max is ignored\n");
+    }
 
+    const int mtu_default = conn->transport == IFWR_TRANSPORT_UNIXGRAM ?
+            IFWR_DGRAM_UNIX_MTU : IFWR_DGRAM_MTU;
+    const int mtu = conn->mtu ? conn->mtu : mtu_default;
+    struct ifwr_dgram* dgram = calloc(1, sizeof(struct ifwr_dgram) + DGRAM_VLEN * mtu);
+    if(!dgram){
+        IFWR_DBG("Could not allocate %i datagram buffers\n", DGRAM_VLEN);
+        IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+        return -1;
+    }
 
+    dgram->mtu = mtu;
+    for(int i = 0; i < DGRAM_VLEN; i++){
+        dgram->iovs[i].iov_base = dgram->buff + i * mtu;
+        dgram->msgs[i].msg_hdr.msg_iov = &dgram->iovs[i];
+        dgram->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
 
-int ifwr_fmt_fieldset(ifwr_conn_t* conn, ifwr_ktv_t* values, int len, char* buff)
-{
-	return ifwr_fmt_set(conn, values, len, buff, "field");
+    priv->dgram = dgram;
+    IFWR_DBG("Success! Packing up to %i datagrams of %i bytes\n", DGRAM_VLEN, mtu);
+    return 0;
 }
 
-static int http_write(ifwr_conn_t* conn, const char* type, const char* buff, int len)
+
+static int shm_setup(ifwr_conn_t* conn)
 {
     ifwr_priv_t* const priv = &conn->__private;
 
-    int written = 0;
-    int attempts_remaing = 1000;
-    IFWR_DBG("Trying to write %i bytes of HTTP %s \"%s\"", len, type, buff);
-    for(;len - written > 0 && attempts_remaing; attempts_remaing--){
-        int ret = write(priv->sockfd, buff + written, len - written);
-        if(ret < 0){
-            IFWR_ERR("Could not write %s. Error: %s", type, strerror(errno));
-            IFWR_SET_ERROR(IFWR_ERR_WRITEFAIL);
-            return -1;
-        }
-        written += ret;
+    //No socket of our own, the daemon on the other side of the ring has it
+    priv->sockfd = -1;
+
+    ifwr_shmring_t* ring = calloc(1, sizeof(ifwr_shmring_t));
+    if(!ring){
+        IFWR_DBG("Could not allocate ring state\n");
+        IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+        return -1;
     }
 
-    if(written != len || attempts_remaing <= 0){
-        IFWR_DBG("Error could not write values! Tried 1000 times but failed\n");
-        IFWR_SET_ERROR(IFWR_ERR_WRITEFAIL);
+    if(ifwr_shmring_open(ring, conn->shmname)){
+        IFWR_DBG("Could not open ring \"%s\". Is ifwr-daemon running?\n", conn->shmname);
+        IFWR_SET_ERROR(IFWR_ERR_CONNECT);
+        free(ring);
         return -1;
     }
 
-    IFWR_DBG("Success! Wrote %i bytes of HTTP %s\n", written);
-    return written;
+    priv->shm = ring;
+    IFWR_DBG("Success! Writing to shared memory ring \"%s\"\n", conn->shmname);
+    return 0;
 }
 
 
-static int http_post_header(ifwr_conn_t* conn, int content_len, const char* prec)
+struct ifwr_series
 {
-    char buff[IFWR_MAX_MSG] = {0};
+    char* prefix;       //"measurement,tags ", rendered once
+    int prefix_len;
+    int nfields;
+    ifwr_type_e* types;
+    char** keys;
+    struct ifwr_agg* agg; //Set by ifwr_series_aggregate()
+    struct ifwr_dedup* dedup; //Set by ifwr_series_deadband()
+    struct ifwr_counter* counter; //Set by ifwr_series_counter()
+    char* bucket;       //Set by ifwr_series_bucket()
+    bool high;          //Set by ifwr_series_priority()
+};
 
-    int header_len = snprintf(buff, IFWR_MAX_MSG, "POST /api/v2/write?org=%s&bucket=%s&precision=%s HTTP/1.1\r\nHost: %s:%i\r\nContent-Length: %i\r\nContent-Encoding: identity\r\nContent-Type: text/plain\r\nAccept: application/json\r\nAuthorization: Token %s\r\nUser-Agent: exact-capture-influx 1.0\r\n\r\n",
-        conn->org,
-		conn->bucket,
-		prec,
-		conn->hostname,
-		conn->port,
-        content_len,
-		conn->token);
+struct ifwr_counter
+{
+    unsigned outputs;   //ifwr_ctr_e flags
+    uint64_t mask;      //Counters wrap at mask + 1
+    bool primed;        //There is a previous point to diff against
+    ifwr_fmt_e ts_fmt;  //Of the previous point
+    int64_t ts_val;
+    int64_t prev[];     //Previous value of each field
+};
 
-   return http_write(conn, "Header", buff, header_len);
-}
+//Running aggregates for one field. Ints are kept as ints, floats as floats.
+typedef struct
+{
+    ifwr_value_u min;
+    ifwr_value_u max;
+    ifwr_value_u sum;
+    ifwr_value_u last;
+} agg_field_t;
 
+struct ifwr_dedup
+{
+    double abs;         //Float deadbands
+    double rel;
+    int64_t heartbeat;  //Send at least this often, in point timestamp units
+    bool sent;          //Nothing to compare against until the first send
+    ifwr_fmt_e ts_fmt;  //Of the last point sent
+    int64_t ts_val;
+    ifwr_value_u last[]; //Strings are copies
+};
 
-static int http_post_content(ifwr_conn_t* conn, const char* content, int content_len)
+struct ifwr_agg
 {
-    return http_write(conn, "Content", content, content_len);
-}
+    int64_t window;     //In units of the sample timestamps
+    unsigned aggs;      //ifwr_agg_e flags to emit
+    ifwr_fmt_e ts_fmt;  //Of the open window
+    int64_t start;      //Of the open window
+    int64_t count;      //Samples in the open window, 0 if none is open
+    agg_field_t fields[];
+};
 
+//What ifwr_send_series() queues in lazy mode. The ring tag is the series.
+typedef struct
+{
+    int64_t ts_val;
+    int32_t ts_fmt;
+    int32_t nvalues;
+    ifwr_value_u values[];
+} lazy_rec_t;
 
 
-__attribute__((__format__ (__printf__, 3, 4)))
-int ifwr_write_raw(ifwr_conn_t* conn, const char* prec, const char* format, ... )
+//Like io_uring, a missing TSC is not fatal, the normal clock will do
+static void tsc_setup(ifwr_conn_t* conn)
 {
-    char content[IFWR_MAX_MSG] = {0};
-    va_list args;
-    va_start(args,format);
-    int content_len = vsnprintf(content, IFWR_MAX_MSG,format, args);
-    va_end(args);
+    ifwr_priv_t* const priv = &conn->__private;
 
-    int sent_bytes = 0;
-    int ret = http_post_header(conn, content_len, prec);
-    if(ret < 0){
-        IFWR_ERR("Could not send HTTP header!");
-        return -1;
+    ifwr_tsc_t* tsc = calloc(1, sizeof(ifwr_tsc_t));
+    if(!tsc){
+        IFWR_WARN("Could not allocate TSC clock state, using CLOCK_REALTIME\n");
+        return;
     }
-    sent_bytes += ret;
 
-    ret = http_post_content(conn,content, content_len);
-    if(ret < 0){
-        IFWR_SET_ERROR(IFWR_ERR_NOCONTENT);
-        ifwr_close(conn);
-        IFWR_FAT("HTTP Header sent, but content failed to send. Closing. Nothing useful to be done here!\n");
-        return -1;
+    if(ifwr_tsc_init(tsc, 0)){
+        IFWR_WARN("TSC clock unavailable, using CLOCK_REALTIME\n");
+        free(tsc);
+        return;
     }
-    sent_bytes += ret;
 
-    return sent_bytes;
+    priv->tsc = tsc;
+}
+
+
+static ifwr_shmring_t* lazy_ring(ifwr_conn_t* conn)
+{
+    ifwr_shmring_t* ring = calloc(1, sizeof(ifwr_shmring_t));
+    if(!ring){
+        IFWR_DBG("Could not allocate lazy queue state\n");
+        IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+        return NULL;
+    }
+
+    if(ifwr_shmring_create_anon(ring, conn->lazy_queue)){
+        IFWR_DBG("Could not create %i byte lazy queue\n", conn->lazy_queue);
+        IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+        free(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+
+static int lazy_setup(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    priv->lazy = lazy_ring(conn);
+    if(!priv->lazy){
+        return -1;
+    }
+
+    IFWR_DBG("Success! Queuing binary records, formatting them on flush\n");
+    return 0;
+}
+
+
+static int batch_setup(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    //Lazy records are formatted in bulk at flush time, so they always go out in batches
+    const int batch_max = conn->batch_max || !conn->lazy_queue ? conn->batch_max : IFWR_MAX_MSG;
+    if(batch_max){
+        priv->batch = calloc(1, batch_max);
+        if(!priv->batch){
+            IFWR_DBG("Could not allocate %i byte batch buffer\n", batch_max);
+            IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+            return -1;
+        }
+        priv->batch_cap  = batch_max;
+        priv->batch_len  = 0;
+        priv->batch_prec = NULL;
+
+        if((conn->batch_sort || conn->batch_coalesce) && !(priv->lines = calloc(1, sizeof(ifwr_lines_t)))){
+            IFWR_DBG("Could not allocate batch sort index\n");
+            IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+//A connect() that gives up after timeout_ms, so that a dead server can't hold
+//up whoever is reconnecting to it. With no timeout it waits as long as the
+//kernel does.
+static int sock_connect(int fd, const struct sockaddr* addr, socklen_t addr_len, int timeout_ms)
+{
+    if(!timeout_ms){
+        return connect(fd, addr, addr_len);
+    }
+
+    const int flags = fcntl(fd, F_GETFL, 0);
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0){
+        return -1;
+    }
+
+    int err = connect(fd, addr, addr_len) ? errno : 0;
+    if(err == EINPROGRESS){
+        struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+        const int ret = poll(&pfd, 1, timeout_ms);
+        socklen_t len = sizeof(err);
+        err = ret < 0 ? errno : !ret ? ETIMEDOUT :
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 ? errno : err;
+    }
+
+    if(err){
+        IFWR_DBG("Could not connect within %ims: %s\n", timeout_ms, strerror(err));
+    }
+
+    fcntl(fd, F_SETFL, flags);
+    errno = err;
+    return err ? -1 : 0;
+}
+
+
+//Blocking sends and receives give up after ms, or never if it is 0
+static int sock_timeouts(int fd, int ms)
+{
+    const struct timeval tv = { .tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000 };
+    if(setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0 ||
+       setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0){
+        IFWR_DBG("Could not set socket timeouts: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int peers_setup(ifwr_conn_t* conn);
+static struct ifwr_ring* peer_ring(const struct ifwr_peer* p);
+static int spill_setup(ifwr_conn_t* conn);
+static void uring_leave(ifwr_conn_t* conn);
+static void peers_free(ifwr_conn_t* conn);
+static void spill_free(ifwr_conn_t* conn);
+
+//Undo whatever ifwr_connect() got through before it failed. Unlike
+//ifwr_close() there is nothing to flush, and series prepared beforehand are
+//left alone. Always returns -1.
+static int connect_fail(ifwr_conn_t* conn)
+{
+	ifwr_priv_t* const priv = &conn->__private;
+
+	if(priv->uring){
+		uring_leave(conn);
+	}
+
+	if(priv->sockfd >= 0){
+		close(priv->sockfd);
+		priv->sockfd = -1;
+	}
+
+	peers_free(conn);
+	spill_free(conn);
+
+	if(priv->lazy){
+		ifwr_shmring_close(priv->lazy, NULL);
+		free(priv->lazy);
+		priv->lazy = NULL;
+	}
+
+	free(priv->tsc);
+	priv->tsc = NULL;
+
+	free(priv->dgram);
+	priv->dgram = NULL;
+
+	free(priv->batch);
+	priv->batch = NULL;
+	priv->batch_cap = 0;
+
+	if(priv->lines){
+		ifwr_lines_free(priv->lines);
+		free(priv->lines);
+		priv->lines = NULL;
+	}
+
+	return -1;
+}
+
+int ifwr_connect(ifwr_conn_t* conn )
+{
+	if(!conn){
+		IFWR_DBG("No connection supplied\n");
+		IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+		return -1;
+	}
+
+	const bool http  = conn->transport == IFWR_TRANSPORT_HTTP ||
+	                   conn->transport == IFWR_TRANSPORT_UNIX;
+	const bool local = conn->transport == IFWR_TRANSPORT_UNIX ||
+	                   conn->transport == IFWR_TRANSPORT_UNIXGRAM;
+
+	const bool shm   = conn->transport == IFWR_TRANSPORT_SHM;
+
+	const bool peers = conn->nendpoints > 0;
+
+	if(!local && !shm && !peers && !conn->hostname){
+		IFWR_DBG("No hostname supplied\n");
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(!local && !shm && !peers && (conn->port < 0 || conn->port > 65536)){
+		IFWR_DBG("Port number should be in the range [0..65536]\n");
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	struct sockaddr_un unaddr = {0};
+
+	if(local && !conn->sockpath){
+		IFWR_DBG("No socket path supplied\n");
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(local && strlen(conn->sockpath) >= sizeof(unaddr.sun_path)){
+		IFWR_DBG("Socket path is longer than %zu bytes\n", sizeof(unaddr.sun_path) - 1);
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(shm && !conn->shmname){
+		IFWR_DBG("No shared memory ring name supplied\n");
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(http && !conn->org){
+		IFWR_DBG("No organization ID supplied\n");
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(http && !conn->bucket){
+		IFWR_DBG("No bucket ID supplied\n");
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(http && !conn->token){
+		IFWR_DBG("No authorization token supplied\n");
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(conn->mtu < 0 || conn->mtu > IFWR_MAX_MSG){
+		IFWR_DBG("Datagram size should be in the range [0..%i]\n", IFWR_MAX_MSG);
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(conn->batch_max < 0 || conn->batch_max > IFWR_MAX_BATCH){
+		IFWR_DBG("Batch size should be in the range [0..%i]\n", IFWR_MAX_BATCH);
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(conn->lazy_queue < 0){
+		IFWR_DBG("Lazy queue size cannot be negative\n");
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(conn->prio_delay_us < 0){
+		IFWR_DBG("High priority delay cannot be negative\n");
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(conn->clock < IFWR_CLOCK_REALTIME || conn->clock > IFWR_CLOCK_BATCH){
+		IFWR_DBG("Unknown clock source %i\n", conn->clock);
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(conn->nendpoints < 0 || conn->nendpoints > IFWR_MAX_ENDPOINTS || (peers && !conn->endpoints)){
+		IFWR_DBG("Number of endpoints should be in the range [0..%i]\n", IFWR_MAX_ENDPOINTS);
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(peers && conn->transport != IFWR_TRANSPORT_HTTP){
+		IFWR_DBG("Endpoints are only supported for HTTP over TCP\n");
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(conn->lb < IFWR_LB_FAILOVER || conn->lb > IFWR_LB_LEAST_OUTSTANDING || conn->lb_max_latency_ms < 0){
+		IFWR_DBG("Unknown load balancing policy %i\n", conn->lb);
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(conn->overflow < IFWR_OVERFLOW_DROP_NEWEST || conn->overflow > IFWR_OVERFLOW_SPILL ||
+			conn->mem_budget < 0 || conn->block_timeout_ms < 0){
+		IFWR_DBG("Unknown overflow policy %i\n", conn->overflow);
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(conn->overflow == IFWR_OVERFLOW_SPILL && (!conn->spill_path || peers)){
+		IFWR_DBG("Spilling needs a spill path, and can't be used with endpoints\n");
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	ifwr_priv_t* const priv = &conn->__private;
+
+	//Nothing of ours yet, for connect_fail()
+	priv->sockfd = -1;
+
+	if(conn->clock == IFWR_CLOCK_TSC){
+		tsc_setup(conn);
+	}
+
+	if(conn->lazy_queue && lazy_setup(conn)){
+		return connect_fail(conn);
+	}
+
+	if(conn->overflow == IFWR_OVERFLOW_SPILL && spill_setup(conn)){
+		return connect_fail(conn);
+	}
+
+	if(shm){
+		return shm_setup(conn) ? connect_fail(conn) : 0;
+	}
+
+	//Requests go out on the endpoints' own connections, never on this one
+	if(peers){
+		if(batch_setup(conn)){
+			return connect_fail(conn);
+		}
+		//The endpoints share one ring, with our batch registered in it
+		if(conn->io == IFWR_IO_URING){
+			priv->uring = uring_new(conn);
+		}
+		return peers_setup(conn) ? connect_fail(conn) : 0;
+	}
+
+	priv->sockfd = socket(local ? AF_UNIX : AF_INET, http ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if (priv->sockfd == -1) {
+		IFWR_DBG("Socket creation failed...\n");
+		IFWR_SET_ERROR(IFWR_ERR_SOCKET);
+		return connect_fail(conn);
+	}
+
+	IFWR_DBG("Socket successfully created..\n");
+
+	struct sockaddr_in servaddr = {0};
+	struct sockaddr* addr = (struct sockaddr*)&servaddr;
+	socklen_t addr_len = sizeof(servaddr);
+	if(local){
+		unaddr.sun_family = AF_UNIX;
+		strcpy(unaddr.sun_path, conn->sockpath);
+		addr = (struct sockaddr*)&unaddr;
+		addr_len = sizeof(unaddr);
+	}
+	else{
+		if(resolve_host(conn->hostname,&servaddr.sin_addr)){
+			IFWR_DBG("Error, could not resolve hostname %s\n", conn->hostname);
+			IFWR_SET_ERROR(IFWR_ERR_HOSTNAME);
+			return connect_fail(conn);
+		}
+
+		servaddr.sin_family         = AF_INET;
+		servaddr.sin_port           = htons(conn->port);
+	}
+
+	// connect the client socket to server socket
+	if (sock_connect(priv->sockfd, addr, addr_len, priv->timeout_ms) != 0) {
+		IFWR_DBG("connection with the server failed...\n");
+		IFWR_SET_ERROR(IFWR_ERR_CONNECT);
+		return connect_fail(conn);
+	}
+
+	if(priv->timeout_ms && sock_timeouts(priv->sockfd, priv->timeout_ms)){
+		IFWR_SET_ERROR(IFWR_ERR_SOCKET);
+		return connect_fail(conn);
+	}
+
+	if(local){
+		IFWR_DBG("Success! Connected to the server at %s..\n", conn->sockpath);
+	}
+	else{
+		IFWR_DBG("Success! Connected to the server %s:%i..\n",
+				conn->hostname,
+				conn->port);
+	}
+
+	if(!http){
+		return dgram_setup(conn) ? connect_fail(conn) : 0;
+	}
+
+	//Header and body go out in separate writes. With Nagle on, the body sits
+	//waiting for the server to ACK the header, which it delays.
+	const int nodelay = 1;
+	if(!local && setsockopt(priv->sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) < 0){
+		IFWR_WARN("Could not turn off Nagle's algorithm: %s\n", strerror(errno));
+	}
+
+	if(conn->io == IFWR_IO_REACTOR){
+		const int flags = fcntl(priv->sockfd, F_GETFL, 0);
+		if(flags < 0 || fcntl(priv->sockfd, F_SETFL, flags | O_NONBLOCK) < 0){
+			IFWR_DBG("Could not make socket non-blocking: %s\n", strerror(errno));
+			IFWR_SET_ERROR(IFWR_ERR_SOCKET);
+			return connect_fail(conn);
+		}
+	}
+
+	if(batch_setup(conn)){
+		return connect_fail(conn);
+	}
+
+	if(conn->io == IFWR_IO_URING){
+		uring_setup(conn, priv->peer ? peer_ring(priv->peer) : NULL);
+	}
+
+	return 0;
+}
+
+static int series_close_windows(ifwr_conn_t* conn);
+static void repl_free(ifwr_conn_t* conn);
+static void routes_free(ifwr_conn_t* conn);
+static bool routes_pending(const ifwr_priv_t* priv);
+
+void ifwr_close(ifwr_conn_t* conn)
+{
+    if(!conn){
+        IFWR_DBG("No connection state supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return;
+    }
+
+    ifwr_priv_t* const priv = &conn->__private;
+
+    //Whatever is still queued may belong in windows that are about to close
+    if(priv->lazy && ifwr_flush(conn)){
+        IFWR_ERR("Could not flush queued points on close\n");
+    }
+
+    if(series_close_windows(conn)){
+        IFWR_ERR("Could not send partly filled aggregation windows on close\n");
+    }
+
+    if((priv->batch_len || (priv->dgram && priv->dgram->count) || routes_pending(priv)) && ifwr_flush(conn)){
+        IFWR_ERR("Could not flush batched points on close\n");
+    }
+
+    if(priv->reactor){
+        epoll_ctl(priv->reactor->epfd, EPOLL_CTL_DEL, priv->sockfd, NULL);
+        priv->reactor = NULL;
+    }
+
+    //Don't throw away requests that a non-blocking socket hasn't taken yet
+    if(priv->txq_len - priv->txq_off > 0){
+        const int flags = fcntl(priv->sockfd, F_GETFL, 0);
+        fcntl(priv->sockfd, F_SETFL, flags & ~O_NONBLOCK);
+        http_write(conn, "Queue", priv->txq + priv->txq_off, priv->txq_len - priv->txq_off);
+    }
+
+    if(priv->uring){
+        uring_leave(conn);
+    }
+
+    if(priv->sockfd >= 0){
+        close(priv->sockfd);
+        priv->sockfd = -1;
+    }
+
+    repl_free(conn);
+    peers_free(conn);
+    routes_free(conn);
+
+    if(priv->shm){
+        ifwr_shmring_close(priv->shm, NULL);
+        free(priv->shm);
+        priv->shm = NULL;
+    }
+
+    if(priv->lazy){
+        ifwr_shmring_close(priv->lazy, NULL);
+        free(priv->lazy);
+        priv->lazy = NULL;
+    }
+
+    if(priv->lazy_high){
+        ifwr_shmring_close(priv->lazy_high, NULL);
+        free(priv->lazy_high);
+        priv->lazy_high = NULL;
+    }
+
+    for(int i = 0; i < priv->series_count; i++){
+        struct ifwr_series* series = priv->series[i];
+        free(series->agg);
+        free(series->counter);
+        if(series->dedup){
+            for(int f = 0; f < series->nfields; f++){
+                if(series->types[f] == IFWR_TYPE_STRING){
+                    free(series->dedup->last[f].s);
+                }
+            }
+            free(series->dedup);
+        }
+        for(int f = 0; f < series->nfields; f++){
+            free(series->keys[f]);
+        }
+        free(series->keys);
+        free(series->types);
+        free(series->bucket);
+        free(series->prefix);
+        free(series);
+    }
+    free(priv->series);
+    priv->series = NULL;
+    priv->series_count = 0;
+
+    if(priv->card){
+        ifwr_card_free(priv->card);
+        free(priv->card);
+        priv->card = NULL;
+    }
+
+    free(priv->tsc);
+    priv->tsc = NULL;
+    priv->batch_ts = 0;
+
+    free(priv->txq);
+    priv->txq = NULL;
+    priv->txq_cap = 0;
+    priv->txq_len = 0;
+    priv->txq_off = 0;
+    free(priv->txq_reqs);
+    priv->txq_reqs = NULL;
+    priv->txq_reqs_cap = 0;
+    priv->txq_nreqs = 0;
+    priv->txq_head_sent = 0;
+    spill_free(conn);
+    priv->rx_len = 0;
+    priv->inflight = 0;
+    priv->epollout = false;
+
+    free(priv->dgram);
+    priv->dgram = NULL;
+
+    free(priv->batch);
+    priv->batch = NULL;
+    priv->batch_cap = 0;
+    priv->batch_len = 0;
+
+    if(priv->lines){
+        ifwr_lines_free(priv->lines);
+        free(priv->lines);
+        priv->lines = NULL;
+    }
+
+    IFWR_DBG("Success! Closed the socket!\n");
+
+}
+
+
+int ifwr_set_measurement(ifwr_conn_t* conn, char* measurement)
+{
+	if(!conn){
+		IFWR_DBG("No connection supplied\n");
+		IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+		return -1;
+	}
+
+	if(!measurement){
+		IFWR_DBG("No measurement name supplied\n");
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	ifwr_priv_t* const priv = &conn->__private;
+
+	priv->default_measurement = measurement;
+
+	IFWR_DBG("Success! Set the default measuremt to \"%s\"\n", measurement);
+	return 0;
+}
+
+
+static int ifwr_fmt_set(
+		ifwr_conn_t* conn,
+		ifwr_ktv_t* values,
+		int len,
+		char* buff,
+		const char* settype //"tag"set or "field"set
+)
+{
+	if(IFWR_BADARG(!conn)){
+		IFWR_DBG("No connection state supplied\n");
+		IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+		return -1;
+	}
+
+	if(IFWR_BADARG(!buff)){
+		IFWR_DBG("No outut buffer supplied\n");
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(IFWR_BADARG(len < 0)){
+		IFWR_DBG("No output buffer supplied\n");
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	if(len > IFWR_MAX_MSG){
+		IFWR_DBG("Buffer is too big\n");
+		IFWR_SET_ERROR(IFWR_ERR_MSGTOOBIG);
+		return -1;
+	}
+
+	int off = 0;
+	for(ifwr_ktv_t* v = values;  v->type != IFWR_TYPE_STOP; v++){
+		switch(v->type){
+		case IFWR_TYPE_INT:
+			off += snprintf(buff + off, len - off, "%s=%" PRIu64 "i,", v->key, v->value.i);
+			continue;
+		case IFWR_TYPE_FLOAT:
+			off += snprintf(buff + off, len - off, "%s=%lf,", v->key, v->value.f);
+			continue;
+		case IFWR_TYPE_STRING:
+			off += snprintf(buff + off, len - off, "%s=\"%s\",", v->key, v->value.s);
+			continue;
+		case IFWR_TYPE_BOOL:
+			if(v->value.b)
+				off += snprintf(buff + off, len - off, "%s=True,", v->key);
+			else
+				off += snprintf(buff + off, len - off, "%s=False,", v->key);
+			continue;
+		case IFWR_TYPE_HIST:
+			off += ifwr_hist_fmt(v->value.h, v->key, buff + off, len - off);
+			continue;
+		default:
+			IFWR_DBG("Unexpected type %i\n", v->type);
+			IFWR_SET_ERROR(IFWR_ERR_UNKNOWN);
+			return -1;
+		}
+	}
+
+	/*
+	 * As we exit this function, we have one too many trailing commas, remove
+	 * and terminate the string properly.
+	 */
+	buff[off] = 0;
+	off--;
+
+	IFWR_DBG("Successfully formatted %sset \"%s\"\n", settype, buff);
+	return off;
+
+}
+
+IFWR_HOT int ifwr_fmt_tagset(ifwr_conn_t* conn, ifwr_ktv_t* values, int len, char* buff)
+{
+	return ifwr_fmt_set(conn, values, len, buff, "tag");
+}
+
+
+int ifwr_set_tagset(ifwr_conn_t* conn, char* tagset)
+{
+	if(!conn){
+		IFWR_DBG("No connection supplied\n");
+		IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+		return -1;
+	}
+
+	if(!tagset){
+		IFWR_DBG("No tagset name supplied\n");
+		IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+		return -1;
+	}
+
+	ifwr_priv_t* const priv = &conn->__private;
+
+	priv->default_tagset = tagset;
+
+	IFWR_DBG("Success! Set the default tagset to \"%s\"\n", tagset);
+	return 0;
+}
+
+
+
+IFWR_HOT int ifwr_fmt_fieldset(ifwr_conn_t* conn, ifwr_ktv_t* values, int len, char* buff)
+{
+	return ifwr_fmt_set(conn, values, len, buff, "field");
+}
+
+static int http_fmt_header(ifwr_conn_t* conn, int content_len, const char* prec)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    //There's no host to name on a UNIX socket, but HTTP/1.1 insists on one
+    char host[256] = "localhost";
+    if(conn->transport != IFWR_TRANSPORT_UNIX){
+        snprintf(host, sizeof(host), "%s:%i", conn->hostname, conn->port);
+    }
+
+    int header_len = snprintf(priv->tx_hdr, IFWR_MAX_HDR, "POST /api/v2/write?org=%s&bucket=%s&precision=%s HTTP/1.1\r\nHost: %s\r\nContent-Length: %i\r\nContent-Encoding: identity\r\nContent-Type: text/plain\r\nAccept: application/json\r\nAuthorization: Token %s\r\nUser-Agent: exact-capture-influx 1.0\r\n\r\n",
+        conn->org,
+		priv->post_bucket ? priv->post_bucket : conn->bucket,
+		prec,
+		host,
+        content_len,
+		conn->token);
+
+    if(header_len < 0 || header_len >= IFWR_MAX_HDR){
+        IFWR_ERR("HTTP header does not fit in %i bytes\n", IFWR_MAX_HDR);
+        IFWR_SET_ERROR(IFWR_ERR_NOHEADER);
+        return -1;
+    }
+
+    return header_len;
+}
+
+
+static int http_post_header(ifwr_conn_t* conn, int header_len)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+    return http_write(conn, "Header", priv->tx_hdr, header_len);
+}
+
+
+static int http_post_content(ifwr_conn_t* conn, const char* content, int content_len)
+{
+    return http_write(conn, "Content", content, content_len);
+}
+
+
+//Hand a completion to the connection it belongs to, which may not be the one
+//that reaped it
+static void uring_complete(uint64_t user_data, int res)
+{
+    ifwr_conn_t* const conn = (ifwr_conn_t*)(uintptr_t)(user_data & ~(uint64_t)URING_UD_MASK);
+    ifwr_priv_t* const priv = &conn->__private;
+
+    switch(user_data & URING_UD_MASK){
+    case URING_UD_HDR:
+        priv->uring_hdr_res = res;
+        priv->uring_writes--;
+        break;
+    case URING_UD_BODY:
+        priv->uring_body_res = res;
+        priv->uring_writes--;
+        break;
+    case URING_UD_RX:
+        priv->uring_rx_done = true;
+        priv->uring_rx_res = res;
+        break;
+    }
+}
+
+
+//Take whatever has completed, without waiting
+static void uring_reap_ready(struct ifwr_ring* ring)
+{
+    uint64_t ud = 0;
+    int res = 0;
+    while(ifwr_uring_reap(&ring->uring, false, &ud, &res) > 0){
+        uring_complete(ud, res);
+    }
+}
+
+
+//Reap until our writes (and optionally the response) are done
+static int uring_wait(ifwr_conn_t* conn, bool rx)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    while(priv->uring_writes || (rx && priv->uring_rx_pending && !priv->uring_rx_done)){
+        uint64_t ud = 0;
+        int res = 0;
+        if(ifwr_uring_reap(&priv->uring->uring, true, &ud, &res) < 0){
+            IFWR_ERR("Could not reap io_uring completion. Error: %s\n", strerror(errno));
+            IFWR_SET_ERROR(IFWR_ERR_WRITEFAIL);
+            return -1;
+        }
+        uring_complete(ud, res);
+    }
+
+    return 0;
+}
+
+
+//Check how the last request's writes went. If the kernel came back with a
+//short write, the link was broken and we finish off with blocking writes.
+//Nothing has touched the header or the body since they were submitted.
+static int uring_settle(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    const int header_len = priv->uring_hdr_len;
+    if(!header_len){
+        return 0;
+    }
+    priv->uring_hdr_len = 0;
+
+    if(uring_wait(conn, false)){
+        return -1;
+    }
+
+    const int hdr_res = priv->uring_hdr_res;
+    if(hdr_res < 0){
+        IFWR_ERR("Could not write Header. Error: %s\n", strerror(-hdr_res));
+        IFWR_SET_ERROR(IFWR_ERR_NOHEADER);
+        return -1;
+    }
+
+    if(hdr_res < header_len){
+        IFWR_DBG("Short io_uring header write (%i of %i), finishing with write()\n", hdr_res, header_len);
+        if(http_write(conn, "Header", priv->tx_hdr + hdr_res, header_len - hdr_res) < 0){
+            IFWR_SET_ERROR(IFWR_ERR_NOHEADER);
+            return -1;
+        }
+    }
+
+    const int body_res = priv->uring_body_res == -ECANCELED ? 0 : priv->uring_body_res;
+    if(body_res < 0){
+        IFWR_ERR("Could not write Content. Error: %s\n", strerror(-body_res));
+        IFWR_SET_ERROR(IFWR_ERR_NOCONTENT);
+        return -1;
+    }
+
+    if(body_res < priv->uring_body_len){
+        IFWR_DBG("Short io_uring content write (%i of %i), finishing with write()\n", body_res,
+                priv->uring_body_len);
+        if(http_post_content(conn, priv->uring_body + body_res, priv->uring_body_len - body_res) < 0){
+            IFWR_SET_ERROR(IFWR_ERR_NOCONTENT);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Send the header and the body as two linked writes with the response receive
+ * linked in behind them, so the whole request costs a single io_uring_enter().
+ * The ring is shared with the rest of the sender's endpoints, and user_data
+ * says which connection each completion is for. The sender's batch isn't
+ * touched again until the response has been read, so writes from it complete
+ * in the background and are reaped along with it. Anything else, like a line
+ * on the caller's stack, is written before we return.
+ */
+static int uring_post(ifwr_conn_t* conn, int header_len, const char* content, int content_len)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+    struct ifwr_ring* const ring = priv->uring;
+
+    //If nobody collected the last response, don't queue a second receive
+    //behind it. ifwr_response() will pick up the old one first.
+    const bool link_rx = !priv->uring_rx_pending;
+
+    const bool in_batch = ring->batch &&
+            content >= ring->batch &&
+            content + content_len <= ring->batch + ring->batch_len;
+    const bool fixed_body = in_batch && ring->batch_fixed;
+    const bool fixed = priv->uring_buf >= 0;
+
+    struct io_uring_sqe* hdr  = ifwr_uring_get_sqe(&ring->uring);
+    struct io_uring_sqe* body = ifwr_uring_get_sqe(&ring->uring);
+    struct io_uring_sqe* rx   = link_rx ? ifwr_uring_get_sqe(&ring->uring) : NULL;
+    struct io_uring_sqe* tmo  = rx && priv->timeout_ms ? ifwr_uring_get_sqe(&ring->uring) : NULL;
+    if(!hdr || !body || (link_rx && !rx) || (rx && priv->timeout_ms && !tmo)){
+        IFWR_ERR("No free io_uring submission entries\n");
+        IFWR_SET_ERROR(IFWR_ERR_WRITEFAIL);
+        return -1;
+    }
+
+    const uint64_t ud = (uint64_t)(uintptr_t)conn;
+
+    hdr->opcode    = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    hdr->fd        = priv->sockfd;
+    hdr->addr      = (uint64_t)(uintptr_t)priv->tx_hdr;
+    hdr->len       = header_len;
+    hdr->buf_index = fixed ? priv->uring_buf : 0;
+    hdr->flags     = IOSQE_IO_LINK;
+    hdr->user_data = ud | URING_UD_HDR;
+
+    body->opcode    = fixed_body ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    body->fd        = priv->sockfd;
+    body->addr      = (uint64_t)(uintptr_t)content;
+    body->len       = content_len;
+    body->buf_index = fixed_body ? URING_BUF_BATCH : 0;
+    body->flags     = link_rx ? IOSQE_IO_LINK : 0;
+    body->user_data = ud | URING_UD_BODY;
+
+    if(link_rx){
+        rx->opcode    = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        rx->fd        = priv->sockfd;
+        rx->addr      = (uint64_t)(uintptr_t)priv->rx_buff;
+        rx->len       = IFWR_MAX_MSG - 1;
+        rx->buf_index = fixed ? priv->uring_buf + URING_BUF_RX - URING_BUF_HDR : 0;
+        rx->user_data = ud | URING_UD_RX;
+    }
+
+    //Socket timeouts don't apply to io_uring, so the receive has its own. The
+    //kernel reads ts when the SQE is submitted.
+    const struct __kernel_timespec ts = {
+        .tv_sec = priv->timeout_ms / 1000,
+        .tv_nsec = (priv->timeout_ms % 1000) * 1000 * 1000LL
+    };
+    if(tmo){
+        rx->flags      = IOSQE_IO_LINK;
+        tmo->opcode    = IORING_OP_LINK_TIMEOUT;
+        tmo->fd        = -1;
+        tmo->addr      = (uint64_t)(uintptr_t)&ts;
+        tmo->len       = 1;
+        tmo->user_data = ud | URING_UD_TIMEOUT;
+    }
+
+    if(ifwr_uring_submit(&ring->uring, in_batch ? 0 : 2) < 0){
+        IFWR_ERR("Could not submit HTTP request to io_uring. Error: %s\n", strerror(errno));
+        IFWR_SET_ERROR(IFWR_ERR_WRITEFAIL);
+        return -1;
+    }
+    priv->uring_rx_pending = true;
+    priv->uring_writes = 2;
+    priv->uring_hdr_len = header_len;
+    priv->uring_body = content;
+    priv->uring_body_len = content_len;
+
+    if(!in_batch && uring_settle(conn)){
+        return -1;
+    }
+
+    //Keep the completion queue short for everyone on the ring
+    uring_reap_ready(ring);
+
+    IFWR_DBG("Success! Queued %i bytes of HTTP via io_uring\n", header_len + content_len);
+    return header_len + content_len;
+}
+
+
+//Nothing can be left in flight pointing at a connection that is going away.
+//A receive waiting on a quiet server is ended by shutting the socket down.
+static void uring_leave(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+    struct ifwr_ring* const ring = priv->uring;
+
+    if(priv->uring_rx_pending && !priv->uring_rx_done){
+        shutdown(priv->sockfd, SHUT_RDWR);
+    }
+    if(uring_wait(conn, true)){
+        IFWR_ERR("Could not wait for io_uring requests on close\n");
+    }
+
+    if(priv->uring_buf >= 0){
+        ring->pairs &= ~(1u << (priv->uring_buf - URING_BUF_HDR) / 2);
+    }
+
+    uring_put(ring);
+    priv->uring = NULL;
+    priv->uring_buf = -1;
+    priv->uring_writes = 0;
+    priv->uring_hdr_len = 0;
+    priv->uring_rx_pending = false;
+    priv->uring_rx_done = false;
+}
+
+
+static int reactor_arm(ifwr_conn_t* conn, bool out)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    if(!priv->reactor || priv->epollout == out){
+        return 0;
+    }
+
+    struct epoll_event ev = {
+        .events = EPOLLIN | (out ? EPOLLOUT : 0),
+        .data.ptr = conn
+    };
+    if(epoll_ctl(priv->reactor->epfd, EPOLL_CTL_MOD, priv->sockfd, &ev) < 0){
+        IFWR_ERR("Could not update epoll events. Error: %s\n", strerror(errno));
+        IFWR_SET_ERROR(IFWR_ERR_CONNECT);
+        return -1;
+    }
+
+    priv->epollout = out;
+    return 0;
+}
+
+
+//Where each request in the queue ends, so that whole requests can be dropped
+struct ifwr_txreq
+{
+    int len;
+    int header_len;
+    int points;
+    bool high;          //Sent ahead of bulk requests that haven't started
+};
+
+
+//The first bytes of the queue have been written, so whole requests may be done
+static void txq_sent(ifwr_priv_t* priv, int bytes)
+{
+    if(!priv->txq_nreqs){
+        return;
+    }
+
+    int done = 0;
+    priv->txq_head_sent += bytes;
+    while(done < priv->txq_nreqs && priv->txq_head_sent >= priv->txq_reqs[done].len){
+        priv->txq_head_sent -= priv->txq_reqs[done].len;
+        done++;
+    }
+
+    priv->txq_nreqs -= done;
+    memmove(priv->txq_reqs, priv->txq_reqs + done, priv->txq_nreqs * sizeof(struct ifwr_txreq));
+}
+
+
+static int prec_tag(const char* prec);
+static void peer_unsent(struct ifwr_peer* p, int requests);
+
+//Write as much of the queue as the socket will take without blocking. Whatever
+//is left over is picked up again when EPOLLOUT fires.
+static int reactor_drain_txq(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    while(priv->txq_off < priv->txq_len){
+        int ret = send(priv->sockfd, priv->txq + priv->txq_off, priv->txq_len - priv->txq_off, MSG_NOSIGNAL);
+        if(ret < 0){
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                IFWR_DBG("Socket full with %i bytes queued, waiting for EPOLLOUT\n", priv->txq_len - priv->txq_off);
+                return reactor_arm(conn, true);
+            }
+            if(errno == EINTR){
+                continue;
+            }
+            IFWR_ERR("Could not write queued requests. Error: %s\n", strerror(errno));
+            IFWR_SET_ERROR(IFWR_ERR_WRITEFAIL);
+            return -1;
+        }
+        priv->txq_off += ret;
+        txq_sent(priv, ret);
+    }
+
+    priv->txq_off = 0;
+    priv->txq_len = 0;
+    return reactor_arm(conn, false);
+}
+
+
+static int txq_budget(const ifwr_conn_t* conn)
+{
+    return conn->mem_budget ? conn->mem_budget : IFWR_MAX_TXQ;
+}
+
+
+//An empty queue always takes a request, or a big batch could never go out
+static bool txq_over(const ifwr_conn_t* conn, int need)
+{
+    const ifwr_priv_t* const priv = &conn->__private;
+    const int queued = priv->txq_len - priv->txq_off;
+    return queued && queued + need > txq_budget(conn);
+}
+
+
+//Points in a request body. The last line may not have a newline.
+static int count_points(const char* content, int len)
+{
+    int points = 0;
+    for(const char* c = content; (c = memchr(c, '\n', content + len - c)); c++){
+        points++;
+    }
+
+    return points + (len && content[len - 1] != '\n');
+}
+
+
+static void txq_dropped(ifwr_conn_t* conn, int requests, int points)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    priv->stats.requests_dropped += requests;
+    priv->stats.points_dropped += points;
+    IFWR_PROBE2(drop, IFWR_DROP_OVERFLOW, points);
+    IFWR_WARN("Outgoing queue over budget, dropped %i points\n", points);
+}
+
+
+//Queued requests that have started going out or are high priority. These
+//always come first, and are never dropped to make room.
+static int txq_keep(const ifwr_priv_t* priv, int* bytes)
+{
+    int keep = priv->txq_head_sent ? 1 : 0;
+    *bytes = keep ? priv->txq_reqs[0].len - priv->txq_head_sent : 0;
+    while(keep < priv->txq_nreqs && priv->txq_reqs[keep].high){
+        *bytes += priv->txq_reqs[keep++].len;
+    }
+
+    return keep;
+}
+
+
+//Make room by dropping the oldest bulk requests that haven't started going
+//out. The queue has been compacted, so it starts part way into the first one.
+static void txq_drop_oldest(ifwr_conn_t* conn, int need)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    int off = 0;
+    const int first = txq_keep(priv, &off);
+
+    int last = first;
+    int bytes = 0;
+    int points = 0;
+    while(last < priv->txq_nreqs && priv->txq_len - bytes + need > txq_budget(conn)){
+        const struct ifwr_txreq* req = &priv->txq_reqs[last++];
+        points += req->points;
+        bytes += req->len;
+    }
+
+    const int dropped = last - first;
+    if(!dropped){
+        return;
+    }
+
+    memmove(priv->txq + off, priv->txq + off + bytes, priv->txq_len - off - bytes);
+    priv->txq_len -= bytes;
+    memmove(priv->txq_reqs + first, priv->txq_reqs + last,
+            (priv->txq_nreqs - last) * sizeof(struct ifwr_txreq));
+    priv->txq_nreqs -= dropped;
+
+    //Nothing will come back for them
+    priv->inflight -= dropped;
+    if(priv->peer){
+        peer_unsent(priv->peer, dropped);
+    }
+
+    txq_dropped(conn, dropped, points);
+}
+
+
+//Let the socket take what it can until the request fits, or time runs out.
+//Responses are left for ifwr_process(), they don't hold up the queue.
+static void txq_wait(ifwr_conn_t* conn, int need)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    const int64_t start = mono_ns();
+    const int64_t deadline = start + conn->block_timeout_ms * 1000 * 1000LL;
+
+    int64_t now = start;
+    while(txq_over(conn, need) && now < deadline){
+        struct pollfd pfd = { .fd = priv->sockfd, .events = POLLOUT };
+        const int ret = poll(&pfd, 1, (int)((deadline - now + 999999) / (1000 * 1000)));
+        if(ret < 0 && errno != EINTR){
+            IFWR_ERR("Could not wait for the outgoing queue. Error: %s\n", strerror(errno));
+            break;
+        }
+        if(ret > 0 && reactor_drain_txq(conn) < 0){
+            break;
+        }
+        now = mono_ns();
+    }
+
+    priv->stats.overflow_wait_ns += now - start;
+}
+
+
+//Add a request to the queue without writing any of it. High priority requests
+//go ahead of every bulk request that hasn't started, after any high ones.
+static int txq_append(ifwr_conn_t* conn, int header_len, const char* content, int content_len, bool high)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    const int need = header_len + content_len;
+    if(priv->txq_len + need > priv->txq_cap){
+        int cap = priv->txq_cap ? priv->txq_cap : IFWR_MAX_MSG;
+        while(cap < priv->txq_len + need){
+            cap *= 2;
+        }
+
+        char* txq = realloc(priv->txq, cap);
+        if(!txq){
+            IFWR_DBG("Could not grow outgoing queue to %i bytes\n", cap);
+            IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+            return -1;
+        }
+        priv->txq = txq;
+        priv->txq_cap = cap;
+    }
+
+    if(priv->txq_nreqs == priv->txq_reqs_cap){
+        const int cap = priv->txq_reqs_cap ? priv->txq_reqs_cap * 2 : 64;
+        struct ifwr_txreq* reqs = realloc(priv->txq_reqs, cap * sizeof(struct ifwr_txreq));
+        if(!reqs){
+            IFWR_DBG("Could not grow outgoing request list to %i\n", cap);
+            IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+            return -1;
+        }
+        priv->txq_reqs = reqs;
+        priv->txq_reqs_cap = cap;
+    }
+
+    int at = priv->txq_nreqs;
+    int off = priv->txq_len;
+    if(high){
+        at = txq_keep(priv, &off);
+        off += priv->txq_off;
+        memmove(priv->txq + off + need, priv->txq + off, priv->txq_len - off);
+        memmove(priv->txq_reqs + at + 1, priv->txq_reqs + at,
+                (priv->txq_nreqs - at) * sizeof(struct ifwr_txreq));
+    }
+
+    memcpy(priv->txq + off, priv->tx_hdr, header_len);
+    memcpy(priv->txq + off + header_len, content, content_len);
+    priv->txq_len += need;
+    priv->txq_nreqs++;
+    priv->inflight++;
+
+    //Kept whatever the overflow policy, it can change while requests are queued
+    struct ifwr_txreq* req = &priv->txq_reqs[at];
+    req->high = high;
+    req->len = need;
+    req->header_len = header_len;
+    req->points = count_points(content, content_len);
+
+    return 0;
+}
+
+
+//Requests that didn't fit in the queue, kept on disk in the order they came
+struct ifwr_spill
+{
+    int fd;
+    off_t rd;           //Next record to send
+    off_t wr;           //End of the last record
+    char* buff;         //Holds the record being sent
+    int buff_cap;
+};
+
+//On disk, followed by the bucket name (if any) and the content
+struct spill_rec
+{
+    uint32_t len;
+    uint16_t prec;      //As for the shared memory ring
+    uint16_t bucket_len;
+};
+
+
+static int spill_setup(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    priv->spill = calloc(1, sizeof(struct ifwr_spill));
+    if(!priv->spill){
+        IFWR_DBG("Could not allocate spill state\n");
+        IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+        return -1;
+    }
+
+    priv->spill->fd = open(conn->spill_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(priv->spill->fd < 0){
+        IFWR_DBG("Could not open spill file %s. Error: %s\n", conn->spill_path, strerror(errno));
+        IFWR_SET_ERROR(IFWR_ERR_WRITEFAIL);
+        free(priv->spill);
+        priv->spill = NULL;
+        return -1;
+    }
+
+    IFWR_DBG("Success! Spilling to %s when the outgoing queue is over budget\n", conn->spill_path);
+    return 0;
+}
+
+
+static int spill_write(ifwr_conn_t* conn, const char* prec, const char* content, int content_len)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+    struct ifwr_spill* const spill = priv->spill;
+
+    const int tag = prec_tag(prec);
+    if(tag < 0){
+        IFWR_ERR("Unknown precision \"%s\"\n", prec);
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    const char* const bucket = priv->post_bucket;
+    const struct spill_rec rec = {
+        .len = content_len,
+        .prec = tag,
+        .bucket_len = bucket ? strlen(bucket) : 0,
+    };
+
+    struct iovec iov[] = {
+        { .iov_base = (void*)&rec, .iov_len = sizeof(rec) },
+        { .iov_base = (void*)bucket, .iov_len = rec.bucket_len },
+        { .iov_base = (void*)content, .iov_len = content_len },
+    };
+    const ssize_t len = sizeof(rec) + rec.bucket_len + content_len;
+    if(pwritev(spill->fd, iov, 3, spill->wr) != len){
+        IFWR_ERR("Could not write to spill file. Error: %s\n", strerror(errno));
+        IFWR_SET_ERROR(IFWR_ERR_WRITEFAIL);
+        txq_dropped(conn, 1, count_points(content, content_len));
+        return -1;
+    }
+
+    spill->wr += len;
+    priv->stats.points_spilled += count_points(content, content_len);
+    priv->stats.spill_bytes = spill->wr - spill->rd;
+    return 0;
+}
+
+
+//Move spilled requests back into the queue while there is room for them
+static int spill_replay(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+    struct ifwr_spill* const spill = priv->spill;
+
+    const char* const post_bucket = priv->post_bucket;
+    int ret = 0;
+    while(spill->rd < spill->wr){
+        struct spill_rec rec;
+        if(pread(spill->fd, &rec, sizeof(rec), spill->rd) != sizeof(rec)){
+            IFWR_ERR("Could not read from spill file. Error: %s\n", strerror(errno));
+            IFWR_SET_ERROR(IFWR_ERR_WRITEFAIL);
+            ret = -1;
+            break;
+        }
+
+        const int header_guess = IFWR_MAX_HDR;
+        if(txq_over(conn, header_guess + rec.len)){
+            break;
+        }
+
+        const int len = rec.bucket_len + 1 + rec.len;
+        if(len > spill->buff_cap){
+            char* buff = realloc(spill->buff, len);
+            if(!buff){
+                IFWR_DBG("Could not allocate %i bytes to read back a spilled request\n", len);
+                IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+                ret = -1;
+                break;
+            }
+            spill->buff = buff;
+            spill->buff_cap = len;
+        }
+
+        const off_t body = spill->rd + sizeof(rec);
+        if(pread(spill->fd, spill->buff, rec.bucket_len, body) != rec.bucket_len ||
+                pread(spill->fd, spill->buff + rec.bucket_len + 1, rec.len, body + rec.bucket_len) != rec.len){
+            IFWR_ERR("Could not read from spill file. Error: %s\n", strerror(errno));
+            IFWR_SET_ERROR(IFWR_ERR_WRITEFAIL);
+            ret = -1;
+            break;
+        }
+        spill->buff[rec.bucket_len] = 0;
+
+        priv->post_bucket = rec.bucket_len ? spill->buff : NULL;
+        const int header_len = http_fmt_header(conn, rec.len, ifwr_shm_prec(rec.prec));
+        priv->post_bucket = post_bucket;
+        if(header_len < 0 || txq_append(conn, header_len, spill->buff + rec.bucket_len + 1, rec.len, false)){
+            ret = -1;
+            break;
+        }
+
+        spill->rd = body + rec.bucket_len + rec.len;
+    }
+
+    //All sent, start the file afresh
+    if(spill->rd == spill->wr && spill->wr){
+        spill->rd = spill->wr = 0;
+        if(ftruncate(spill->fd, 0)){
+            IFWR_WARN("Could not truncate spill file. Error: %s\n", strerror(errno));
+        }
+    }
+
+    priv->stats.spill_bytes = spill->wr - spill->rd;
+    return ret;
+}
+
+
+static void spill_free(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    if(!priv->spill){
+        return;
+    }
+
+    close(priv->spill->fd);
+    free(priv->spill->buff);
+    free(priv->spill);
+    priv->spill = NULL;
+}
+
+
+static int reactor_post(ifwr_conn_t* conn, const char* prec, int header_len, const char* content,
+        int content_len)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    const int need = header_len + content_len;
+    const bool high = priv->batch_high;
+
+    //Compact away whatever has been written already
+    if(priv->txq_off){
+        memmove(priv->txq, priv->txq + priv->txq_off, priv->txq_len - priv->txq_off);
+        priv->txq_len -= priv->txq_off;
+        priv->txq_off = 0;
+    }
+
+    //High priority requests jump the queue, so they are never held back by the
+    //overflow policy, which is there to bound bulk traffic
+    if(high){
+        if(txq_append(conn, header_len, content, content_len, true)){
+            return -1;
+        }
+        return reactor_drain_txq(conn) < 0 ? -1 : need;
+    }
+
+    //Once anything has spilled, everything after it does too, to keep the order
+    if(priv->spill && priv->spill->rd < priv->spill->wr){
+        spill_replay(conn);
+        if(priv->spill->rd < priv->spill->wr){
+            if(spill_write(conn, prec, content, content_len)){
+                return -1;
+            }
+            return reactor_drain_txq(conn) < 0 ? -1 : need;
+        }
+    }
+
+    if(txq_over(conn, need)){
+        switch(conn->overflow){
+        case IFWR_OVERFLOW_DROP_OLDEST:
+            txq_drop_oldest(conn, need);
+            break;
+        case IFWR_OVERFLOW_BLOCK:
+            txq_wait(conn, need);
+            break;
+        case IFWR_OVERFLOW_SPILL:
+            return spill_write(conn, prec, content, content_len) ? -1 : need;
+        default:
+            break;
+        }
+    }
+
+    if(txq_over(conn, need)){
+        IFWR_DBG("Outgoing queue is over budget with %i bytes\n", priv->txq_len - priv->txq_off);
+        txq_dropped(conn, 1, count_points(content, content_len));
+        IFWR_SET_ERROR(IFWR_ERR_QFULL);
+        return -1;
+    }
+
+    if(txq_append(conn, header_len, content, content_len, false)){
+        return -1;
+    }
+
+    if(reactor_drain_txq(conn) < 0){
+        return -1;
+    }
+
+    return need;
+}
+
+
+//Points going out in the next request get a fresh IFWR_CLOCK_BATCH reading
+static void clock_new_window(ifwr_conn_t* conn)
+{
+    if(conn->clock == IFWR_CLOCK_BATCH){
+        __atomic_store_n(&conn->__private.batch_ts, 0, __ATOMIC_RELAXED);
+    }
+}
+
+
+static int http_post_one(ifwr_conn_t* conn, const char* prec, const char* content, int content_len)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    //The last request's header may still be on its way out of tx_hdr
+    if(priv->uring && uring_settle(conn)){
+        return -1;
+    }
+
+    int header_len = http_fmt_header(conn, content_len, prec);
+    if(header_len < 0){
+        return -1;
+    }
+
+    IFWR_PROBE2(request, header_len + content_len, conn->port);
+
+    if(priv->uring){
+        return uring_post(conn, header_len, content, content_len);
+    }
+
+    if(conn->io == IFWR_IO_REACTOR){
+        return reactor_post(conn, prec, header_len, content, content_len);
+    }
+
+    int sent_bytes = 0;
+    int ret = http_post_header(conn, header_len);
+    if(ret < 0){
+        IFWR_ERR("Could not send HTTP header!");
+        return -1;
+    }
+    sent_bytes += ret;
+
+    //Half a request leaves the stream out of step, so the socket has to go.
+    //Whatever is batched or queued stays for the caller to reconnect and send.
+    ret = http_post_content(conn,content, content_len);
+    if(ret < 0){
+        IFWR_ERR("HTTP Header sent, but content failed to send. Closing to reconnect later\n");
+        close(priv->sockfd);
+        priv->sockfd = -1;
+        IFWR_SET_ERROR(IFWR_ERR_NOCONTENT);
+        return -1;
+    }
+    sent_bytes += ret;
+
+    return sent_bytes;
+}
+
+
+static void repl_push(ifwr_conn_t* conn, const char* prec, const char* content, int content_len);
+static void repl_pump(ifwr_conn_t* conn);
+static int peer_post(ifwr_conn_t* conn, const char* prec, const char* content, int content_len);
+static int http_post(ifwr_conn_t* conn, const char* prec, const char* content, int content_len)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    //Points are timestamped on this connection, whichever one sends them
+    clock_new_window(conn);
+
+    if(!priv->nreplicas){
+        return priv->npeers ? peer_post(conn, prec, content, content_len) :
+                http_post_one(conn, prec, content, content_len);
+    }
+
+    //Replicas get their copy first, so they don't miss out if this one fails
+    repl_push(conn, prec, content, content_len);
+    const int ret = priv->npeers ? peer_post(conn, prec, content, content_len) :
+            http_post_one(conn, prec, content, content_len);
+    repl_pump(conn);
+    return ret;
+}
+
+
+
+static int dgram_flush(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+    struct ifwr_dgram* const dgram = priv->dgram;
+
+    clock_new_window(conn);
+
+    const int count = dgram->count;
+    dgram->count = 0;
+
+    for(int sent = 0; sent < count;){
+        int ret = sendmmsg(priv->sockfd, dgram->msgs + sent, count - sent, 0);
+        if(ret < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            //UDP is loss tolerant by choice, so the rest of this lot is gone
+            IFWR_ERR("Could not send %i datagrams. Error: %s\n", count - sent, strerror(errno));
+            IFWR_PROBE2(drop, IFWR_DROP_DGRAM, count - sent);
+            IFWR_SET_ERROR(IFWR_ERR_WRITEFAIL);
+            return -1;
+        }
+        sent += ret;
+    }
+
+    IFWR_DBG("Success! Sent %i datagrams\n", count);
+    return 0;
+}
+
+
+//Pack lines into MTU sized datagrams, and only go to the kernel once every
+//datagram slot has been filled.
+static int dgram_append(ifwr_conn_t* conn, const char* line, int line_len)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+    struct ifwr_dgram* const dgram = priv->dgram;
+
+    if(line_len > dgram->mtu){
+        IFWR_DBG("Line of %i bytes is bigger than the MTU, sending on its own\n", line_len);
+        if(dgram->count && dgram_flush(conn)){
+            return -1;
+        }
+        if(send(priv->sockfd, line, line_len, 0) < 0){
+            IFWR_ERR("Could not send datagram. Error: %s\n", strerror(errno));
+            IFWR_SET_ERROR(IFWR_ERR_WRITEFAIL);
+            return -1;
+        }
+        return line_len;
+    }
+
+    struct iovec* iov = dgram->count ? &dgram->iovs[dgram->count - 1] : NULL;
+    if(!iov || iov->iov_len + line_len > (size_t)dgram->mtu){
+        if(dgram->count == DGRAM_VLEN && dgram_flush(conn)){
+            return -1;
+        }
+        iov = &dgram->iovs[dgram->count++];
+        iov->iov_len = 0;
+    }
+
+    memcpy((char*)iov->iov_base + iov->iov_len, line, line_len);
+    iov->iov_len += line_len;
+    return line_len;
+}
+
+
+
+__attribute__((__format__ (__printf__, 3, 4)))
+int ifwr_write_raw(ifwr_conn_t* conn, const char* prec, const char* format, ... )
+{
+    char content[IFWR_MAX_MSG] = {0};
+    va_list args;
+    va_start(args,format);
+    int content_len = vsnprintf(content, IFWR_MAX_MSG,format, args);
+    va_end(args);
+
+    ifwr_priv_t* const priv = &conn->__private;
+    if(priv->dgram || priv->shm){
+        return ifwr_write_line(conn, prec, content, content_len);
+    }
+
+    return http_post(conn, prec, content, content_len);
+}
+
+//Format one key=value pair, with a trailing ","
+static int fmt_value(char* buff, int buff_len, const char* key, ifwr_type_e type, ifwr_value_u value)
+{
+    switch(type){
+        case IFWR_TYPE_STOP:
+            //Impossible ? -- handled by callers
+            IFWR_FAT("Impossible situation has happend!?\n");
+            break;
+
+        case IFWR_TYPE_BOOL:
+            if(value.b){
+                return snprintf(buff, buff_len,"%s=True,", key );
+            }
+            return snprintf(buff, buff_len,"%s=False,", key );
+
+        case IFWR_TYPE_FLOAT:
+            return snprintf(buff, buff_len,"%s=%lf,", key, value.f );
+
+        case IFWR_TYPE_INT:
+            return snprintf(buff, buff_len,"%s=%" PRIu64 "i,", key, value.i );
+
+        case IFWR_TYPE_STRING:
+            return snprintf(buff, buff_len,"%s=\"%s\",", key, value.s );
+
+        case IFWR_TYPE_HIST:
+            return ifwr_hist_fmt(value.h, key, buff, buff_len);
+
+        case IFWR_TYPE_UNKOWN:
+            IFWR_ERR("Found a type of UNKOWN, was your KTV unitialised?\n");
+            break;
+    }
+
+    return 0;
+}
+
+
+static int ktv2str(char* buff, int buff_len, const ifwr_ktv_t* ktv )
+{
+    int written = 0;
+    for(const ifwr_ktv_t* curr = ktv; curr->type != IFWR_TYPE_STOP; curr++){
+        written += fmt_value(buff + written, buff_len - written, curr->key, curr->type, curr->value);
+    }
+
+    //Remove the tailing "," , replace with a null terminator
+    if(buff_len - written > 0){
+        buff[written -1] = 0;
+    }
+
+    return written;
+}
+
+
+static int local_now_ns(ifwr_conn_t* conn, int64_t* ns)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    if(priv->tsc){
+        if(ifwr_tsc_now(priv->tsc, ns) < 0){
+            IFWR_ERR("Could not get time! Error: %s", strerror(errno));
+            IFWR_SET_ERROR(IFWR_ERR_NOTIME);
+            return -1;
+        }
+        return 0;
+    }
+
+    //Lazy producers may get here from many threads at once
+    if(conn->clock == IFWR_CLOCK_BATCH){
+        *ns = __atomic_load_n(&priv->batch_ts, __ATOMIC_RELAXED);
+        if(*ns){
+            return 0;
+        }
+    }
+
+    struct timespec now_ts = {0};
+    const clockid_t clk = conn->clock == IFWR_CLOCK_COARSE ? CLOCK_REALTIME_COARSE : CLOCK_REALTIME;
+    if(clock_gettime(clk, &now_ts) < 0){
+        IFWR_ERR("Could not get time! Error: %s", strerror(errno));
+        IFWR_SET_ERROR(IFWR_ERR_NOTIME);
+        return -1;
+    }
+
+    *ns = now_ts.tv_sec * 1000 * 1000 * 1000 + now_ts.tv_nsec;
+
+    if(conn->clock == IFWR_CLOCK_BATCH){
+        int64_t unset = 0;
+        if(!__atomic_compare_exchange_n(&priv->batch_ts, &unset, *ns, false,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+            *ns = unset; //Another thread got there first
+        }
+    }
+
+    return 0;
+}
+
+
+#define TS_LEN_MAX 64
+
+static const uint64_t pow10s[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+    1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+    1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+//Successive timestamps mostly share their leading digits, so keep the last
+//one rendered and only redo the digits that changed. Same output as "%" PRIu64.
+static int fmt_ts_digits(ifwr_conn_t* conn, int64_t ts_val, char* ts_str)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+    char* const digits = priv->ts_digits;
+    int len = priv->ts_len;
+    uint64_t ts = (uint64_t)ts_val;
+    uint64_t last = priv->ts_last;
+
+    priv->ts_last = ts;
+
+    //A different number of digits means starting from scratch
+    if(!len || ts < pow10s[len - 1] || (len < 20 && ts >= pow10s[len])){
+        for(len = 1; len < 20 && ts >= pow10s[len]; len++);
+        for(int i = len - 1; i >= 0; i--){
+            digits[i] = '0' + ts % 10;
+            ts /= 10;
+        }
+    }
+    else{
+        for(int i = len - 1; ts != last; i--){
+            digits[i] = '0' + ts % 10;
+            ts /= 10;
+            last /= 10;
+        }
+    }
+
+    priv->ts_len = len;
+    memcpy(ts_str, digits, len);
+    ts_str[len] = 0;
+    return len;
+}
+
+
+//Render the timestamp and work out its precision. ts_str must have space for
+//TS_LEN_MAX bytes. Returns the length of the timestamp string, -1 on error.
+static int fmt_ts(ifwr_conn_t* conn, ifwr_fmt_e ts_fmt, int64_t ts_val, char* ts_str, const char** prec_out)
+{
+    const char* prec = NULL;
+
+    switch(ts_fmt){
+        case IFWR_TS_UNDEF:
+            IFWR_SET_ERROR(IFWR_ERR_NOTIME);
+            IFWR_ERR("No timestamp value set!\n");
+            return -1;
+        case IFWR_TS_LOCAL:{
+            if(local_now_ns(conn, &ts_val) < 0){
+                return -1;
+            }
+            prec = "ns";
+            break;
+        }
+        case IFWR_TS_REMOTE:
+            prec = "ms"; //This seems sane. How are you going to get better than
+                         //this over the network with a remote timestamp?
+            ts_str[0] = 0;
+            *prec_out = prec;
+            return 0;
+        case IFWR_TS_NANOS:
+            prec = "ns";
+            //TODO - some sanity check that this is a sensible nanosecond value
+            break;
+        case IFWR_TS_MICROS:
+            prec = "us";
+            //TODO - some sanity check that this is a sensible microsecond value
+            break;
+        case IFWR_TS_MILLIS:
+            prec = "ms";
+            //TODO - some sanity check that this is a sensible milliscecond value
+            break;
+        case IFWR_TS_SECS:
+            prec = "s";
+            //TODO - some sanity check that this is a sensible seconds value
+            break;
+
+         /*default: no default case intentional. Let the compiler pick up if
+          * I've forgotten a value.
+          * */
+    }
+
+    IFWR_DBG("Timestamp precision is \"%s\"\n", prec);
+    *prec_out = prec;
+    return fmt_ts_digits(conn, ts_val, ts_str);
+}
+
+
+int ifwr_cardinality_limit(ifwr_conn_t* conn, uint64_t limit, ifwr_card_action_e action, int sample)
+{
+    if(!conn){
+        IFWR_DBG("No connection supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
+
+    ifwr_priv_t* const priv = &conn->__private;
+
+    if(action < IFWR_CARD_WARN || action > IFWR_CARD_DROP || (action == IFWR_CARD_SAMPLE && sample < 1)){
+        IFWR_DBG("Bad cardinality action, or sampling without a rate\n");
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    if(priv->card){
+        ifwr_card_free(priv->card);
+        free(priv->card);
+        priv->card = NULL;
+    }
+
+    ifwr_card_t* card = calloc(1, sizeof(ifwr_card_t));
+    if(!card || ifwr_card_init(card, limit)){
+        IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+        free(card);
+        return -1;
+    }
+
+    priv->card = card;
+    priv->card_action = action;
+    priv->card_sample = sample;
+    return 0;
+}
+
+
+int64_t ifwr_cardinality(ifwr_conn_t* conn, const char* measurement)
+{
+    if(!conn){
+        IFWR_DBG("No connection supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
+
+    ifwr_priv_t* const priv = &conn->__private;
+
+    if(!priv->card || !measurement){
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    return ifwr_card_estimate(priv->card, measurement);
+}
+
+
+static void peers_stats(const ifwr_conn_t* conn, ifwr_stats_t* stats);
+
+int ifwr_stats(ifwr_conn_t* conn, ifwr_stats_t* stats)
+{
+    if(!conn || !stats){
+        IFWR_DBG("No connection or stats supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
+
+    const ifwr_priv_t* const priv = &conn->__private;
+
+    *stats = priv->stats;
+    peers_stats(conn, stats);
+    for(int i = 0; i < IFWR_PRIO_COUNT; i++){
+        const uint64_t points = stats->lanes[i].points;
+        stats->lanes[i].delay_avg_ns = points ? priv->lane_wait_ns[i] / (int64_t)points : 0;
+    }
+    if(priv->tsc){
+        stats->clock_err_ns = __atomic_load_n(&priv->tsc->err_ns, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+
+//Count the series, and decide whether a point on it can go. 0 if it can.
+static int card_guard(ifwr_conn_t* conn, const char* measurement, const char* tags)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    uint64_t measure_hash = 0;
+    const uint64_t hash = ifwr_card_hash(measurement, tags, &measure_hash);
+    const ifwr_card_e seen = ifwr_card_check(priv->card, measurement, measure_hash, hash, false);
+    if(seen != IFWR_CARD_OVER && seen != IFWR_CARD_REFUSED){
+        return 0;
+    }
+
+    //Each new series is counted once, however many of its points follow
+    bool admit = priv->card_action == IFWR_CARD_WARN;
+    if(seen == IFWR_CARD_OVER){
+        //Complain on the 1st, 2nd, 4th, 8th... so a runaway doesn't flood the log
+        const uint64_t over = ++priv->stats.series_over;
+        if(!(over & (over - 1))){
+            IFWR_ERR("Measurement \"%s\" is over its limit of %lu series, %lu new series so far\n",
+                    measurement, (unsigned long)priv->card->limit, (unsigned long)over);
+        }
+
+        admit |= priv->card_action == IFWR_CARD_SAMPLE && over % priv->card_sample == 0;
+    }
+
+    if(admit){
+        ifwr_card_check(priv->card, measurement, measure_hash, hash, true);
+        return 0;
+    }
+
+    if(seen == IFWR_CARD_OVER){
+        priv->stats.series_dropped++;
+    }
+    IFWR_PROBE2(drop, IFWR_DROP_CARDINALITY, 1);
+    IFWR_SET_ERROR(IFWR_ERR_CARDINALITY);
+    return -1;
+}
+
+
+//Take a look at the InfluxDB line protocol specification to see what this
+//function is trying to build:
+//https://v2.docs.influxdata.com/v2.0/reference/syntax/line-protocol/
+static int fmt_line(
+		ifwr_conn_t* conn,
+		const char* measurement,
+		const ifwr_ktv_t* tags,
+		const ifwr_ktv_t* fields,
+		ifwr_fmt_e ts_fmt,
+		int64_t ts_val,
+		char* line,
+		int line_max,
+		const char** prec_out
+		)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    //Figure out the measurement name
+    if(!measurement){
+        if(!priv->default_measurement){
+            IFWR_SET_ERROR(IFWR_ERR_NOMEASURE);
+            IFWR_ERR("No default measurement name is set\n");
+            return -1;
+        }
+
+        measurement = priv->default_measurement;
+    }
+    IFWR_DBG("Measurement set to \"%s\"\n", measurement);
+
+    //Figure out the tags
+    char* tags_str = NULL;
+    char tmp_tags[IFWR_MAX_MSG] = {0};
+    if(!tags){
+        if(!priv->default_tagset){
+            IFWR_SET_ERROR(IFWR_ERR_NOTAGS);
+            IFWR_ERR("No default tagset is set\n");
+            return -1;
+        }
+        tags_str = priv->default_tagset;
+    }
+    else{
+        ktv2str(tmp_tags, IFWR_MAX_MSG, tags);
+        tags_str = tmp_tags;
+    }
+    IFWR_DBG("Tags set to \"%s\"\n", tags_str);
+
+    if(priv->card && card_guard(conn, measurement, tags_str)){
+        return -1;
+    }
+
+    //Figure out the fields
+    char fields_str[IFWR_MAX_MSG] = {0};
+    if(!fields){
+        IFWR_SET_ERROR(IFWR_ERR_NOFIELDS);
+        IFWR_ERR("No measurement fields supplied!\n");
+        return -1;
+    }
+
+    ktv2str(fields_str, IFWR_MAX_MSG, fields);
+    IFWR_DBG("Fields set to \"%s\"\n", fields_str);
+
+
+    //Figure out the timestamp
+    const char* prec = NULL;
+    char ts_str[TS_LEN_MAX] = {0};
+    if(fmt_ts(conn, ts_fmt, ts_val, ts_str, &prec) < 0){
+        return -1;
+    }
+    IFWR_DBG("Timestamp string is \"%s\"\n ", ts_str);
+
+
+    //At this point we have strings for everything, just need to format it
+    int line_len = snprintf(line, line_max, "%s,%s %s %s\n",
+            measurement,
+            tags_str,
+            fields_str,
+            ts_str);
+    if(line_len < 0 || line_len >= line_max){
+        IFWR_ERR("Line does not fit in %i bytes\n", line_max);
+        IFWR_SET_ERROR(IFWR_ERR_MSGTOOBIG);
+        return -1;
+    }
+
+    *prec_out = prec;
+    return line_len;
+}
+
+
+//Reactor connections hear about responses through ifwr_process() instead
+static int http_collect(ifwr_conn_t* conn)
+{
+    if(conn->io == IFWR_IO_REACTOR){
+        return 0;
+    }
+
+    return ifwr_response(conn);
+}
+
+
+static int lanes_flush(ifwr_conn_t* conn);
+
+//Lines in a batch waited from when each was batched until now
+static void lane_account(ifwr_priv_t* priv)
+{
+    const int64_t now = mono_ns();
+    const int lane = priv->batch_high ? IFWR_PRIO_HIGH : IFWR_PRIO_BULK;
+    ifwr_lane_stats_t* const stats = &priv->stats.lanes[lane];
+
+    const int64_t oldest = now - priv->batch_open_ns;
+    stats->points += priv->batch_points;
+    stats->requests++;
+    stats->delay_max_ns = oldest > stats->delay_max_ns ? oldest : stats->delay_max_ns;
+    priv->lane_wait_ns[lane] += priv->batch_points * oldest - priv->batch_queued_ns;
+
+    priv->batch_points = 0;
+    priv->batch_queued_ns = 0;
+}
+
+
+static int batch_flush(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    //High priority points never wait behind a bulk batch
+    const int high_ret = !priv->batch_high && priv->prio_open_ns ? lanes_flush(conn) : 0;
+
+    int len = priv->batch_len;
+    priv->batch_len = 0;
+
+    if(priv->batch_points){
+        lane_account(priv);
+    }
+
+    //Neither is worth failing the batch over, it just goes out as it came in
+    if(conn->batch_coalesce){
+        int merged = 0;
+        const int coalesced = ifwr_lines_coalesce(priv->lines, priv->batch, len, &merged);
+        if(coalesced < 0){
+            IFWR_WARN("Could not coalesce batch of %i bytes, sending as is\n", len);
+        }
+        else{
+            len = coalesced;
+            priv->stats.lines_coalesced += merged;
+        }
+    }
+
+    if(conn->batch_sort && ifwr_lines_sort(priv->lines, priv->batch, len)){
+        IFWR_WARN("Could not sort batch of %i bytes, sending as is\n", len);
+    }
+
+    //Points in the batch, and how long the first of them waited
+    if(IFWR_PROBE_ENABLED(batch)){
+        int points = 0;
+        for(const char* nl = priv->batch; (nl = memchr(nl, '\n', priv->batch + len - nl)); nl++){
+            points++;
+        }
+        const int64_t age = priv->batch_open_ns ? mono_ns() - priv->batch_open_ns : 0;
+        IFWR_PROBE3(batch, len, points, age);
+    }
+    if(!priv->lanes){
+        priv->batch_open_ns = 0;
+    }
+
+    if(http_post(conn, priv->batch_prec, priv->batch, len) < 0){
+        IFWR_ERR("Could not send batch of %i bytes\n", len);
+        return -1;
+    }
+
+    IFWR_DBG("Success! Sent batch of %i bytes\n", len);
+    return http_collect(conn) || high_ret ? -1 : 0;
+}
+
+
+static int batch_append(ifwr_conn_t* conn, const char* prec, const char* line, int line_len)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    //A batch is a single POST, so it can only carry one precision
+    const bool prec_change = priv->batch_prec && strcmp(priv->batch_prec, prec) != 0;
+    if(priv->batch_len && (prec_change || priv->batch_len + line_len > priv->batch_cap)){
+        if(batch_flush(conn)){
+            return -1;
+        }
+    }
+
+    //Too big for even an empty batch, just send it on its own
+    if(line_len > priv->batch_cap){
+        IFWR_DBG("Line of %i bytes is bigger than the batch, sending directly\n", line_len);
+        int ret = http_post(conn, prec, line, line_len);
+        if(ret < 0){
+            return -1;
+        }
+        return http_collect(conn) ? -1 : ret;
+    }
+
+    if(priv->lanes){
+        const int64_t now = mono_ns();
+        if(!priv->batch_points){
+            priv->batch_open_ns = now;
+        }
+        priv->batch_points++;
+        priv->batch_queued_ns += now - priv->batch_open_ns;
+    }
+    else if(!priv->batch_len && IFWR_PROBE_ENABLED(batch)){
+        priv->batch_open_ns = mono_ns();
+    }
+
+    memcpy(priv->batch + priv->batch_len, line, line_len);
+    priv->batch_len += line_len;
+    priv->batch_prec = prec;
+
+    IFWR_DBG("Batched %i bytes, %i of %i used\n", line_len, priv->batch_len, priv->batch_cap);
+    return line_len;
+}
+
+
+//Precisions travel through the shared memory ring as a small tag
+static const char* const shm_precs[] = { "ns", "us", "ms", "s" };
+
+//-1 for a precision InfluxDB doesn't know
+static int prec_tag(const char* prec)
+{
+    for(int tag = 0; tag < (int)(sizeof(shm_precs) / sizeof(shm_precs[0])); tag++){
+        if(strcmp(shm_precs[tag], prec) == 0){
+            return tag;
+        }
+    }
+
+    return -1;
+}
+
+
+static int shm_append(ifwr_conn_t* conn, const char* prec, const char* line, int line_len)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    const int tag = prec_tag(prec);
+    if(tag < 0){
+        IFWR_ERR("Unknown precision \"%s\"\n", prec);
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    void* rec = NULL;
+    void* slot = ifwr_shmring_reserve(priv->shm, line_len, tag, &rec);
+    if(!slot){
+        IFWR_DBG("Shared memory ring is full\n");
+        IFWR_PROBE2(drop, IFWR_DROP_QFULL, count_points(line, line_len));
+        IFWR_SET_ERROR(IFWR_ERR_QFULL);
+        return -1;
+    }
+
+    memcpy(slot, line, line_len);
+    ifwr_shmring_commit(priv->shm, rec, line_len);
+
+    //Every line is a request of its own as far as the clock is concerned
+    clock_new_window(conn);
+    return line_len;
+}
+
+
+const char* ifwr_shm_prec(uint16_t tag)
+{
+    if(tag >= sizeof(shm_precs) / sizeof(shm_precs[0])){
+        return NULL;
+    }
+
+    return shm_precs[tag];
+}
+
+
+//Hand a formatted line to whichever transport this connection uses
+static int send_line(ifwr_conn_t* conn, const char* prec, const char* line, int line_len)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    if(priv->shm){
+        return shm_append(conn, prec, line, line_len);
+    }
+
+    if(priv->dgram){
+        return dgram_append(conn, line, line_len);
+    }
+
+    if(priv->batch){
+        return batch_append(conn, prec, line, line_len);
+    }
+
+    return http_post(conn, prec, line, line_len);
+}
+
+
+//Another bucket, precision or priority, with a batch of its own
+struct ifwr_route
+{
+    char* bucket;       //NULL for conn->bucket
+    const char* prec;
+    bool high;
+
+    //Swapped with the connection's own
+    char* batch;
+    int batch_len;
+    const char* batch_prec;
+    const char* post_bucket;
+    bool batch_high;
+    int batch_points;
+    int64_t batch_open_ns;
+    int64_t batch_queued_ns;
+};
+
+
+//A route's batch is swapped in while it is being worked on, so that all of
+//the batching code applies to it unchanged. Swap again to put it back.
+static void route_swap(ifwr_priv_t* priv, struct ifwr_route* route)
+{
+    char* const batch = priv->batch;
+    const int batch_len = priv->batch_len;
+    const char* const batch_prec = priv->batch_prec;
+    const char* const post_bucket = priv->post_bucket;
+    const bool batch_high = priv->batch_high;
+    const int batch_points = priv->batch_points;
+    const int64_t batch_open_ns = priv->batch_open_ns;
+    const int64_t batch_queued_ns = priv->batch_queued_ns;
+
+    priv->batch = route->batch;
+    priv->batch_len = route->batch_len;
+    priv->batch_prec = route->batch_prec;
+    priv->post_bucket = route->post_bucket;
+    priv->batch_high = route->batch_high;
+    priv->batch_points = route->batch_points;
+    priv->batch_open_ns = route->batch_open_ns;
+    priv->batch_queued_ns = route->batch_queued_ns;
+
+    route->batch = batch;
+    route->batch_len = batch_len;
+    route->batch_prec = batch_prec;
+    route->post_bucket = post_bucket;
+    route->batch_high = batch_high;
+    route->batch_points = batch_points;
+    route->batch_open_ns = batch_open_ns;
+    route->batch_queued_ns = batch_queued_ns;
+}
+
+
+static int route_check(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    if(priv->shm || priv->dgram){
+        IFWR_DBG("Only HTTP connections can write to other buckets\n");
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static bool route_match(const struct ifwr_route* route, const char* bucket, const char* prec,
+        bool high)
+{
+    if(route->high != high || strcmp(route->prec, prec) != 0){
+        return false;
+    }
+
+    return route->bucket && bucket ? strcmp(route->bucket, bucket) == 0 : route->bucket == bucket;
+}
+
+
+static struct ifwr_route* route_get(ifwr_conn_t* conn, const char* bucket, const char* prec,
+        bool high)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    for(int i = 0; i < priv->nroutes; i++){
+        struct ifwr_route* route = &priv->routes[i];
+        if(route_match(route, bucket, prec, high)){
+            return route;
+        }
+    }
+
+    if(route_check(conn)){
+        return NULL;
+    }
+
+    if(priv->nroutes == IFWR_MAX_BUCKETS){
+        IFWR_DBG("No more than %i other bucket batches per connection\n", IFWR_MAX_BUCKETS);
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return NULL;
+    }
+
+    if(!priv->routes){
+        priv->routes = calloc(IFWR_MAX_BUCKETS, sizeof(struct ifwr_route));
+        if(!priv->routes){
+            IFWR_DBG("Could not allocate bucket routes\n");
+            IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+            return NULL;
+        }
+    }
+
+    struct ifwr_route* route = &priv->routes[priv->nroutes];
+    memset(route, 0, sizeof(*route));
+    route->bucket = bucket ? strdup(bucket) : NULL;
+    route->prec = prec;
+    route->high = high;
+    route->post_bucket = route->bucket;
+    route->batch_high = high;
+    route->batch = priv->batch_cap ? calloc(1, priv->batch_cap) : NULL;
+    if((bucket && !route->bucket) || (priv->batch_cap && !route->batch)){
+        IFWR_DBG("Could not allocate batch for bucket %s\n", bucket ? bucket : conn->bucket);
+        IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+        free(route->bucket);
+        free(route->batch);
+        return NULL;
+    }
+
+    IFWR_DBG("Success! Added %s batch for bucket %s, precision %s\n", high ? "high priority" : "bulk",
+            bucket ? bucket : conn->bucket, prec);
+    priv->lanes |= high;
+    priv->nroutes++;
+    return route;
+}
+
+
+//Send every high priority batch
+static int lanes_flush(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    priv->prio_open_ns = 0;
+
+    int ret = 0;
+    for(int i = 0; i < priv->nroutes; i++){
+        struct ifwr_route* route = &priv->routes[i];
+        if(!route->high || !route->batch_len){
+            continue;
+        }
+
+        route_swap(priv, route);
+        ret |= batch_flush(conn);
+        route_swap(priv, route);
+    }
+
+    return ret ? -1 : 0;
+}
+
+
+//Lines for other buckets are batched by bucket and precision, so that mixed
+//precisions don't force batches out early. High priority lines are batched
+//apart from the rest, even for conn->bucket.
+static int send_line_route(ifwr_conn_t* conn, const char* bucket, bool high, const char* prec,
+        const char* line, int line_len)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    IFWR_PROBE2(point, line_len, high);
+
+    if(priv->prio_open_ns && mono_ns() - priv->prio_open_ns >= conn->prio_delay_us * 1000LL){
+        if(lanes_flush(conn)){
+            return -1;
+        }
+    }
+
+    //Without a batch there is nothing for high priority lines to overtake
+    high &= priv->batch && !priv->shm && !priv->dgram;
+    if(!bucket && !high){
+        return send_line(conn, prec, line, line_len);
+    }
+
+    struct ifwr_route* route = route_get(conn, bucket, prec, high);
+    if(!route){
+        return -1;
+    }
+
+    route_swap(priv, route);
+    int ret = send_line(conn, prec, line, line_len);
+    if(ret >= 0 && high && priv->batch_len){
+        if(!conn->prio_delay_us){
+            ret = batch_flush(conn) ? -1 : ret;
+        }
+        else if(!priv->prio_open_ns){
+            priv->prio_open_ns = priv->batch_open_ns;
+        }
+    }
+    route_swap(priv, route);
+    return ret;
+}
+
+
+static int routes_flush(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    int ret = 0;
+    for(int i = 0; i < priv->nroutes; i++){
+        struct ifwr_route* route = &priv->routes[i];
+        if(!route->batch_len){
+            continue;
+        }
+
+        route_swap(priv, route);
+        ret |= batch_flush(conn);
+        route_swap(priv, route);
+    }
+
+    return ret ? -1 : 0;
+}
+
+
+static bool routes_pending(const ifwr_priv_t* priv)
+{
+    for(int i = 0; i < priv->nroutes; i++){
+        if(priv->routes[i].batch_len){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static void routes_free(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    for(int i = 0; i < priv->nroutes; i++){
+        free(priv->routes[i].bucket);
+        free(priv->routes[i].batch);
+    }
+
+    free(priv->routes);
+    priv->routes = NULL;
+    priv->nroutes = 0;
+}
+
+
+IFWR_HOT int ifwr_write_line(ifwr_conn_t* conn, const char* prec, const char* lines, int len)
+{
+    if(IFWR_BADARG(!conn)){
+        IFWR_DBG("No connection supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
+
+    if(IFWR_BADARG(!prec || !lines || len <= 0)){
+        IFWR_DBG("No lines supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    return send_line_route(conn, NULL, false, prec, lines, len);
+}
+
+
+IFWR_HOT int ifwr_send(
+		ifwr_conn_t* conn,
+		const char* measurement,
+		const ifwr_ktv_t* tags,
+		const ifwr_ktv_t* fields,
+		ifwr_fmt_e ts_fmt,
+		int64_t ts_val
+		)
+{
+    if(IFWR_BADARG(!conn)){
+        IFWR_DBG("No connection supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
+
+    char line[IFWR_MAX_MSG];
+    const char* prec = NULL;
+    int line_len = fmt_line(conn, measurement, tags, fields, ts_fmt, ts_val, line, IFWR_MAX_MSG, &prec);
+    if(line_len < 0){
+        return -1;
+    }
+
+    return send_line_route(conn, NULL, false, prec, line, line_len);
+}
+
+
+IFWR_HOT int ifwr_send_bucket(
+		ifwr_conn_t* conn,
+		const char* bucket,
+		const char* measurement,
+		const ifwr_ktv_t* tags,
+		const ifwr_ktv_t* fields,
+		ifwr_fmt_e ts_fmt,
+		int64_t ts_val
+		)
+{
+    return ifwr_send_prio(conn, IFWR_PRIO_BULK, bucket, measurement, tags, fields, ts_fmt, ts_val);
+}
+
+
+IFWR_HOT int ifwr_send_prio(
+		ifwr_conn_t* conn,
+		ifwr_prio_e prio,
+		const char* bucket,
+		const char* measurement,
+		const ifwr_ktv_t* tags,
+		const ifwr_ktv_t* fields,
+		ifwr_fmt_e ts_fmt,
+		int64_t ts_val
+		)
+{
+    if(IFWR_BADARG(!conn)){
+        IFWR_DBG("No connection supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
+
+    if(IFWR_BADARG(prio < IFWR_PRIO_BULK || prio >= IFWR_PRIO_COUNT)){
+        IFWR_DBG("Unknown priority %i\n", prio);
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    if(bucket && route_check(conn)){
+        return -1;
+    }
+
+    char line[IFWR_MAX_MSG];
+    const char* prec = NULL;
+    int line_len = fmt_line(conn, measurement, tags, fields, ts_fmt, ts_val, line, IFWR_MAX_MSG, &prec);
+    if(line_len < 0){
+        return -1;
+    }
+
+    return send_line_route(conn, bucket, prio == IFWR_PRIO_HIGH, prec, line, line_len);
+}
+
+
+int ifwr_series_prepare(
+        ifwr_conn_t* conn,
+        const char* measurement,
+        const ifwr_ktv_t* tags,
+        const ifwr_ktv_t* fields)
+{
+    if(!conn){
+        IFWR_DBG("No connection supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
+
+    ifwr_priv_t* const priv = &conn->__private;
+
+    if(!measurement){
+        if(!priv->default_measurement){
+            IFWR_SET_ERROR(IFWR_ERR_NOMEASURE);
+            IFWR_ERR("No default measurement name is set\n");
+            return -1;
+        }
+
+        measurement = priv->default_measurement;
+    }
+
+    char tags_str[IFWR_MAX_MSG] = {0};
+    if(!tags){
+        if(!priv->default_tagset){
+            IFWR_SET_ERROR(IFWR_ERR_NOTAGS);
+            IFWR_ERR("No default tagset is set\n");
+            return -1;
+        }
+        snprintf(tags_str, IFWR_MAX_MSG, "%s", priv->default_tagset);
+    }
+    else{
+        ktv2str(tags_str, IFWR_MAX_MSG, tags);
+    }
+
+    if(priv->card && card_guard(conn, measurement, tags_str)){
+        return -1;
+    }
+
+    if(!fields || fields[0].type == IFWR_TYPE_STOP){
+        IFWR_SET_ERROR(IFWR_ERR_NOFIELDS);
+        IFWR_ERR("No measurement fields supplied!\n");
+        return -1;
+    }
+
+    if(priv->series_count >= IFWR_MAX_SERIES){
+        IFWR_ERR("Cannot prepare more than %i series\n", IFWR_MAX_SERIES);
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    if(!priv->series){
+        priv->series = calloc(IFWR_MAX_SERIES, sizeof(struct ifwr_series*));
+        if(!priv->series){
+            IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+            return -1;
+        }
+    }
+
+    int nfields = 0;
+    while(fields[nfields].type != IFWR_TYPE_STOP){
+        nfields++;
+    }
+
+    struct ifwr_series* series = calloc(1, sizeof(struct ifwr_series));
+    char prefix[IFWR_MAX_MSG];
+    const int prefix_len = snprintf(prefix, IFWR_MAX_MSG, "%s,%s ", measurement, tags_str);
+    if(series){
+        series->prefix = strdup(prefix);
+        series->types = calloc(nfields, sizeof(ifwr_type_e));
+        series->keys = calloc(nfields, sizeof(char*));
+    }
+    if(!series || !series->prefix || !series->types || !series->keys){
+        IFWR_ERR("Could not allocate series with %i fields\n", nfields);
+        IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+        if(series){
+            free(series->prefix);
+            free(series->types);
+            free(series->keys);
+            free(series);
+        }
+        return -1;
+    }
+
+    series->prefix_len = prefix_len;
+    series->nfields = nfields;
+    for(int i = 0; i < nfields; i++){
+        series->types[i] = fields[i].type;
+        series->keys[i] = strdup(fields[i].key);
+        if(!series->keys[i]){
+            IFWR_ERR("Could not copy field key \"%s\"\n", fields[i].key);
+            IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+            while(i--){
+                free(series->keys[i]);
+            }
+            free(series->prefix);
+            free(series->types);
+            free(series->keys);
+            free(series);
+            return -1;
+        }
+    }
+
+    const int id = priv->series_count;
+    priv->series[id] = series;
+    __atomic_store_n(&priv->series_count, id + 1, __ATOMIC_RELEASE);
+
+    IFWR_DBG("Success! Prepared series %i \"%s\" with %i fields\n", id, prefix, nfields);
+    return id;
+}
+
+
+//Swap the trailing "," after the fields for the timestamp, and end the line
+static int fmt_line_end(
+        ifwr_conn_t* conn,
+        char* line,
+        int line_len,
+        int line_max,
+        ifwr_fmt_e ts_fmt,
+        int64_t ts_val,
+        const char** prec_out)
+{
+    char ts_str[TS_LEN_MAX];
+    const int ts_len = fmt_ts(conn, ts_fmt, ts_val, ts_str, prec_out);
+    if(ts_len < 0){
+        return -1;
+    }
+
+    if(line_len + ts_len + 1 >= line_max){
+        IFWR_ERR("Line does not fit in %i bytes\n", line_max);
+        IFWR_SET_ERROR(IFWR_ERR_MSGTOOBIG);
+        return -1;
+    }
+
+    line[line_len - 1] = ' ';
+    memcpy(line + line_len, ts_str, ts_len);
+    line_len += ts_len;
+    line[line_len++] = '\n';
+    return line_len;
+}
+
+
+static int fmt_series(
+        ifwr_conn_t* conn,
+        const struct ifwr_series* series,
+        const ifwr_value_u* values,
+        ifwr_fmt_e ts_fmt,
+        int64_t ts_val,
+        char* line,
+        int line_max,
+        const char** prec_out)
+{
+    if(series->prefix_len >= line_max){
+        IFWR_SET_ERROR(IFWR_ERR_MSGTOOBIG);
+        return -1;
+    }
+
+    memcpy(line, series->prefix, series->prefix_len);
+    int line_len = series->prefix_len;
+    for(int i = 0; i < series->nfields; i++){
+        line_len += fmt_value(line + line_len, line_max - line_len, series->keys[i], series->types[i], values[i]);
+        if(line_len >= line_max){
+            IFWR_ERR("Line does not fit in %i bytes\n", line_max);
+            IFWR_SET_ERROR(IFWR_ERR_MSGTOOBIG);
+            return -1;
+        }
+    }
+
+    return fmt_line_end(conn, line, line_len, line_max, ts_fmt, ts_val, prec_out);
+}
+
+
+static struct ifwr_series* series_get(ifwr_conn_t* conn, int series)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    if(series < 0 || series >= __atomic_load_n(&priv->series_count, __ATOMIC_ACQUIRE)){
+        IFWR_DBG("No such series %i\n", series);
+        return NULL;
+    }
+
+    return priv->series[series];
+}
+
+
+int ifwr_series_aggregate(ifwr_conn_t* conn, int series, int64_t window, unsigned aggs)
+{
+    if(!conn){
+        IFWR_DBG("No connection supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
+
+    struct ifwr_series* const s = series_get(conn, series);
+    if(!s || window <= 0 || !aggs || (aggs & ~IFWR_AGG_ALL)){
+        IFWR_DBG("Need a series, a positive window and some aggregates\n");
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    struct ifwr_agg* agg = calloc(1, sizeof(struct ifwr_agg) + s->nfields * sizeof(agg_field_t));
+    if(!agg){
+        IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+        return -1;
+    }
+
+    agg->window = window;
+    agg->aggs = aggs;
+
+    free(s->agg);
+    s->agg = agg;
+
+    IFWR_DBG("Success! Aggregating series %i over windows of %" PRIi64 "\n", series, window);
+    return 0;
+}
+
+
+static int fmt_agg_value(char* buff, int buff_len, const char* key, const char* suffix,
+        ifwr_type_e type, ifwr_value_u value)
+{
+    if(type == IFWR_TYPE_INT){
+        return snprintf(buff, buff_len, "%s_%s=%" PRIi64 "i,", key, suffix, value.i);
+    }
+
+    return snprintf(buff, buff_len, "%s_%s=%lf,", key, suffix, value.f);
+}
+
+
+//Send one point summarising the open window, then close it
+static int agg_emit(ifwr_conn_t* conn, struct ifwr_series* s)
+{
+    struct ifwr_agg* const agg = s->agg;
+    const int64_t count = agg->count;
+    agg->count = 0;
+
+    char line[IFWR_MAX_MSG];
+    int line_len = s->prefix_len;
+    memcpy(line, s->prefix, line_len);
+
+    for(int i = 0; i < s->nfields && line_len < IFWR_MAX_MSG; i++){
+        char* const out = line + line_len;
+        const int out_len = IFWR_MAX_MSG - line_len;
+        const agg_field_t* const f = &agg->fields[i];
+        const char* const key = s->keys[i];
+        const ifwr_type_e type = s->types[i];
+
+        //Strings and bools can't be summarised, so they just keep the last value
+        if(type != IFWR_TYPE_INT && type != IFWR_TYPE_FLOAT){
+            line_len += fmt_value(out, out_len, key, type, f->last);
+            continue;
+        }
+
+        int n = 0;
+        if(agg->aggs & IFWR_AGG_MIN){
+            n += fmt_agg_value(out + n, out_len - n, key, "min", type, f->min);
+        }
+        if(agg->aggs & IFWR_AGG_MAX && n < out_len){
+            n += fmt_agg_value(out + n, out_len - n, key, "max", type, f->max);
+        }
+        if(agg->aggs & IFWR_AGG_SUM && n < out_len){
+            n += fmt_agg_value(out + n, out_len - n, key, "sum", type, f->sum);
+        }
+        if(agg->aggs & IFWR_AGG_COUNT && n < out_len){
+            const ifwr_value_u v = { .i = count };
+            n += fmt_agg_value(out + n, out_len - n, key, "count", IFWR_TYPE_INT, v);
+        }
+        if(agg->aggs & IFWR_AGG_MEAN && n < out_len){
+            const double sum = type == IFWR_TYPE_INT ? (double)f->sum.i : f->sum.f;
+            const ifwr_value_u v = { .f = sum / count };
+            n += fmt_agg_value(out + n, out_len - n, key, "mean", IFWR_TYPE_FLOAT, v);
+        }
+        if(agg->aggs & IFWR_AGG_LAST && n < out_len){
+            n += fmt_agg_value(out + n, out_len - n, key, "last", type, f->last);
+        }
+        line_len += n;
+    }
+
+    const char* prec = NULL;
+    line_len = fmt_line_end(conn, line, line_len, IFWR_MAX_MSG, agg->ts_fmt, agg->start, &prec);
+    if(line_len < 0){
+        return -1;
+    }
+
+    IFWR_DBG("Closed window at %" PRIi64 " with %" PRIi64 " samples\n", agg->start, count);
+    return send_line_route(conn, s->bucket, s->high, prec, line, line_len);
+}
+
+
+//Fold a sample into the open window. Windows close when a sample for a later
+//window arrives, so the output only depends on the sample timestamps. Late
+//samples are counted in the open window.
+static int agg_add(ifwr_conn_t* conn, struct ifwr_series* s, const ifwr_value_u* values,
+        ifwr_fmt_e ts_fmt, int64_t ts_val)
+{
+    struct ifwr_agg* const agg = s->agg;
+
+    if(ts_fmt == IFWR_TS_LOCAL){
+        if(local_now_ns(conn, &ts_val) < 0){
+            return -1;
+        }
+        ts_fmt = IFWR_TS_NANOS;
+    }
+
+    if(ts_fmt == IFWR_TS_UNDEF || ts_fmt == IFWR_TS_REMOTE){
+        IFWR_ERR("Aggregated series need a timestamp to find their window\n");
+        IFWR_SET_ERROR(IFWR_ERR_NOTIME);
+        return -1;
+    }
+
+    int64_t offset = ts_val % agg->window;
+    if(offset < 0){
+        offset += agg->window;
+    }
+    const int64_t start = ts_val - offset;
+
+    int ret = 0;
+    if(agg->count && (ts_fmt != agg->ts_fmt || start > agg->start)){
+        ret = agg_emit(conn, s);
+    }
+
+    if(!agg->count){
+        agg->ts_fmt = ts_fmt;
+        agg->start = start;
+        for(int i = 0; i < s->nfields; i++){
+            agg_field_t* const f = &agg->fields[i];
+            f->min = f->max = f->sum = f->last = values[i];
+        }
+        agg->count = 1;
+        return ret;
+    }
+
+    for(int i = 0; i < s->nfields; i++){
+        agg_field_t* const f = &agg->fields[i];
+        const ifwr_value_u v = values[i];
+        switch(s->types[i]){
+            case IFWR_TYPE_INT:
+                f->min.i = v.i < f->min.i ? v.i : f->min.i;
+                f->max.i = v.i > f->max.i ? v.i : f->max.i;
+                f->sum.i += v.i;
+                break;
+            case IFWR_TYPE_FLOAT:
+                f->min.f = v.f < f->min.f ? v.f : f->min.f;
+                f->max.f = v.f > f->max.f ? v.f : f->max.f;
+                f->sum.f += v.f;
+                break;
+            default:
+                break;
+        }
+        f->last = v;
+    }
+    agg->count++;
+
+    return ret;
+}
+
+
+static int series_close_windows(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    int ret = 0;
+    for(int i = 0; i < priv->series_count; i++){
+        struct ifwr_series* const s = priv->series[i];
+        if(s->agg && s->agg->count && agg_emit(conn, s) < 0){
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+
+int ifwr_series_deadband(ifwr_conn_t* conn, int series, double abs, double rel, int64_t heartbeat)
+{
+    if(!conn){
+        IFWR_DBG("No connection supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
+
+    struct ifwr_series* const s = series_get(conn, series);
+    if(!s || abs < 0 || rel < 0 || heartbeat < 0){
+        IFWR_DBG("Need a series, and deadbands and heartbeat that are not negative\n");
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    if(s->dedup){
+        IFWR_DBG("Series %i already has a deadband\n", series);
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    struct ifwr_dedup* dedup = calloc(1, sizeof(struct ifwr_dedup) + s->nfields * sizeof(ifwr_value_u));
+    if(!dedup){
+        IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+        return -1;
+    }
+
+    dedup->abs = abs;
+    dedup->rel = rel;
+    dedup->heartbeat = heartbeat;
+    s->dedup = dedup;
+
+    IFWR_DBG("Success! Suppressing unchanged points on series %i\n", series);
+    return 0;
+}
+
+
+//Saves dragging in libm for one function
+static double dabs(double x)
+{
+    return x < 0 ? -x : x;
+}
+
+
+static bool dedup_unchanged(const struct ifwr_dedup* dedup, ifwr_type_e type, ifwr_value_u last,
+        ifwr_value_u v)
+{
+    switch(type){
+        case IFWR_TYPE_INT:
+            return v.i == last.i;
+        case IFWR_TYPE_FLOAT:{
+            const double diff = dabs(v.f - last.f);
+            return diff <= dedup->abs || diff <= dedup->rel * dabs(last.f);
+        }
+        case IFWR_TYPE_BOOL:
+            return v.b == last.b;
+        case IFWR_TYPE_STRING:
+            return v.s && last.s && strcmp(v.s, last.s) == 0;
+        default:
+            return false; //Histograms always have news
+    }
+}
+
+
+//True if the point is close enough to the last one sent to leave out
+static bool dedup_suppress(const struct ifwr_series* s, const ifwr_value_u* values,
+        ifwr_fmt_e ts_fmt, int64_t ts_val)
+{
+    const struct ifwr_dedup* const dedup = s->dedup;
+    if(!dedup->sent){
+        return false;
+    }
+
+    const bool stamped = ts_fmt != IFWR_TS_REMOTE && ts_fmt != IFWR_TS_UNDEF;
+    if(dedup->heartbeat && stamped &&
+       (ts_fmt != dedup->ts_fmt || ts_val - dedup->ts_val >= dedup->heartbeat)){
+        return false;
+    }
+
+    for(int i = 0; i < s->nfields; i++){
+        if(!dedup_unchanged(dedup, s->types[i], dedup->last[i], values[i])){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static void dedup_sent(struct ifwr_series* s, const ifwr_value_u* values, ifwr_fmt_e ts_fmt,
+        int64_t ts_val)
+{
+    struct ifwr_dedup* const dedup = s->dedup;
+
+    for(int i = 0; i < s->nfields; i++){
+        if(s->types[i] != IFWR_TYPE_STRING){
+            dedup->last[i] = values[i];
+            continue;
+        }
+
+        if(dedup->last[i].s && values[i].s && strcmp(dedup->last[i].s, values[i].s) == 0){
+            continue;
+        }
+        free(dedup->last[i].s);
+        dedup->last[i].s = values[i].s ? strdup(values[i].s) : NULL;
+    }
+
+    dedup->ts_fmt = ts_fmt;
+    dedup->ts_val = ts_val;
+    dedup->sent = true;
+}
+
+
+int ifwr_series_counter(ifwr_conn_t* conn, int series, unsigned outputs, int bits)
+{
+    if(!conn){
+        IFWR_DBG("No connection supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
+
+    bits = bits ? bits : 64;
+    struct ifwr_series* const s = series_get(conn, series);
+    if(!s || !outputs || (outputs & ~IFWR_CTR_ALL) || bits < 1 || bits > 64){
+        IFWR_DBG("Need a series, some outputs and a counter width in the range [1..64]\n");
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    struct ifwr_counter* counter = calloc(1, sizeof(struct ifwr_counter) + s->nfields * sizeof(int64_t));
+    if(!counter){
+        IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+        return -1;
+    }
+
+    counter->outputs = outputs;
+    counter->mask = bits == 64 ? UINT64_MAX : (1ULL << bits) - 1;
+
+    free(s->counter);
+    s->counter = counter;
+
+    IFWR_DBG("Success! Treating integer fields of series %i as %i bit counters\n", series, bits);
+    return 0;
+}
+
+
+int ifwr_series_bucket(ifwr_conn_t* conn, int series, const char* bucket)
+{
+    struct ifwr_series* s = series_get(conn, series);
+    if(!s){
+        return -1;
+    }
+
+    if(bucket && route_check(conn)){
+        return -1;
+    }
+
+    char* copy = bucket ? strdup(bucket) : NULL;
+    if(bucket && !copy){
+        IFWR_DBG("Could not allocate bucket name\n");
+        IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+        return -1;
+    }
+
+    free(s->bucket);
+    s->bucket = copy;
+    return 0;
+}
+
+
+int ifwr_series_priority(ifwr_conn_t* conn, int series, ifwr_prio_e prio)
+{
+    struct ifwr_series* s = series_get(conn, series);
+    if(!s){
+        return -1;
+    }
+
+    if(prio < IFWR_PRIO_BULK || prio >= IFWR_PRIO_COUNT){
+        IFWR_DBG("Unknown priority %i\n", prio);
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    ifwr_priv_t* const priv = &conn->__private;
+    if(prio == IFWR_PRIO_HIGH && priv->lazy && !priv->lazy_high){
+        priv->lazy_high = lazy_ring(conn);
+        if(!priv->lazy_high){
+            return -1;
+        }
+    }
+
+    s->high = prio == IFWR_PRIO_HIGH;
+    return 0;
+}
+
+
+//How far a counter moved. Going backwards is a wrap if that makes for a
+//plausible step (less than half the range), otherwise the counter was reset
+//and counts from zero again.
+static uint64_t counter_delta(uint64_t mask, int64_t prev, int64_t cur)
+{
+    const uint64_t old = (uint64_t)prev & mask;
+    const uint64_t now = (uint64_t)cur & mask;
+    if(now >= old){
+        return now - old;
+    }
+
+    const uint64_t wrapped = (now - old) & mask;
+    if(mask != UINT64_MAX && wrapped <= mask / 2){
+        return wrapped;
+    }
+
+    return now;
+}
+
+
+static int64_t ts_per_sec(ifwr_fmt_e ts_fmt)
+{
+    switch(ts_fmt){
+        case IFWR_TS_SECS:   return 1;
+        case IFWR_TS_MILLIS: return 1000;
+        case IFWR_TS_MICROS: return 1000 * 1000;
+        case IFWR_TS_NANOS:  return 1000 * 1000 * 1000;
+        default:             return 0;
+    }
+}
+
+
+static int counter_emit(ifwr_conn_t* conn, struct ifwr_series* s, const ifwr_value_u* values,
+        ifwr_fmt_e ts_fmt, int64_t ts_val)
+{
+    struct ifwr_counter* const counter = s->counter;
+
+    //Rates need a clock. Points without a timestamp use the local one.
+    ifwr_fmt_e clk_fmt = ts_fmt;
+    int64_t clk_val = ts_val;
+    if(ts_fmt == IFWR_TS_LOCAL || ts_fmt == IFWR_TS_REMOTE){
+        if(local_now_ns(conn, &clk_val) < 0){
+            return -1;
+        }
+        clk_fmt = IFWR_TS_NANOS;
+        if(ts_fmt == IFWR_TS_LOCAL){
+            ts_fmt = clk_fmt;
+            ts_val = clk_val;
+        }
+    }
+
+    const bool primed = counter->primed && counter->ts_fmt == clk_fmt;
+    const int64_t elapsed = clk_val - counter->ts_val;
+
+    //With nothing to diff against, only the raw values can go out
+    const bool diff = primed && (counter->outputs & ~IFWR_CTR_RAW);
+    if(!diff && !(counter->outputs & IFWR_CTR_RAW)){
+        for(int i = 0; i < s->nfields; i++){
+            counter->prev[i] = values[i].i;
+        }
+        counter->primed = true;
+        counter->ts_fmt = clk_fmt;
+        counter->ts_val = clk_val;
+        return 0;
+    }
+
+    char line[IFWR_MAX_MSG];
+    int line_len = s->prefix_len;
+    memcpy(line, s->prefix, line_len);
+
+    for(int i = 0; i < s->nfields && line_len < IFWR_MAX_MSG; i++){
+        char* const out = line + line_len;
+        const int out_len = IFWR_MAX_MSG - line_len;
+        const char* const key = s->keys[i];
+
+        if(s->types[i] != IFWR_TYPE_INT){
+            line_len += fmt_value(out, out_len, key, s->types[i], values[i]);
+            continue;
+        }
+
+        const uint64_t delta = counter_delta(counter->mask, counter->prev[i], values[i].i);
+        counter->prev[i] = values[i].i;
+
+        int n = 0;
+        if(counter->outputs & IFWR_CTR_RAW){
+            n += fmt_value(out, out_len, key, IFWR_TYPE_INT, values[i]);
+        }
+        if(diff && counter->outputs & IFWR_CTR_DELTA && n < out_len){
+            const ifwr_value_u v = { .i = (int64_t)delta };
+            n += fmt_agg_value(out + n, out_len - n, key, "delta", IFWR_TYPE_INT, v);
+        }
+        if(diff && counter->outputs & IFWR_CTR_RATE && elapsed > 0 && n < out_len){
+            const ifwr_value_u v = { .f = (double)delta * ts_per_sec(clk_fmt) / elapsed };
+            n += fmt_agg_value(out + n, out_len - n, key, "rate", IFWR_TYPE_FLOAT, v);
+        }
+        line_len += n;
+    }
+
+    counter->primed = true;
+    counter->ts_fmt = clk_fmt;
+    counter->ts_val = clk_val;
+
+    //Only rates were asked for and no time has passed, so there is nothing to
+    //say. A line with no fields would get the whole request rejected.
+    if(line_len == s->prefix_len){
+        IFWR_DBG("No time has passed since the last point, no rates to send\n");
+        return 0;
+    }
+
+    const char* prec = NULL;
+    line_len = fmt_line_end(conn, line, line_len, IFWR_MAX_MSG, ts_fmt, ts_val, &prec);
+    if(line_len < 0){
+        return -1;
+    }
+
+    return send_line_route(conn, s->bucket, s->high, prec, line, line_len);
+}
+
+
+//Every point on a prepared series ends up here, either straight from
+//ifwr_send_series() or from the lazy queue
+static int series_emit(ifwr_conn_t* conn, struct ifwr_series* s, const ifwr_value_u* values,
+        ifwr_fmt_e ts_fmt, int64_t ts_val)
+{
+    if(s->counter){
+        return counter_emit(conn, s, values, ts_fmt, ts_val);
+    }
+
+    if(s->agg){
+        return agg_add(conn, s, values, ts_fmt, ts_val);
+    }
+
+    if(s->dedup){
+        //The heartbeat needs to know when "now" was
+        if(ts_fmt == IFWR_TS_LOCAL){
+            if(local_now_ns(conn, &ts_val) < 0){
+                return -1;
+            }
+            ts_fmt = IFWR_TS_NANOS;
+        }
+
+        if(dedup_suppress(s, values, ts_fmt, ts_val)){
+            return 0;
+        }
+    }
+
+    char line[IFWR_MAX_MSG];
+    const char* prec = NULL;
+    const int line_len = fmt_series(conn, s, values, ts_fmt, ts_val, line, IFWR_MAX_MSG, &prec);
+    if(line_len < 0){
+        return -1;
+    }
+
+    const int ret = send_line_route(conn, s->bucket, s->high, prec, line, line_len);
+    if(ret >= 0 && s->dedup){
+        dedup_sent(s, values, ts_fmt, ts_val);
+    }
+
+    return ret;
+}
+
+
+IFWR_HOT int ifwr_send_series(
+        ifwr_conn_t* conn,
+        int series,
+        const ifwr_value_u* values,
+        ifwr_fmt_e ts_fmt,
+        int64_t ts_val)
+{
+    if(IFWR_BADARG(!conn)){
+        IFWR_DBG("No connection supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
+
+    ifwr_priv_t* const priv = &conn->__private;
+
+    struct ifwr_series* const s = series_get(conn, series);
+    if(!s || !values){
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    if(!priv->lazy){
+        return series_emit(conn, s, values, ts_fmt, ts_val);
+    }
+
+    //Formatting happens later, but "now" means now
+    if(ts_fmt == IFWR_TS_LOCAL){
+        if(local_now_ns(conn, &ts_val) < 0){
+            return -1;
+        }
+        ts_fmt = IFWR_TS_NANOS;
+    }
+
+    const uint32_t len = sizeof(lazy_rec_t) + s->nfields * sizeof(ifwr_value_u);
+    void* handle = NULL;
+    ifwr_shmring_t* const ring = s->high ? priv->lazy_high : priv->lazy;
+    lazy_rec_t* rec = ifwr_shmring_reserve(ring, len, (uint16_t)series, &handle);
+    if(!rec){
+        IFWR_PROBE2(drop, IFWR_DROP_QFULL, 1);
+        IFWR_SET_ERROR(IFWR_ERR_QFULL);
+        return -1;
+    }
+
+    rec->ts_val = ts_val;
+    rec->ts_fmt = ts_fmt;
+    rec->nvalues = s->nfields;
+    memcpy(rec->values, values, s->nfields * sizeof(ifwr_value_u));
+    ifwr_shmring_commit(ring, handle, len);
+
+    return len;
+}
+
+
+IFWR_HOT int ifwr_send_rendered(
+        ifwr_conn_t* conn,
+        ifwr_prio_e prio,
+        const char* bucket,
+        char* line,
+        int line_len,
+        int line_max,
+        ifwr_fmt_e ts_fmt,
+        int64_t ts_val)
+{
+    if(IFWR_BADARG(!conn || !line)){
+        IFWR_DBG("No connection or line supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
+
+    if(IFWR_BADARG(prio < IFWR_PRIO_BULK || prio >= IFWR_PRIO_COUNT || line_len <= 0)){
+        IFWR_DBG("Unknown priority %i, or an empty line\n", prio);
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    if(bucket && route_check(conn)){
+        return -1;
+    }
+
+    if(line_len + 1 >= line_max){
+        IFWR_SET_ERROR(IFWR_ERR_MSGTOOBIG);
+        return -1;
+    }
+
+    //fmt_line_end() swaps the last character for the space
+    const char* prec = NULL;
+    line_len = fmt_line_end(conn, line, line_len + 1, line_max, ts_fmt, ts_val, &prec);
+    if(line_len < 0){
+        return -1;
+    }
+
+    return send_line_route(conn, bucket, prio == IFWR_PRIO_HIGH, prec, line, line_len);
+}
+
+
+//Format everything queued so far and hand it on to the transport, high
+//priority records first
+static int lazy_drain(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    ifwr_shmring_t* const rings[] = { priv->lazy_high, priv->lazy };
+
+    int failed = 0;
+    for(int i = 0; i < 2; i++){
+        const lazy_rec_t* rec = NULL;
+        uint32_t len = 0;
+        uint16_t tag = 0;
+        while(rings[i] && (rec = ifwr_shmring_peek(rings[i], &len, &tag))){
+            if(series_emit(conn, priv->series[tag], rec->values, rec->ts_fmt, rec->ts_val) < 0){
+                failed++;
+            }
+            ifwr_shmring_release(rings[i]);
+        }
+    }
+
+    if(failed){
+        IFWR_ERR("Could not send %i queued points\n", failed);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int ifwr_flush(ifwr_conn_t* conn)
+{
+    if(!conn){
+        IFWR_DBG("No connection supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
+
+    ifwr_priv_t* const priv = &conn->__private;
+
+    clock_new_window(conn);
+
+    if(priv->lazy && lazy_drain(conn)){
+        return -1;
+    }
+
+    if(priv->spill && priv->spill->rd < priv->spill->wr && priv->reactor){
+        if(spill_replay(conn) || reactor_drain_txq(conn) < 0){
+            return -1;
+        }
+    }
+
+    if(priv->dgram){
+        return dgram_flush(conn);
+    }
+
+    int ret = priv->prio_open_ns ? lanes_flush(conn) : 0;
+    if(priv->batch_len && !priv->shm){
+        ret |= batch_flush(conn);
+    }
+    else{
+        //Nothing new to send, but replicas that are behind may be due a retry
+        repl_pump(conn);
+    }
+
+    return routes_flush(conn) || ret ? -1 : 0;
+}
+
+
+//Batches keep what they hold, unless it might not fit any more
+static int batch_resize(ifwr_conn_t* conn, int batch_max)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    const int cap = batch_max || !conn->lazy_queue ? batch_max : IFWR_MAX_MSG;
+    if(cap == priv->batch_cap){
+        return 0;
+    }
+
+    //Buffers bigger than the batch are fine, so shrink it before they are
+    if(cap < priv->batch_cap){
+        if(ifwr_flush(conn)){
+            return -1;
+        }
+        priv->batch_cap = cap;
+    }
+
+    //The io_uring registration is for the old buffer, so stop using it
+    if(priv->uring){
+        priv->uring->batch = NULL;
+    }
+
+    if(!cap){
+        free(priv->batch);
+        priv->batch = NULL;
+        for(int i = 0; i < priv->nroutes; i++){
+            free(priv->routes[i].batch);
+            priv->routes[i].batch = NULL;
+        }
+        return 0;
+    }
+
+    char* batch = realloc(priv->batch, cap);
+    if(!batch){
+        IFWR_DBG("Could not resize batch buffer to %i bytes\n", cap);
+        IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+        return -1;
+    }
+    priv->batch = batch;
+
+    for(int i = 0; i < priv->nroutes; i++){
+        batch = realloc(priv->routes[i].batch, cap);
+        if(!batch){
+            IFWR_DBG("Could not resize batch buffer to %i bytes\n", cap);
+            IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+            return -1;
+        }
+        priv->routes[i].batch = batch;
+    }
+
+    //... and grow it once they all are, so a failure part way leaves them usable
+    priv->batch_cap = cap;
+    return 0;
+}
+
+
+static void peers_retune(ifwr_conn_t* conn);
+
+int ifwr_reconfigure(ifwr_conn_t* conn, const ifwr_conn_t* settings)
+{
+    if(!conn || !settings){
+        IFWR_DBG("No connection or settings supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
+
+    ifwr_priv_t* const priv = &conn->__private;
+
+    if(settings->batch_max < 0 || settings->batch_max > IFWR_MAX_BATCH || settings->prio_delay_us < 0 ||
+            settings->lb < IFWR_LB_FAILOVER || settings->lb > IFWR_LB_LEAST_OUTSTANDING ||
+            settings->lb_max_latency_ms < 0 || settings->mem_budget < 0 || settings->block_timeout_ms < 0 ||
+            settings->overflow < IFWR_OVERFLOW_DROP_NEWEST || settings->overflow > IFWR_OVERFLOW_SPILL){
+        IFWR_DBG("New settings are out of range\n");
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    //There is only a spill file if there was one at connect time
+    if((settings->overflow == IFWR_OVERFLOW_SPILL) != (conn->overflow == IFWR_OVERFLOW_SPILL)){
+        IFWR_DBG("Spilling can only be turned on or off by reconnecting\n");
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    //Datagrams and the shared memory ring don't use the batch
+    const bool batched = !priv->shm && !priv->dgram && priv->sockfd != -1;
+    const bool index = settings->batch_sort || settings->batch_coalesce;
+    if((batched || priv->npeers) && index && !priv->lines){
+        priv->lines = calloc(1, sizeof(ifwr_lines_t));
+        if(!priv->lines){
+            IFWR_DBG("Could not allocate batch sort index\n");
+            IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+            return -1;
+        }
+    }
+
+    if((batched || priv->npeers) && batch_resize(conn, settings->batch_max)){
+        return -1;
+    }
+
+    conn->batch_max         = settings->batch_max;
+    conn->batch_sort        = settings->batch_sort;
+    conn->batch_coalesce    = settings->batch_coalesce;
+    conn->prio_delay_us     = settings->prio_delay_us;
+    conn->lb                = settings->lb;
+    conn->lb_max_latency_ms = settings->lb_max_latency_ms;
+    conn->mem_budget        = settings->mem_budget;
+    //Safe with requests queued, their boundaries are tracked under every policy
+    conn->overflow          = settings->overflow;
+    conn->block_timeout_ms  = settings->block_timeout_ms;
+    peers_retune(conn);
+
+    IFWR_DBG("Success! Reconfigured with %i byte batches\n", priv->batch_cap);
+    return 0;
+}
+
+
+//A request body shared by every replica that still has to send it
+struct ifwr_block
+{
+    int refs;
+    const char* prec;
+    const char* bucket;
+    int len;
+    char data[];
+};
+
+struct ifwr_replica
+{
+    ifwr_conn_t* conn;
+    const char* name;       //For messages
+    ifwr_reactor_t* reactor; //To rejoin after reconnecting
+    bool converted;         //Was blocking, and is on conn's own reactor
+    struct ifwr_block* queue[IFWR_REPL_QUEUE];
+    int head;
+    int64_t retry_ns;       //Monotonic time of the next attempt while unhealthy
+    int64_t backoff_ns;
+    ifwr_replica_stats_t stats;
+};
+
+//Back off between attempts on a failed replica, doubling up to the max
+#define REPL_BACKOFF_MIN_NS (100 * 1000 * 1000LL)
+#define REPL_BACKOFF_MAX_NS (30 * 1000 * 1000 * 1000LL)
+
+
+static int64_t mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000 * 1000LL + ts.tv_nsec;
+}
+
+
+static void block_release(struct ifwr_block* block)
+{
+    if(--block->refs == 0){
+        free(block);
+    }
+}
+
+
+static void repl_pop(struct ifwr_replica* r)
+{
+    struct ifwr_block* block = r->queue[r->head];
+    r->queue[r->head] = NULL;
+    r->head = (r->head + 1) % IFWR_REPL_QUEUE;
+    r->stats.queued--;
+    r->stats.queued_bytes -= block->len;
+    block_release(block);
+}
+
+
+static void repl_push(ifwr_conn_t* conn, const char* prec, const char* content, int content_len)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    struct ifwr_block* block = malloc(sizeof(struct ifwr_block) + content_len);
+    if(!block){
+        IFWR_WARN("Could not allocate %i bytes for replicas, they will miss this request\n", content_len);
+        for(int i = 0; i < priv->nreplicas; i++){
+            priv->replicas[i].stats.dropped++;
+        }
+        return;
+    }
+
+    block->refs = 0;
+    block->prec = prec;
+    block->bucket = priv->post_bucket;
+    block->len = content_len;
+    memcpy(block->data, content, content_len);
+
+    for(int i = 0; i < priv->nreplicas; i++){
+        struct ifwr_replica* r = &priv->replicas[i];
+        if(r->stats.queued == IFWR_REPL_QUEUE){
+            IFWR_DBG("Replica %i queue is full, dropping its oldest request\n", i);
+            IFWR_PROBE2(drop, IFWR_DROP_REPLICA, 1);
+            repl_pop(r);
+            r->stats.dropped++;
+        }
+
+        r->queue[(r->head + r->stats.queued) % IFWR_REPL_QUEUE] = block;
+        r->stats.queued++;
+        r->stats.queued_bytes += content_len;
+        block->refs++;
+    }
+
+    if(!block->refs){
+        free(block);
+    }
+}
+
+
+static void repl_failed(struct ifwr_replica* r, int64_t now)
+{
+    r->stats.healthy = false;
+    r->stats.failures++;
+    r->stats.last_err = r->conn->__private.last_err;
+
+    r->backoff_ns = r->backoff_ns ? r->backoff_ns * 2 : REPL_BACKOFF_MIN_NS;
+    if(r->backoff_ns > REPL_BACKOFF_MAX_NS){
+        r->backoff_ns = REPL_BACKOFF_MAX_NS;
+    }
+    r->retry_ns = now + r->backoff_ns;
 
+    IFWR_WARN("Replica %s failed with \"%s\", retrying in %lims\n", r->name,
+            ifwr_err2str(r->stats.last_err), (long)(r->backoff_ns / 1000 / 1000));
 }
 
-static int ktv2str(char* buff, int buff_len, const ifwr_ktv_t* ktv )
+
+//Send as much of a replica's queue as it will take
+static void repl_drain(struct ifwr_replica* r, int64_t now)
 {
-    int written = 0;
-    for(const ifwr_ktv_t* curr = ktv; curr->type != IFWR_TYPE_STOP; curr++){
-        switch(curr->type){
-            case IFWR_TYPE_STOP:
-                //Impossible ? -- handled above
-                IFWR_FAT("Impossible situation has happend!?\n");
-                break;
+    ifwr_conn_t* const rconn = r->conn;
+    ifwr_priv_t* const rpriv = &rconn->__private;
 
-            case IFWR_TYPE_BOOL:
-                if(curr->value.b){
-                    written += snprintf(buff + written, buff_len - written,"%s=True,", curr->key );
-                }
-                else{
-                    written += snprintf(buff + written, buff_len - written,"%s=False,", curr->key );
-                }
-                continue;
+    //Added to a reactor after ifwr_replicate()
+    if(rpriv->reactor){
+        r->reactor = rpriv->reactor;
+    }
 
-            case IFWR_TYPE_FLOAT:
-                written += snprintf(buff + written, buff_len - written,"%s=%lf,", curr->key, curr->value.f );
-                continue;
+    //The reactor lets go of a connection when a response fails
+    if(r->stats.healthy && r->reactor && !rpriv->reactor){
+        repl_failed(r, now);
+    }
 
-            case IFWR_TYPE_INT:
-                written += snprintf(buff + written, buff_len - written,"%s=%" PRIu64 "i,", curr->key, curr->value.i );
-                continue;
+    if(!r->stats.healthy){
+        if(now < r->retry_ns){
+            return;
+        }
 
-            case IFWR_TYPE_STRING:
-                written += snprintf(buff + written, buff_len - written,"%s=\"%s\",", curr->key, curr->value.s );
-                continue;
+        //The connect gives up after IFWR_REPL_TIMEOUT_MS
+        ifwr_close(rconn);
+        const int err = ifwr_connect(rconn) || (r->reactor && ifwr_reactor_add(r->reactor, rconn));
+        IFWR_PROBE2(reconnect, rconn->port, err);
+        if(err){
+            repl_failed(r, now);
+            return;
+        }
+    }
 
-            case IFWR_TYPE_UNKOWN:
-                IFWR_ERR("Found a type of UNKOWN, was your KTV unitialised?\n");
-                break;
+    while(r->stats.queued){
+        struct ifwr_block* block = r->queue[r->head];
+
+        rpriv->http_err_code = 0;
+        rpriv->post_bucket = block->bucket;
+        const int ret = http_post_one(rconn, block->prec, block->data, block->len);
+        rpriv->post_bucket = NULL;
+        if(ret < 0){
+            //A reactor replica that is just behind keeps its place in line
+            if(rpriv->last_err != IFWR_ERR_QFULL){
+                repl_failed(r, now);
+            }
+            return;
+        }
 
+        if(http_collect(rconn) < 0){
+            //Resending data the server has refused won't help
+            if(rpriv->http_err_code < 400 || rpriv->http_err_code >= 500){
+                repl_failed(r, now);
+                return;
+            }
+            r->stats.rejected++;
         }
+        else{
+            r->stats.sent++;
+        }
+
+        repl_pop(r);
     }
 
-    //Remove the tailing "," , replace with a null terminator
-    if(buff_len - written > 0){
-        buff[written -1] = 0;
+    r->stats.healthy = true;
+    r->backoff_ns = 0;
+}
+
+
+static void repl_pump(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    const int64_t now = priv->nreplicas ? mono_ns() : 0;
+    for(int i = 0; i < priv->nreplicas; i++){
+        repl_drain(&priv->replicas[i], now);
     }
 
-    return written;
+    //Take in whatever the replicas that were blocking have answered so far
+    if(priv->repl_reactor && ifwr_poll(priv->repl_reactor, 0) > 0){
+        ifwr_process(priv->repl_reactor);
+    }
 }
 
 
-//Take a look at the InfluxDB line protocol specification to see what this
-//function is trying to build:
-//https://v2.docs.influxdata.com/v2.0/reference/syntax/line-protocol/
-int ifwr_send(
-		ifwr_conn_t* conn,
-		const char* measurement,
-		const ifwr_ktv_t* tags,
-		const ifwr_ktv_t* fields,
-		ifwr_fmt_e ts_fmt,
-		int64_t ts_val
-		)
+static void repl_free(ifwr_conn_t* conn)
 {
-    if(!conn){
-        IFWR_DBG("No connection supplied\n");
+    ifwr_priv_t* const priv = &conn->__private;
+
+    for(int i = 0; i < priv->nreplicas; i++){
+        struct ifwr_replica* r = &priv->replicas[i];
+        if(r->stats.queued){
+            IFWR_WARN("Replica %s still had %i requests queued\n", r->name, r->stats.queued);
+        }
+        while(r->stats.queued){
+            repl_pop(r);
+        }
+
+        //Hand it back as it came, anything still queued goes out on close
+        ifwr_priv_t* const rpriv = &r->conn->__private;
+        if(r->converted){
+            if(rpriv->reactor){
+                epoll_ctl(rpriv->reactor->epfd, EPOLL_CTL_DEL, rpriv->sockfd, NULL);
+                rpriv->reactor = NULL;
+            }
+            const int flags = fcntl(rpriv->sockfd, F_GETFL, 0);
+            fcntl(rpriv->sockfd, F_SETFL, flags & ~O_NONBLOCK);
+            r->conn->io = IFWR_IO_BLOCKING;
+        }
+        rpriv->is_replica = false;
+        rpriv->timeout_ms = 0;
+        sock_timeouts(rpriv->sockfd, 0);
+    }
+
+    if(priv->repl_reactor){
+        ifwr_reactor_free(priv->repl_reactor);
+        priv->repl_reactor = NULL;
+    }
+
+    free(priv->replicas);
+    priv->replicas = NULL;
+    priv->nreplicas = 0;
+}
+
+
+int ifwr_replicate(ifwr_conn_t* conn, ifwr_conn_t* replica)
+{
+    if(!conn || !replica){
+        IFWR_DBG("No connection or replica supplied\n");
         IFWR_SET_ERROR(IFWR_ERR_NULLARG);
         return -1;
     }
 
     ifwr_priv_t* const priv = &conn->__private;
 
-    //Figure out the measurement name
-    if(!measurement){
-        if(!priv->default_measurement){
-            IFWR_SET_ERROR(IFWR_ERR_NOMEASURE);
-            IFWR_ERR("No default measurement name is set\n");
+    const bool http = conn->transport == IFWR_TRANSPORT_HTTP ||
+                      conn->transport == IFWR_TRANSPORT_UNIX;
+    const bool rhttp = replica->transport == IFWR_TRANSPORT_HTTP ||
+                       replica->transport == IFWR_TRANSPORT_UNIX;
+    if(!http || !rhttp){
+        IFWR_DBG("Only HTTP requests can be replicated\n");
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    if(replica == conn || replica->__private.is_replica || replica->__private.nreplicas ||
+       priv->is_replica || replica->nendpoints){
+        IFWR_DBG("A replica can only be fed by one connection, and can't feed others\n");
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    if(replica->io == IFWR_IO_URING){
+        IFWR_DBG("io_uring replicas can't be sent on without waiting, use blocking or reactor I/O\n");
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    if(priv->nreplicas == IFWR_MAX_REPLICAS){
+        IFWR_DBG("No more than %i replicas per connection\n", IFWR_MAX_REPLICAS);
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    if(!priv->replicas){
+        priv->replicas = calloc(IFWR_MAX_REPLICAS, sizeof(struct ifwr_replica));
+        if(!priv->replicas){
+            IFWR_DBG("Could not allocate replica state\n");
+            IFWR_SET_ERROR(IFWR_ERR_NOMEM);
             return -1;
         }
-
-        measurement = priv->default_measurement;
     }
-    IFWR_DBG("Measurement set to \"%s\"\n", measurement);
 
-    //Figure out the tags
-    char* tags_str = NULL;
-    if(!tags){
-        if(!priv->default_tagset){
-            IFWR_SET_ERROR(IFWR_ERR_NOTAGS);
-            IFWR_ERR("No default tagset is set\n");
+    struct ifwr_replica* r = &priv->replicas[priv->nreplicas];
+    memset(r, 0, sizeof(*r));
+
+    //Waiting on a blocking replica would add its latency to every request on
+    //conn, so it goes non-blocking, on a reactor that conn drives itself
+    ifwr_priv_t* const rpriv = &replica->__private;
+    if(replica->io == IFWR_IO_BLOCKING){
+        if(!priv->repl_reactor && !(priv->repl_reactor = ifwr_reactor_new())){
+            IFWR_DBG("Could not make a reactor for replicas\n");
+            IFWR_SET_ERROR(IFWR_ERR_NOMEM);
             return -1;
         }
-        tags_str = priv->default_tagset;
+
+        const int flags = fcntl(rpriv->sockfd, F_GETFL, 0);
+        if(flags < 0 || fcntl(rpriv->sockfd, F_SETFL, flags | O_NONBLOCK) < 0){
+            IFWR_DBG("Could not make replica socket non-blocking: %s\n", strerror(errno));
+            IFWR_SET_ERROR(IFWR_ERR_SOCKET);
+            return -1;
+        }
+
+        replica->io = IFWR_IO_REACTOR;
+        if(ifwr_reactor_add(priv->repl_reactor, replica)){
+            fcntl(rpriv->sockfd, F_SETFL, flags);
+            replica->io = IFWR_IO_BLOCKING;
+            IFWR_SET_ERROR(IFWR_ERR_SOCKET);
+            return -1;
+        }
+        r->converted = true;
     }
-    else{
-        char tmp_tags[IFWR_MAX_MSG] = {0};
-        ktv2str(tmp_tags, IFWR_MAX_MSG, tags);
-        tags_str = tmp_tags;
+
+    r->conn = replica;
+    r->reactor = rpriv->reactor;
+    rpriv->timeout_ms = IFWR_REPL_TIMEOUT_MS;
+    sock_timeouts(rpriv->sockfd, rpriv->timeout_ms);
+    r->name = replica->hostname ? replica->hostname : replica->sockpath;
+    r->stats.healthy = true;
+    rpriv->is_replica = true;
+
+    IFWR_DBG("Success! Replicating to %s\n", r->name);
+    return priv->nreplicas++;
+}
+
+
+int ifwr_replica_stats(ifwr_conn_t* conn, int replica, ifwr_replica_stats_t* stats)
+{
+    if(!conn || !stats){
+        IFWR_DBG("No connection or stats supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
     }
-    IFWR_DBG("Tags set to \"%s\"\n", tags_str);
 
-    //Figure out the fields
-    char fields_str[IFWR_MAX_MSG] = {0};
-    if(!fields){
-        IFWR_SET_ERROR(IFWR_ERR_NOFIELDS);
-        IFWR_ERR("No measurement fields supplied!\n");
+    ifwr_priv_t* const priv = &conn->__private;
+
+    if(replica < 0 || replica >= priv->nreplicas){
+        IFWR_DBG("No replica %i\n", replica);
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
         return -1;
     }
 
-    ktv2str(fields_str, IFWR_MAX_MSG, fields);
-    IFWR_DBG("Fields set to \"%s\"\n", fields_str);
+    *stats = priv->replicas[replica].stats;
+    return 0;
+}
 
 
-    //Figure out the timestamp
-    char* prec = NULL;
-    #define TS_LEN_MAX 64
-    char ts_str_tmp[TS_LEN_MAX] = {0};
-    char* ts_str = NULL;
+//Send times of requests still waiting on a response, oldest first
+#define PEER_SENT_RING 64
 
-    switch(ts_fmt){
-        case IFWR_TS_UNDEF:
-            IFWR_SET_ERROR(IFWR_ERR_NOTIME);
-            IFWR_ERR("No timestamp value set!\n");
-            return -1;
-        case IFWR_TS_LOCAL:{
-            struct timespec now_ts = {0};
-            if(clock_gettime(CLOCK_REALTIME, &now_ts) < 0){
-                IFWR_ERR("Could not get time! Error: %s", strerror(errno));
-                IFWR_SET_ERROR(IFWR_ERR_NOTIME);
-                return -1;
+struct ifwr_peer
+{
+    ifwr_conn_t* conn;      //Behind this endpoint, owned by the peer
+    ifwr_reactor_t* reactor;
+    struct ifwr_ring* ring; //The sender's io_uring, NULL if none
+    bool closed;            //Needs reconnecting before it is used again
+    int64_t sent[PEER_SENT_RING];
+    uint64_t sent_r;
+    uint64_t sent_w;
+    int64_t retry_ns;       //Monotonic time of the next probe while unhealthy
+    int64_t backoff_ns;
+    int64_t max_latency_ns;
+    ifwr_endpoint_stats_t stats;
+};
+
+
+static struct ifwr_ring* peer_ring(const struct ifwr_peer* p)
+{
+    return p->ring;
+}
+
+
+//How long an endpoint has to connect, take a request or answer one
+static int peer_timeout_ms(const ifwr_conn_t* conn)
+{
+    return conn->lb_max_latency_ms ? conn->lb_max_latency_ms : IFWR_LB_TIMEOUT_MS;
+}
+
+
+static void peer_failed(struct ifwr_peer* p, int64_t now, bool closed)
+{
+    p->stats.healthy = false;
+    p->closed |= closed;
+
+    p->backoff_ns = p->backoff_ns ? p->backoff_ns * 2 : REPL_BACKOFF_MIN_NS;
+    if(p->backoff_ns > REPL_BACKOFF_MAX_NS){
+        p->backoff_ns = REPL_BACKOFF_MAX_NS;
+    }
+    p->retry_ns = now + p->backoff_ns;
+
+    IFWR_WARN("Endpoint %s:%i is unhealthy, probing again in %lims\n", p->conn->hostname, p->conn->port,
+            (long)(p->backoff_ns / 1000 / 1000));
+}
+
+
+static void peer_count(struct ifwr_peer* p, bool ok)
+{
+    p->stats.requests++;
+    p->stats.errors += !ok;
+    p->stats.error_rate += ((ok ? 0.0 : 1.0) - p->stats.error_rate) / 4;
+}
+
+
+//Account for a response, or a failure in place of one (http_code 0)
+static void peer_done(struct ifwr_peer* p, int64_t now, int http_code)
+{
+    const bool ok = http_code && http_code < 500;
+    peer_count(p, ok);
+
+    if(p->sent_r < p->sent_w){
+        const int64_t latency = now - p->sent[p->sent_r++ % PEER_SENT_RING];
+        //A probe starts the average afresh, or a recovered endpoint looks slow for a while
+        const bool fresh = !p->stats.latency_ns || !p->stats.healthy;
+        p->stats.latency_ns = fresh ? latency : p->stats.latency_ns + (latency - p->stats.latency_ns) / 4;
+    }
+
+    //Don't wait for a trend, the next request should already go elsewhere
+    const bool slow = p->max_latency_ns && p->stats.latency_ns > p->max_latency_ns;
+    if(!ok || slow){
+        if(p->stats.healthy || now >= p->retry_ns){
+            peer_failed(p, now, !http_code);
+        }
+        return;
+    }
+
+    if(!p->stats.healthy){
+        IFWR_DBG("Endpoint %s:%i is healthy again\n", p->conn->hostname, p->conn->port);
+    }
+    p->stats.healthy = true;
+    p->backoff_ns = 0;
+}
+
+
+static void peer_sent(struct ifwr_peer* p, int64_t now)
+{
+    if(p->sent_w - p->sent_r == PEER_SENT_RING){
+        p->sent_r++;
+    }
+    p->sent[p->sent_w++ % PEER_SENT_RING] = now;
+}
+
+
+//Requests dropped before they went out won't be answered
+static void peer_unsent(struct ifwr_peer* p, int requests)
+{
+    p->sent_w = p->sent_w - p->sent_r > (uint64_t)requests ? p->sent_w - requests : p->sent_r;
+}
+
+
+static int peer_outstanding(const ifwr_conn_t* conn, const struct ifwr_peer* p)
+{
+    return p->conn->__private.inflight + (conn->__private.peer_last == p);
+}
+
+
+//Pick an endpoint that hasn't been tried yet. Healthy ones first, then ones
+//due a probe, then whichever is next due a probe.
+static struct ifwr_peer* peer_pick(ifwr_conn_t* conn, int64_t now, unsigned tried)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    struct ifwr_peer* best = NULL;
+    int best_rank = 0;
+    for(int n = 0; n < priv->npeers; n++){
+        const int i = conn->lb == IFWR_LB_ROUND_ROBIN ? (priv->peer_next + n) % priv->npeers : n;
+        struct ifwr_peer* p = &priv->peers[i];
+        if(tried & (1u << i)){
+            continue;
+        }
+
+        const int rank = p->stats.healthy ? 0 : now >= p->retry_ns ? 1 : 2;
+        bool better = !best || rank < best_rank;
+        if(best && rank == best_rank){
+            if(rank == 2){
+                better = p->retry_ns < best->retry_ns;
             }
+            else if(conn->lb == IFWR_LB_LEAST_OUTSTANDING){
+                const int a = peer_outstanding(conn, p);
+                const int b = peer_outstanding(conn, best);
+                better = a < b || (a == b && p->stats.latency_ns < best->stats.latency_ns);
+            }
+        }
+
+        if(better){
+            best = p;
+            best_rank = rank;
+        }
+    }
+
+    if(best && conn->lb == IFWR_LB_ROUND_ROBIN){
+        priv->peer_next = (int)(best - priv->peers + 1) % priv->npeers;
+    }
+
+    return best;
+}
+
+
+static int peer_connect(struct ifwr_peer* p, int64_t now)
+{
+    ifwr_close(p->conn);
+    p->sent_r = p->sent_w = 0;
+
+    const int err = ifwr_connect(p->conn) || (p->reactor && ifwr_reactor_add(p->reactor, p->conn));
+    IFWR_PROBE2(reconnect, p->conn->port, err);
+    if(err){
+        peer_failed(p, now, true);
+        return -1;
+    }
+
+    p->closed = false;
+    return 0;
+}
+
+
+//Nothing waits on a reactor endpoint's responses, so one that has sat on a
+//request for longer than its timeout is only noticed when the next goes out
+static void peer_expire(struct ifwr_peer* p, int64_t now)
+{
+    const int64_t timeout_ns = p->conn->__private.timeout_ms * 1000 * 1000LL;
+    if(p->closed || p->sent_r == p->sent_w || now - p->sent[p->sent_r % PEER_SENT_RING] <= timeout_ns){
+        return;
+    }
+
+    IFWR_DBG("Endpoint %s:%i has not answered in %ims\n", p->conn->hostname, p->conn->port,
+            p->conn->__private.timeout_ms);
+    peer_count(p, false);
+    peer_failed(p, now, true);
+}
+
+
+//Send on the best endpoint. Whatever it is that fails, try the next one.
+static int peer_post(ifwr_conn_t* conn, const char* prec, const char* content, int content_len)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    const int64_t now = mono_ns();
+
+    if(conn->io == IFWR_IO_REACTOR){
+        for(int i = 0; i < priv->npeers; i++){
+            peer_expire(&priv->peers[i], now);
+        }
+    }
+
+    //Nobody asked for the last response, so don't hold it against the endpoint
+    priv->peer_last = NULL;
+
+    unsigned tried = 0;
+    ifwr_err_e err = IFWR_ERR_CONNECT;
+    for(struct ifwr_peer* p; (p = peer_pick(conn, now, tried));){
+        ifwr_priv_t* const ppriv = &p->conn->__private;
+        tried |= 1u << (p - priv->peers);
+
+        if(p->closed && peer_connect(p, now)){
+            err = ppriv->last_err;
+            continue;
+        }
+
+        ppriv->http_err_code = 0;
+        //Endpoints have no batches of their own, this only carries the lane
+        ppriv->post_bucket = priv->post_bucket;
+        ppriv->batch_high = priv->batch_high;
+        const int ret = http_post_one(p->conn, prec, content, content_len);
+        ppriv->post_bucket = NULL;
+        ppriv->batch_high = false;
+        if(ret >= 0){
+            peer_sent(p, now);
+            priv->peer_last = conn->io == IFWR_IO_REACTOR ? NULL : p;
+            return ret;
+        }
+
+        //Just behind on a reactor, it's not unhealthy
+        err = ppriv->last_err;
+        if(err != IFWR_ERR_QFULL){
+            peer_count(p, false);
+            peer_failed(p, now, true);
+        }
+    }
+
+    IFWR_DBG("No endpoint could take a request of %i bytes\n", content_len);
+    IFWR_SET_ERROR(err);
+    return -1;
+}
+
+
+//The endpoint that took the last request has the response
+static int peer_response(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    struct ifwr_peer* p = priv->peer_last;
+    if(!p){
+        IFWR_DBG("No request is waiting on a response\n");
+        return 0;
+    }
+    priv->peer_last = NULL;
+
+    ifwr_priv_t* const ppriv = &p->conn->__private;
+    const int ret = ifwr_response(p->conn);
+    peer_done(p, mono_ns(), ppriv->http_err_code);
+
+    priv->http_err_code = ppriv->http_err_code;
+    priv->json_err_str = ppriv->json_err_str;
+    if(ret < 0){
+        IFWR_SET_ERROR(ppriv->last_err);
+    }
+    return ret;
+}
+
+
+static int peers_setup(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    priv->peers = calloc(conn->nendpoints, sizeof(struct ifwr_peer));
+    if(!priv->peers){
+        IFWR_DBG("Could not allocate endpoint state\n");
+        IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+        return -1;
+    }
+
+    int connected = 0;
+    const int64_t now = mono_ns();
+    for(int i = 0; i < conn->nendpoints; i++){
+        struct ifwr_peer* p = &priv->peers[i];
+        ifwr_conn_t* pconn = calloc(1, sizeof(ifwr_conn_t));
+        if(!pconn){
+            IFWR_DBG("Could not allocate endpoint connection\n");
+            IFWR_SET_ERROR(IFWR_ERR_NOMEM);
+            return -1;
+        }
+        priv->npeers++;
+
+        pconn->hostname    = conn->endpoints[i].hostname;
+        pconn->port        = conn->endpoints[i].port;
+        pconn->org         = conn->org;
+        pconn->bucket      = conn->bucket;
+        pconn->token       = conn->token;
+        pconn->transport   = IFWR_TRANSPORT_HTTP;
+        pconn->io          = conn->io;
+        pconn->mem_budget  = conn->mem_budget;
+        pconn->overflow    = conn->overflow;
+        pconn->block_timeout_ms = conn->block_timeout_ms;
+        pconn->on_response = conn->on_response;
+        pconn->user        = conn->user;
+        pconn->__private.sockfd = -1;
+        pconn->__private.peer = p;
+        pconn->__private.timeout_ms = peer_timeout_ms(conn);
+
+        p->conn = pconn;
+        p->ring = priv->uring;
+        p->max_latency_ns = conn->lb_max_latency_ms * 1000 * 1000LL;
+        p->stats.healthy = true;
+
+        //One endpoint being down is what this is for, so carry on without it
+        if(ifwr_connect(pconn)){
+            IFWR_WARN("Could not connect to endpoint %s:%i\n", pconn->hostname, pconn->port);
+            peer_failed(p, now, true);
+            continue;
+        }
+        connected++;
+    }
+
+    if(!connected){
+        IFWR_DBG("Could not connect to any of %i endpoints\n", conn->nendpoints);
+        IFWR_SET_ERROR(IFWR_ERR_CONNECT);
+        return -1;
+    }
+
+    IFWR_DBG("Success! Connected to %i of %i endpoints\n", connected, conn->nendpoints);
+    return 0;
+}
+
+
+static void peers_free(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
 
-            int64_t ns = now_ts.tv_sec * 1000 * 1000 * 1000 + now_ts.tv_nsec;
+    for(int i = 0; i < priv->npeers; i++){
+        ifwr_close(priv->peers[i].conn);
+        free(priv->peers[i].conn);
+    }
 
-            prec = "ns";
-            snprintf(ts_str_tmp,TS_LEN_MAX,"%" PRIu64,ns);
-            ts_str = ts_str_tmp;
-            break;
-        }
-        case IFWR_TS_REMOTE:
-            prec = "ms"; //This seems sane. How are you going to get better than
-                         //this over the network with a remote timestamp?
-            ts_str = "";
-            break;
-        case IFWR_TS_NANOS:
-            prec = "ns";
-            //TODO - some sanity check that this is a sensible nanosecond value
-            snprintf(ts_str_tmp,TS_LEN_MAX,"%" PRIu64 ,ts_val);
-            ts_str = ts_str_tmp;
-            break;
-        case IFWR_TS_MICROS:
-            prec = "us";
-            //TODO - some sanity check that this is a sensible microsecond value
-            snprintf(ts_str_tmp,TS_LEN_MAX,"%" PRIu64,ts_val);
-            ts_str = ts_str_tmp;
-            break;
-        case IFWR_TS_MILLIS:
-            prec = "ms";
-            //TODO - some sanity check that this is a sensible milliscecond value
-            snprintf(ts_str_tmp,TS_LEN_MAX,"%" PRIu64,ts_val);
-            ts_str = ts_str_tmp;
-            break;
-        case IFWR_TS_SECS:
-            prec = "s";
-            //TODO - some sanity check that this is a sensible seconds value
-            snprintf(ts_str_tmp,TS_LEN_MAX,"%" PRIu64,ts_val);
-            ts_str = ts_str_tmp;
-            break;
+    free(priv->peers);
+    priv->peers = NULL;
+    priv->npeers = 0;
+    priv->peer_next = 0;
+    priv->peer_last = NULL;
+}
 
-         /*default: no default case intentional. Let the compiler pick up if
-          * I've forgotten a value.
-          * */
+
+//Endpoint connections carry some of the settings of the one they serve
+static void peers_retune(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    for(int i = 0; i < priv->npeers; i++){
+        struct ifwr_peer* p = &priv->peers[i];
+        p->conn->__private.timeout_ms = peer_timeout_ms(conn);
+        if(!p->closed){
+            sock_timeouts(p->conn->__private.sockfd, p->conn->__private.timeout_ms);
+        }
+        p->max_latency_ns = conn->lb_max_latency_ms * 1000 * 1000LL;
+        p->conn->mem_budget = conn->mem_budget;
+        p->conn->overflow = conn->overflow;
+        p->conn->block_timeout_ms = conn->block_timeout_ms;
     }
-    IFWR_DBG("Timestamp precision is \"%s\"\n", prec);
-    IFWR_DBG("Timestamp string is \"%s\"\n ", ts_str_tmp);
+}
 
 
-    //At this point we have strings for everything, just need to format it
-    return ifwr_write_raw(conn, prec, "%s,%s %s %s\r\n",
-            measurement,
-            tags_str,
-            fields_str,
-            ts_str);
+//Requests are queued (and dropped) on the endpoints' own connections
+static void peers_stats(const ifwr_conn_t* conn, ifwr_stats_t* stats)
+{
+    const ifwr_priv_t* const priv = &conn->__private;
 
+    for(int i = 0; i < priv->npeers; i++){
+        const ifwr_stats_t* const pstats = &priv->peers[i].conn->__private.stats;
+        stats->points_dropped += pstats->points_dropped;
+        stats->requests_dropped += pstats->requests_dropped;
+        stats->overflow_wait_ns += pstats->overflow_wait_ns;
+    }
 }
 
 
-int ifwr_response(ifwr_conn_t* conn)
+int ifwr_endpoint_stats(ifwr_conn_t* conn, int endpoint, ifwr_endpoint_stats_t* stats)
 {
-    if(!conn){
-          IFWR_DBG("No connection supplied\n");
-          IFWR_SET_ERROR(IFWR_ERR_NULLARG);
-          return -1;
-      }
+    if(!conn || !stats){
+        IFWR_DBG("No connection or stats supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
 
     ifwr_priv_t* const priv = &conn->__private;
 
-
-    int len = read(priv->sockfd, priv->rx_buff, IFWR_MAX_MSG);
-    if(len == 0){
-    	IFWR_ERR("Connection to InfluxDB has been closed by the remote end\n");
-    	IFWR_SET_ERROR(IFWR_ERR_CONNECT);
-    	return -1;
+    if(endpoint < 0 || endpoint >= priv->npeers){
+        IFWR_DBG("No endpoint %i\n", endpoint);
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
     }
 
+    const struct ifwr_peer* p = &priv->peers[endpoint];
+    *stats = p->stats;
+    stats->outstanding = peer_outstanding(conn, p);
+    return 0;
+}
+
+
+//Work out the result of a single, null terminated, HTTP response
+static int http_parse_response(ifwr_conn_t* conn, char* msg, int len)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
     if(len < 14){ //HTTP header string should be at least 14 bytes
     	IFWR_ERR("Connection failed to return a valid responsed\n");
     	IFWR_SET_ERROR(IFWR_ERR_CONNECT);
     	return -1;
     }
 
-    char* token = strtok(priv->rx_buff,"\r\n");
+    char* token = strtok(msg,"\r\n");
 
     //Check if we've got a correct HTTP header
     if(memcmp(token,"HTTP/1.1 ",9) != 0){
@@ -662,6 +4854,7 @@ int ifwr_response(ifwr_conn_t* conn)
     }
 
     priv->http_err_code = http_err_code;
+    IFWR_PROBE2(response, http_err_code, len);
     if(http_err_code >= 200 && http_err_code < 300 ){
         IFWR_DBG("Success with HTTP response code %li\n", http_err_code);
         priv->json_err_str = NULL;
@@ -684,6 +4877,102 @@ int ifwr_response(ifwr_conn_t* conn)
     return -1;
 }
 
+//Collect the receive linked in behind the last POST, falling back to a
+//plain read() if the link was broken by a short or failed write.
+static int uring_response(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    //The request has to be all out before its response can be
+    const int settled = uring_settle(conn);
+    if(uring_wait(conn, true)){
+        return -1;
+    }
+    priv->uring_rx_pending = false;
+    priv->uring_rx_done = false;
+    if(settled){
+        return -1;
+    }
+
+    const int res = priv->uring_rx_res;
+
+    if(res == -ECANCELED){
+        IFWR_DBG("Linked receive was cancelled, reading response directly\n");
+        return read(priv->sockfd, priv->rx_buff, IFWR_MAX_MSG - 1);
+    }
+
+    if(res < 0){
+        errno = -res;
+        return -1;
+    }
+
+    return res;
+}
+
+
+static int http_response(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    if(priv->dgram || priv->shm){
+        IFWR_DBG("Datagram and shared memory transports have no responses\n");
+        return 0;
+    }
+
+    if(priv->npeers && conn->io != IFWR_IO_REACTOR){
+        return peer_response(conn);
+    }
+
+    if(conn->io == IFWR_IO_REACTOR){
+        IFWR_DBG("Reactor connections deliver responses via on_response\n");
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    int len = 0;
+    if(priv->uring_rx_pending){
+        len = uring_response(conn);
+    }
+    else{
+        len = read(priv->sockfd, priv->rx_buff, IFWR_MAX_MSG - 1);
+    }
+
+    if(len < 0){
+        IFWR_ERR("Could not read response from InfluxDB. Error: %s\n", strerror(errno));
+        IFWR_SET_ERROR(IFWR_ERR_CONNECT);
+        return -1;
+    }
+    priv->rx_buff[len] = 0;
+
+    if(len == 0){
+    	IFWR_ERR("Connection to InfluxDB has been closed by the remote end\n");
+    	IFWR_SET_ERROR(IFWR_ERR_CONNECT);
+    	return -1;
+    }
+
+    return http_parse_response(conn, priv->rx_buff, len);
+}
+
+
+int ifwr_response(ifwr_conn_t* conn)
+{
+    if(!conn){
+          IFWR_DBG("No connection supplied\n");
+          IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+          return -1;
+      }
+
+    //Only time the wait if someone is watching
+    const int64_t start = IFWR_PROBE_ENABLED(response_wait) ? mono_ns() : 0;
+    const int ret = http_response(conn);
+    if(start){
+        IFWR_PROBE2(response_wait, ret, mono_ns() - start);
+    }
+
+    return ret;
+}
+
+
 int ifwr_http_err(ifwr_conn_t* conn, char** json_msg)
 {
     if(!conn){
@@ -700,3 +4989,301 @@ int ifwr_http_err(ifwr_conn_t* conn, char** json_msg)
 
 
 
+ifwr_reactor_t* ifwr_reactor_new(void)
+{
+    ifwr_reactor_t* reactor = calloc(1, sizeof(ifwr_reactor_t));
+    if(!reactor){
+        IFWR_DBG("Could not allocate reactor\n");
+        return NULL;
+    }
+
+    reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(reactor->epfd < 0){
+        IFWR_DBG("Could not create epoll instance: %s\n", strerror(errno));
+        free(reactor);
+        return NULL;
+    }
+
+    IFWR_DBG("Success! Created reactor\n");
+    return reactor;
+}
+
+
+int ifwr_reactor_add(ifwr_reactor_t* reactor, ifwr_conn_t* conn)
+{
+    if(!conn){
+        IFWR_DBG("No connection supplied\n");
+        return -1;
+    }
+
+    if(!reactor){
+        IFWR_DBG("No reactor supplied\n");
+        IFWR_SET_ERROR(IFWR_ERR_NULLARG);
+        return -1;
+    }
+
+    if(conn->io != IFWR_IO_REACTOR){
+        IFWR_DBG("Only IFWR_IO_REACTOR connections can be added to a reactor\n");
+        IFWR_SET_ERROR(IFWR_ERR_BADARGS);
+        return -1;
+    }
+
+    ifwr_priv_t* const priv = &conn->__private;
+
+    //Endpoints that are down now join when they reconnect
+    for(int i = 0; i < priv->npeers; i++){
+        struct ifwr_peer* p = &priv->peers[i];
+        p->reactor = reactor;
+        if(!p->closed && ifwr_reactor_add(reactor, p->conn)){
+            peer_failed(p, mono_ns(), true);
+        }
+    }
+    if(priv->npeers){
+        return 0;
+    }
+
+    const bool out = priv->txq_len > priv->txq_off;
+    struct epoll_event ev = {
+        .events = EPOLLIN | (out ? EPOLLOUT : 0),
+        .data.ptr = conn
+    };
+    if(epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, priv->sockfd, &ev) < 0){
+        IFWR_DBG("Could not add socket to epoll: %s\n", strerror(errno));
+        IFWR_SET_ERROR(IFWR_ERR_SOCKET);
+        return -1;
+    }
+
+    priv->reactor = reactor;
+    priv->epollout = out;
+
+    IFWR_DBG("Success! Added socket %i to reactor\n", priv->sockfd);
+    return 0;
+}
+
+
+int ifwr_reactor_fd(ifwr_reactor_t* reactor)
+{
+    if(!reactor){
+        IFWR_DBG("No reactor supplied\n");
+        return -1;
+    }
+
+    return reactor->epfd;
+}
+
+
+int ifwr_poll(ifwr_reactor_t* reactor, int timeout_ms)
+{
+    if(!reactor){
+        IFWR_DBG("No reactor supplied\n");
+        return -1;
+    }
+
+    //Don't lose events that nobody has processed yet
+    if(reactor->ready){
+        return reactor->ready;
+    }
+
+    int ready = epoll_wait(reactor->epfd, reactor->events, REACTOR_EVENTS, timeout_ms);
+    if(ready < 0){
+        if(errno == EINTR){
+            return 0;
+        }
+        IFWR_ERR("epoll_wait() failed. Error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    reactor->ready = ready;
+    return ready;
+}
+
+
+//Length of the first complete HTTP response in buff, or 0 if more is needed
+static int http_response_len(const char* buff, int len)
+{
+    const char* hdr_end = memmem(buff, len, "\r\n\r\n", 4);
+    if(!hdr_end){
+        return 0;
+    }
+    const int hdr_len = hdr_end + 4 - buff;
+
+    long body_len = 0;
+    bool chunked = false;
+    for(const char* line = buff; line < hdr_end;){
+        const char* eol = memmem(line, hdr_end + 2 - line, "\r\n", 2);
+        if(!eol){
+            break;
+        }
+        if(strncasecmp(line, "Content-Length:", 15) == 0){
+            body_len = strtol(line + 15, NULL, 10);
+        }
+        else if(strncasecmp(line, "Transfer-Encoding:", 18) == 0){
+            chunked = memmem(line, eol - line, "chunked", 7) != NULL;
+        }
+        line = eol + 2;
+    }
+
+    if(chunked){
+        const char* end = memmem(hdr_end + 2, len - (hdr_end + 2 - buff), "\r\n0\r\n\r\n", 7);
+        return end ? end + 7 - buff : 0;
+    }
+
+    if(hdr_len + body_len > len){
+        return 0;
+    }
+
+    return hdr_len + body_len;
+}
+
+
+//Read whatever has arrived and hand every complete response to on_response
+static int reactor_read(ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    int responses = 0;
+    for(;;){
+        int ret = read(priv->sockfd, priv->rx_buff + priv->rx_len, IFWR_MAX_MSG - 1 - priv->rx_len);
+        if(ret < 0){
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                return responses;
+            }
+            if(errno == EINTR){
+                continue;
+            }
+            IFWR_ERR("Could not read response from InfluxDB. Error: %s\n", strerror(errno));
+            IFWR_SET_ERROR(IFWR_ERR_CONNECT);
+            return -1;
+        }
+
+        if(ret == 0){
+            IFWR_ERR("Connection to InfluxDB has been closed by the remote end\n");
+            IFWR_SET_ERROR(IFWR_ERR_CONNECT);
+            return -1;
+        }
+        priv->rx_len += ret;
+
+        int resp_len = 0;
+        while((resp_len = http_response_len(priv->rx_buff, priv->rx_len)) > 0){
+            const char saved = priv->rx_buff[resp_len];
+            priv->rx_buff[resp_len] = 0;
+
+            priv->http_err_code = 0;
+            priv->json_err_str = NULL;
+            http_parse_response(conn, priv->rx_buff, resp_len);
+            if(priv->inflight > 0){
+                priv->inflight--;
+            }
+            if(priv->peer){
+                peer_done(priv->peer, mono_ns(), priv->http_err_code);
+            }
+            responses++;
+
+            if(conn->on_response){
+                conn->on_response(conn, priv->http_err_code, priv->json_err_str);
+            }
+
+            priv->rx_buff[resp_len] = saved;
+            priv->rx_len -= resp_len;
+            memmove(priv->rx_buff, priv->rx_buff + resp_len, priv->rx_len);
+            priv->json_err_str = NULL;
+        }
+
+        if(priv->rx_len >= IFWR_MAX_MSG - 1){
+            IFWR_ERR("HTTP response is bigger than %i bytes\n", IFWR_MAX_MSG);
+            IFWR_SET_ERROR(IFWR_ERR_BADHTTP);
+            return -1;
+        }
+    }
+}
+
+
+//A dead connection leaves the reactor. Whatever was queued or waiting on a
+//response is lost with it, so nothing is left to confuse the next connect.
+static void reactor_detach(ifwr_reactor_t* reactor, ifwr_conn_t* conn)
+{
+    ifwr_priv_t* const priv = &conn->__private;
+
+    //Stop listening, or a dead socket will wake us up forever
+    epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, priv->sockfd, NULL);
+    priv->reactor = NULL;
+    priv->epollout = false;
+
+    //Including one that only got part way out, the server can't use half of it
+    int points = 0;
+    for(int i = 0; i < priv->txq_nreqs; i++){
+        points += priv->txq_reqs[i].points;
+    }
+    if(priv->txq_nreqs){
+        priv->stats.requests_dropped += priv->txq_nreqs;
+        priv->stats.points_dropped += points;
+        IFWR_PROBE2(drop, IFWR_DROP_DISCONNECT, points);
+        IFWR_WARN("Connection failed with %i requests queued, dropped %i points\n", priv->txq_nreqs, points);
+    }
+
+    priv->txq_len = 0;
+    priv->txq_off = 0;
+    priv->txq_nreqs = 0;
+    priv->txq_head_sent = 0;
+    priv->rx_len = 0;
+    priv->inflight = 0;
+}
+
+
+int ifwr_process(ifwr_reactor_t* reactor)
+{
+    if(!reactor){
+        IFWR_DBG("No reactor supplied\n");
+        return -1;
+    }
+
+    if(!reactor->ready && ifwr_poll(reactor, 0) < 0){
+        return -1;
+    }
+
+    int responses = 0;
+    for(int i = 0; i < reactor->ready; i++){
+        ifwr_conn_t* const conn = reactor->events[i].data.ptr;
+        ifwr_priv_t* const priv = &conn->__private;
+        const uint32_t events = reactor->events[i].events;
+
+        int ret = 0;
+        if(events & (EPOLLIN | EPOLLERR | EPOLLHUP)){
+            ret = reactor_read(conn);
+        }
+        if(ret >= 0 && (events & EPOLLOUT)){
+            ret = reactor_drain_txq(conn) < 0 ? -1 : ret;
+        }
+        if(ret >= 0 && priv->spill && priv->spill->rd < priv->spill->wr){
+            ret = spill_replay(conn) || reactor_drain_txq(conn) < 0 ? -1 : ret;
+        }
+
+        if(ret < 0){
+            reactor_detach(reactor, conn);
+            if(priv->peer){
+                peer_failed(priv->peer, mono_ns(), true);
+            }
+            if(conn->on_response){
+                conn->on_response(conn, 0, NULL);
+            }
+            continue;
+        }
+
+        responses += ret;
+    }
+
+    reactor->ready = 0;
+    return responses;
+}
+
+
+void ifwr_reactor_free(ifwr_reactor_t* reactor)
+{
+    if(!reactor){
+        IFWR_DBG("No reactor supplied\n");
+        return;
+    }
+
+    close(reactor->epfd);
+    free(reactor);
+}
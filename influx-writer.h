@@ -18,6 +18,15 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/*
+ * Linkage of the send path. The header-only build sets this to "static inline"
+ * when IFWR_INLINE is defined, so that the compiler can inline it into callers
+ * without LTO.
+ */
+#ifndef IFWR_HOT
+    #define IFWR_HOT
+#endif
+
 
 /**
  * @struct Nothing to see here. Opaque structure to hold internal state.
@@ -46,6 +55,8 @@ typedef enum
 	IFWR_ERR_NOTSFMT,   /**< No timestamp format type set */
     IFWR_ERR_NOTIME,    /**< Could not get the time from the local Linux clock*/
     IFWR_ERR_BADHTTP,   /**< Bad HTTP response message */
+    IFWR_ERR_QFULL,     /**< Outgoing queue is full, try again later */
+    IFWR_ERR_CARDINALITY, /**< Dropped a new series beyond the limit */
 
 	//*** !! Don't forget to update ifwr_err2str() and ifwr_errs_en[]. !! ***
 
@@ -57,6 +68,222 @@ typedef enum
 //uncapped
 #define IFWR_MAX_MSG 64 * 1024
 
+//Batches can be bigger than a single message, but not unreasonably so
+#define IFWR_MAX_BATCH 16 * 1024 * 1024
+
+//Space for the HTTP POST header (URL, host and token)
+#define IFWR_MAX_HDR 4 * 1024
+
+/**
+ * @enum I/O backend used to move bytes to and from InfluxDB
+ */
+typedef enum
+{
+    IFWR_IO_BLOCKING = 0,   /**< Blocking write()/read() calls (default) */
+    IFWR_IO_URING,          /**< Linked io_uring submissions, on one ring per
+                                 sender shared by its endpoints. Falls back to
+                                 blocking I/O if io_uring is unavailable */
+    IFWR_IO_REACTOR,        /**< Non-blocking socket driven by an
+                                 ifwr_reactor_t event loop */
+} ifwr_io_e;
+
+/**
+ * @enum How line protocol gets to InfluxDB
+ */
+typedef enum
+{
+    IFWR_TRANSPORT_HTTP = 0,    /**< POST to the /api/v2/write endpoint (default) */
+    IFWR_TRANSPORT_UDP,         /**< Raw line protocol datagrams to a UDP
+                                     listener. Fire and forget, no responses */
+    IFWR_TRANSPORT_UNIX,        /**< HTTP over a UNIX domain stream socket at
+                                     conn->sockpath, e.g. a co-located relay */
+    IFWR_TRANSPORT_UNIXGRAM,    /**< Raw line protocol datagrams to a UNIX
+                                     domain socket at conn->sockpath */
+    IFWR_TRANSPORT_SHM,         /**< Lines go into the shared memory ring
+                                     conn->shmname, drained by ifwr-daemon */
+} ifwr_transport_e;
+
+//Default datagram payload. Fits a 1500 byte Ethernet MTU after IP/UDP headers
+#define IFWR_DGRAM_MTU 1472
+
+//Local datagrams don't have to fit on the wire, so they can be much bigger
+#define IFWR_DGRAM_UNIX_MTU 16 * 1024
+
+//Default cap on bytes queued for a non-blocking socket that hasn't drained yet
+#define IFWR_MAX_TXQ 4 * IFWR_MAX_BATCH
+
+/**
+ * @enum What happens to a request that would take the outgoing queue of a
+ * 		reactor connection over conn->mem_budget. High priority requests are
+ * 		always queued, and are never dropped to make room.
+ */
+typedef enum
+{
+    IFWR_OVERFLOW_DROP_NEWEST = 0,  /**< Drop it, failing with IFWR_ERR_QFULL (default) */
+    IFWR_OVERFLOW_DROP_OLDEST,      /**< Drop queued requests that haven't started
+                                         going out yet to make room for it */
+    IFWR_OVERFLOW_BLOCK,            /**< Wait up to conn->block_timeout_ms for the
+                                         socket to take enough, then drop it */
+    IFWR_OVERFLOW_SPILL,            /**< Append it to conn->spill_path, and send it
+                                         once the queue has room again */
+} ifwr_overflow_e;
+
+struct ifwr_ring;
+struct ifwr_reactor;
+struct ifwr_dgram;
+struct ifwr_shmring;
+struct ifwr_series;
+struct ifwr_card;
+struct ifwr_tsc;
+struct ifwr_lines;
+struct ifwr_replica;
+struct ifwr_peer;
+struct ifwr_route;
+struct ifwr_txreq;
+struct ifwr_spill;
+
+/**
+ * @enum Where IFWR_TS_LOCAL timestamps come from
+ */
+typedef enum
+{
+    IFWR_CLOCK_REALTIME = 0,    /**< clock_gettime(CLOCK_REALTIME) per point (default) */
+    IFWR_CLOCK_COARSE,          /**< CLOCK_REALTIME_COARSE, a few ms resolution */
+    IFWR_CLOCK_TSC,             /**< CPU timestamp counter, calibrated against
+                                     CLOCK_REALTIME. Falls back to it if the
+                                     CPU has no invariant TSC */
+    IFWR_CLOCK_BATCH,           /**< One CLOCK_REALTIME reading shared by every
+                                     point until the next request or datagram
+                                     flush goes out. Per point over shared
+                                     memory */
+} ifwr_clock_e;
+
+/**
+ * @enum How requests are spread over conn->endpoints
+ */
+typedef enum
+{
+    IFWR_LB_FAILOVER = 0,       /**< The first healthy endpoint, in order */
+    IFWR_LB_ROUND_ROBIN,        /**< Healthy endpoints take turns */
+    IFWR_LB_LEAST_OUTSTANDING,  /**< The healthy endpoint with the fewest requests
+                                     waiting on a response, then the fastest */
+} ifwr_lb_e;
+
+/**
+ * @struct A server to send to, in conn->endpoints
+ */
+typedef struct
+{
+    char* hostname;
+    int port;
+} ifwr_endpoint_t;
+
+//Most endpoints a single connection can spread requests over
+#define IFWR_MAX_ENDPOINTS 8
+
+//How long an endpoint has to connect, take a request or answer one, when
+//conn->lb_max_latency_ms doesn't say
+#define IFWR_LB_TIMEOUT_MS 1000
+
+/**
+ * @struct How an endpoint is doing, from ifwr_endpoint_stats()
+ */
+typedef struct
+{
+    bool healthy;           /**< Getting requests. Unhealthy endpoints are
+                                 probed again after a back off */
+    int outstanding;        /**< Requests waiting on a response */
+    int64_t latency_ns;     /**< Smoothed response time */
+    double error_rate;      /**< Smoothed fraction of requests that failed */
+    uint64_t requests;      /**< Responses (or failures) seen */
+    uint64_t errors;        /**< ... of which were failures or a 5xx */
+} ifwr_endpoint_stats_t;
+
+/**
+ * @enum What to do with new series once a measurement reaches its limit
+ */
+typedef enum
+{
+    IFWR_CARD_WARN = 0,     /**< Send them anyway, and complain */
+    IFWR_CARD_SAMPLE,       /**< Let one in every card_sample through */
+    IFWR_CARD_DROP,         /**< Drop them */
+} ifwr_card_action_e;
+
+/**
+ * @enum Priority lanes. Each lane has batches of its own, and high priority
+ * 		batches are always sent ahead of bulk ones.
+ */
+typedef enum
+{
+    IFWR_PRIO_BULK = 0,     /**< The default */
+    IFWR_PRIO_HIGH,         /**< Sent within conn->prio_delay_us, and before
+                                 anything queued in the bulk lane */
+    IFWR_PRIO_COUNT,
+} ifwr_prio_e;
+
+/**
+ * @struct How long points in one lane waited in a batch before going out
+ */
+typedef struct
+{
+    uint64_t points;
+    uint64_t requests;
+    int64_t delay_avg_ns;
+    int64_t delay_max_ns;
+} ifwr_lane_stats_t;
+
+/**
+ * @struct Counters for things the writer did on your behalf
+ */
+typedef struct
+{
+    uint64_t series_over;       /**< Distinct new series seen beyond the cardinality limit */
+    uint64_t series_dropped;    /**< ... and how many of those were dropped */
+    int64_t clock_err_ns;       /**< IFWR_CLOCK_TSC drift found at the last re-sync */
+    uint64_t lines_coalesced;   /**< Lines folded into others by conn->batch_coalesce */
+    ifwr_lane_stats_t lanes[IFWR_PRIO_COUNT]; /**< Per ifwr_prio_e. Only counted
+                                     once a high priority point has been batched */
+    uint64_t points_dropped;    /**< Lost to conn->overflow, including lines
+                                     without a trailing newline */
+    uint64_t requests_dropped;  /**< ... in this many requests */
+    uint64_t points_spilled;    /**< Written to conn->spill_path */
+    int64_t spill_bytes;        /**< Still waiting in conn->spill_path */
+    int64_t overflow_wait_ns;   /**< Time spent waiting by IFWR_OVERFLOW_BLOCK */
+} ifwr_stats_t;
+
+//Most series a single connection can prepare
+#define IFWR_MAX_SERIES 4096
+
+//Most batches (one per bucket, precision and priority) a single connection can
+//keep besides its default one
+#define IFWR_MAX_BUCKETS 32
+
+//Most replicas a single connection can feed
+#define IFWR_MAX_REPLICAS 8
+
+//Requests held for a replica that is behind or down. Beyond this the oldest
+//is dropped.
+#define IFWR_REPL_QUEUE 64
+
+//Longest a replica may take to reconnect, before it is counted as failed and
+//left alone to back off
+#define IFWR_REPL_TIMEOUT_MS 100
+
+/**
+ * @struct How a replica is keeping up, from ifwr_replica_stats()
+ */
+typedef struct
+{
+    bool healthy;           /**< The last attempt to send to it worked */
+    int queued;             /**< Requests waiting to be sent */
+    uint64_t queued_bytes;
+    uint64_t sent;          /**< Requests delivered */
+    uint64_t rejected;      /**< Requests refused with a 4xx, not retried */
+    uint64_t dropped;       /**< Requests dropped from a full queue */
+    uint64_t failures;      /**< Failed attempts, each followed by a back off */
+    ifwr_err_e last_err;    /**< Why the last attempt failed */
+} ifwr_replica_stats_t;
+
 typedef struct ifwr_priv
 {
     ifwr_err_e last_err;
@@ -66,20 +293,146 @@ typedef struct ifwr_priv
     char* default_tagset;
     int http_err_code;
     char* json_err_str;
+
+    char tx_hdr[IFWR_MAX_HDR];
+    char* batch;            //Line protocol waiting for ifwr_flush()
+    int batch_len;
+    int batch_cap;
+    const char* batch_prec; //All lines in a batch share one precision
+    struct ifwr_lines* lines;   //Index for conn->batch_sort and batch_coalesce
+
+    struct ifwr_ring* uring; //Shared with the sender's load balanced endpoints
+    int uring_buf;          //First fixed buffer slot of our own, -1 if none
+    int uring_writes;       //Header and body writes not reaped yet
+    int uring_hdr_len;      //Last request, until its writes have been checked
+    int uring_hdr_res;
+    const char* uring_body;
+    int uring_body_len;
+    int uring_body_res;
+    bool uring_rx_pending;  //A linked receive is in flight for the response
+    bool uring_rx_done;     //... and has completed, with this result
+    int uring_rx_res;
+
+    struct ifwr_reactor* reactor;
+    char* txq;              //Requests waiting for the socket to become writable
+    int txq_len;
+    int txq_off;
+    int txq_cap;
+    int rx_len;             //Bytes of partial response(s) held in rx_buff
+    int inflight;           //Requests sent that have not been answered yet
+    bool epollout;          //EPOLLOUT is currently armed
+    struct ifwr_txreq* txq_reqs; //Where each request in txq ends
+    int txq_nreqs;
+    int txq_reqs_cap;
+    int txq_head_sent;      //Bytes of the first of them written already
+    struct ifwr_spill* spill;   //For IFWR_OVERFLOW_SPILL
+
+    struct ifwr_dgram* dgram; //Datagrams being packed for sendmmsg()
+    struct ifwr_shmring* shm; //Ring shared with a writer daemon
+
+    struct ifwr_series** series; //Prepared by ifwr_series_prepare()
+    int series_count;
+    struct ifwr_shmring* lazy;  //Binary records waiting to be formatted
+
+    struct ifwr_card* card;     //Series cardinality tracking
+    ifwr_card_action_e card_action;
+    int card_sample;
+    ifwr_stats_t stats;
+
+    struct ifwr_tsc* tsc;       //For IFWR_CLOCK_TSC
+    int64_t batch_ts;           //For IFWR_CLOCK_BATCH, 0 when not read yet
+
+    uint64_t ts_last;           //Last timestamp rendered, and its digits
+    char ts_digits[24];
+    int ts_len;
+
+    struct ifwr_replica* replicas; //Fed a copy of every request
+    int nreplicas;
+    struct ifwr_reactor* repl_reactor; //Drives replicas that were blocking
+    bool is_replica;            //Fed by another connection
+    int timeout_ms;             //Give up on connecting, or on a blocking send
+                                //or receive, after this. 0 for never
+
+    struct ifwr_peer* peers;    //One per conn->endpoints
+    int npeers;
+    int peer_next;              //For IFWR_LB_ROUND_ROBIN
+    struct ifwr_peer* peer_last; //Sent the last request, owes a response
+    struct ifwr_peer* peer;     //Set on the connection behind each endpoint
+
+    struct ifwr_route* routes;  //Other buckets, a batch for each precision
+    int nroutes;
+    const char* post_bucket;    //Bucket for the next request, NULL for conn->bucket
+
+    bool batch_high;            //The batch swapped in is a high priority one
+    int batch_points;           //Lines batched since priority lanes came into use
+    int64_t batch_open_ns;      //... when the first of them was batched
+    int64_t batch_queued_ns;    //... and their total time since then
+    bool lanes;                 //A high priority batch exists
+    int64_t prio_open_ns;       //Oldest unsent high priority point, 0 if none
+    int64_t lane_wait_ns[IFWR_PRIO_COUNT]; //Total batching time, per lane
+    struct ifwr_shmring* lazy_high; //High priority binary records
 } ifwr_priv_t;
 
+struct ifwr_conn;
+
+/**
+ * @brief Called from ifwr_process() for each response that arrives on a
+ * 		reactor connection. http_code is 0 if the connection failed, in which
+ * 		case ifwr_lasterr() says why. json_msg is only valid during the call.
+ */
+typedef void (*ifwr_resp_cb_t)(struct ifwr_conn* conn, int http_code, const char* json_msg);
+
 
 /**
  * @struct Influx-Writer connection state. Supply parameters here to set up
  * 		and maintain the connection.
  */
-typedef struct
+typedef struct ifwr_conn
 {
 	char* hostname; /**< Hostname string e.g "example.com" */
 	int   port;		/**< Host port e.g. 9999 */
+	char* sockpath; /**< UNIX domain socket path e.g. "/run/influxdb.sock" */
+	char* shmname;  /**< Shared memory ring name e.g. "/ifwr" */
 	char* org;		/**< Organization string (as supplied by InfluxDB */
 	char* bucket;   /**< Bucket identifier (as supplied by InfluxDB */
 	char* token;	/**< Authorization toke (as supplied by InfluxDB */
+	ifwr_transport_e transport; /**< Defaults to HTTP. org, bucket and token
+									 are only needed for HTTP */
+	int mtu;		/**< Max datagram payload, 0 for IFWR_DGRAM_MTU
+						 (or IFWR_DGRAM_UNIX_MTU for UNIX sockets) */
+	ifwr_io_e io;	/**< I/O backend for HTTP, defaults to blocking */
+	int batch_max;	/**< Collect up to this many bytes of lines per POST.
+						 0 (default) sends every point immediately */
+	bool batch_sort; /**< Group each batch by series, and sort by time
+						 within each series, before it is sent. Costs
+						 client CPU at flush time to save server CPU */
+	bool batch_coalesce; /**< Fold points in a batch with the same series and
+						 timestamp into one line with all of their fields.
+						 Where a field is sent twice, the last value wins */
+	int lazy_queue; /**< Bytes of binary record queue for ifwr_send_series().
+						 0 (default) formats points as they are sent */
+	ifwr_clock_e clock; /**< Source of IFWR_TS_LOCAL timestamps */
+	ifwr_endpoint_t* endpoints; /**< HTTP servers to spread requests over,
+						 or fail over between, instead of hostname and
+						 port. Each has its own connection. */
+	int nendpoints;	/**< Up to IFWR_MAX_ENDPOINTS */
+	ifwr_lb_e lb;	/**< How endpoints are picked */
+	int lb_max_latency_ms; /**< Endpoints whose smoothed response time goes
+						 over this are unhealthy. 0 for no limit. It is
+						 also how long an endpoint has to connect, take a
+						 request or answer one (IFWR_LB_TIMEOUT_MS if 0) */
+	int prio_delay_us; /**< Longest a high priority point may wait to be
+						 batched with others. 0 (default) sends each one
+						 straight away */
+	int mem_budget;	/**< Bytes of requests a reactor connection may queue
+						 for a slow server. 0 for IFWR_MAX_TXQ. A request
+						 is always let into an empty queue */
+	ifwr_overflow_e overflow; /**< What to do when the queue is over budget */
+	int block_timeout_ms; /**< For IFWR_OVERFLOW_BLOCK */
+	char* spill_path; /**< File for IFWR_OVERFLOW_SPILL, emptied on connect.
+						 Not supported with endpoints */
+	ifwr_resp_cb_t on_response; /**< Response callback (reactor only) */
+	void* user;		/**< Yours to use, e.g. from on_response */
 
 	struct ifwr_priv __private; //Don't touch my privates
 } ifwr_conn_t;
@@ -145,9 +498,15 @@ typedef enum
 	IFWR_TYPE_FLOAT,		/**< Type value is a float (double) */
 	IFWR_TYPE_STRING,		/**< Type value is a string (char*) */
 	IFWR_TYPE_BOOL,			/**< Type value is a boolean (bool) */
-	IFWR_TYPE_STOP 		 	/**< Signals end of an array */
+	IFWR_TYPE_STOP, 		/**< Signals end of an array */
+
+	//New types go after IFWR_TYPE_STOP, so its value never changes
+	IFWR_TYPE_HIST,			/**< Type value is a histogram (ifwr_hist_t*),
+								 sent as a count and quantile fields */
 } ifwr_type_e;
 
+struct ifwr_hist;
+
 /**
  * @union Storage type to hold the superset of all supported types
  */
@@ -157,6 +516,7 @@ typedef union
 	double f;
 	bool   b;
 	char* s;
+	struct ifwr_hist* h;
 } ifwr_value_u;
 
 
@@ -185,7 +545,7 @@ typedef struct
  *
  * @return Number of bytes written to the string, -1 on error
  */
-int ifwr_fmt_tagset(ifwr_conn_t* conn, ifwr_ktv_t* values, int len, char* buff);
+IFWR_HOT int ifwr_fmt_tagset(ifwr_conn_t* conn, ifwr_ktv_t* values, int len, char* buff);
 
 
 /**
@@ -208,7 +568,7 @@ int ifwr_set_tagset(ifwr_conn_t* conn, char* tagset);
  *
  * @return Number of bytes written to the string, -1 on error
  */
-int ifwr_fmt_fieldset(ifwr_conn_t* conn, ifwr_ktv_t* values, int len, char* buff);
+IFWR_HOT int ifwr_fmt_fieldset(ifwr_conn_t* conn, ifwr_ktv_t* values, int len, char* buff);
 
 /**
  * @enum Set the measurement timestamp precision
@@ -244,7 +604,7 @@ typedef enum
  *
  * @return Number of bytes written to the string, -1 on error
  */
-int ifwr_send(
+IFWR_HOT int ifwr_send(
 		ifwr_conn_t* conn,
 		const char* measurement,
 		const ifwr_ktv_t* tags,
@@ -252,6 +612,342 @@ int ifwr_send(
         ifwr_fmt_e ts_fmt,
 		int64_t ts_val);
 
+/**
+ * @brief Like ifwr_send(), but to a different bucket in the same org. Each
+ * 		bucket and precision gets its own batch, all sharing the connection's
+ * 		socket (or endpoints). HTTP only. ifwr_flush() sends every batch.
+ *
+ * @param[in]	bucket
+ * 		Bucket for this point, NULL for conn->bucket
+ *
+ * @return Number of bytes written to the string, -1 on error
+ */
+IFWR_HOT int ifwr_send_bucket(
+		ifwr_conn_t* conn,
+		const char* bucket,
+		const char* measurement,
+		const ifwr_ktv_t* tags,
+		const ifwr_ktv_t* fields,
+		ifwr_fmt_e ts_fmt,
+		int64_t ts_val);
+
+/**
+ * @brief Like ifwr_send_bucket(), but in a given priority lane. High priority
+ * 		points are batched apart from bulk ones, and go out ahead of any bulk
+ * 		batch, at most conn->prio_delay_us after they were sent. Priority only
+ * 		matters for batched HTTP connections. Other transports send high
+ * 		priority points like any others.
+ *
+ * @param[in]	prio
+ * 		Lane for this point
+ * @param[in]	bucket
+ * 		Bucket for this point, NULL for conn->bucket
+ *
+ * @return Number of bytes written to the string, -1 on error
+ */
+IFWR_HOT int ifwr_send_prio(
+		ifwr_conn_t* conn,
+		ifwr_prio_e prio,
+		const char* bucket,
+		const char* measurement,
+		const ifwr_ktv_t* tags,
+		const ifwr_ktv_t* fields,
+		ifwr_fmt_e ts_fmt,
+		int64_t ts_val);
+
+/**
+ * @brief Prepare a series so that later sends only need to supply values. The
+ * 		measurement and tagset are rendered once, and the field keys and types
+ * 		are remembered. Prepare all series before sending from other threads.
+ *
+ * @param[in]	conn
+ * 		InfluxDB connection state
+ * @param[in]	measurement
+ * 		measurement name, if NULL, use the default
+ * @param[in] tags
+ * 		InfluxDB Line protocol tag set, if NULL, the the default
+ * @param[in] fields
+ * 		Field keys and types, in the order values will be supplied. The
+ * 		values themselves are ignored.
+ *
+ * @return A series handle (>= 0), or -1 on error
+ */
+int ifwr_series_prepare(
+		ifwr_conn_t* conn,
+		const char* measurement,
+		const ifwr_ktv_t* tags,
+		const ifwr_ktv_t* fields);
+
+/**
+ * @brief Send a point on a prepared series.
+ *
+ * With conn->lazy_queue set this only copies the raw values into a binary
+ * record queue, and the line protocol is rendered by whichever thread calls
+ * ifwr_flush(). Strings are queued by reference and must stay valid until
+ * then. Many threads may send while one other thread flushes.
+ *
+ * @param[in]	conn
+ * 		InfluxDB connection state
+ * @param[in]	series
+ * 		Handle from ifwr_series_prepare()
+ * @param[in]	values
+ * 		One value per field, in the order the series was prepared with
+ * @param   fmt
+ *      Timesatmp format
+ * @param[in] ts
+ * 		Timesatmp value in Unix epoch format with precision as above
+ *
+ * @return Number of bytes queued or written, -1 on error
+ */
+IFWR_HOT int ifwr_send_series(
+		ifwr_conn_t* conn,
+		int series,
+		const ifwr_value_u* values,
+		ifwr_fmt_e ts_fmt,
+		int64_t ts_val);
+
+/**
+ * @brief Send a point that the caller has already rendered up to the end of
+ * 		its fieldset, e.g. by the typed schemas in influx-writer.hpp. The
+ * 		timestamp and newline are added in place, then it is batched, packed
+ * 		or queued like any other point. There are no cardinality checks.
+ *
+ * @param[in]	prio
+ * 		Lane for this point
+ * @param[in]	bucket
+ * 		Bucket for this point, NULL for conn->bucket
+ * @param[in,out]	line
+ * 		"measurement,tagset fieldset", not terminated
+ * @param[in]	line_len
+ * 		Length of the line so far
+ * @param[in]	line_max
+ * 		Size of the line buffer, which needs room for the timestamp
+ *
+ * @return Number of bytes written to the string, -1 on error
+ */
+IFWR_HOT int ifwr_send_rendered(
+		ifwr_conn_t* conn,
+		ifwr_prio_e prio,
+		const char* bucket,
+		char* line,
+		int line_len,
+		int line_max,
+		ifwr_fmt_e ts_fmt,
+		int64_t ts_val);
+
+/**
+ * @enum Aggregates that ifwr_series_aggregate() can emit for numeric fields.
+ * 		Each becomes a field named "<key>_min", "<key>_max" and so on.
+ */
+typedef enum
+{
+    IFWR_AGG_MIN    = 1 << 0,
+    IFWR_AGG_MAX    = 1 << 1,
+    IFWR_AGG_SUM    = 1 << 2,
+    IFWR_AGG_COUNT  = 1 << 3,
+    IFWR_AGG_MEAN   = 1 << 4,   /**< Always a float */
+    IFWR_AGG_LAST   = 1 << 5,
+    IFWR_AGG_ALL    = (1 << 6) - 1,
+} ifwr_agg_e;
+
+/**
+ * @brief Aggregate a prepared series over tumbling windows. Points sent with
+ * 		ifwr_send_series() are folded into the window their timestamp falls in,
+ * 		and one point per window is sent, stamped with the window start.
+ *
+ * A window closes when a point for a later window arrives (or on ifwr_close()),
+ * so replayed data aggregates exactly as live data did. String and bool fields
+ * keep their last value. Call before sending on the series. In lazy mode the
+ * aggregation runs on the thread that calls ifwr_flush().
+ *
+ * @param[in]	conn
+ * 		InfluxDB connection state
+ * @param[in]	series
+ * 		Handle from ifwr_series_prepare()
+ * @param[in]	window
+ * 		Window length in the units of the point timestamps, e.g. 1000 for one
+ * 		second windows of IFWR_TS_MILLIS points
+ * @param[in]	aggs
+ * 		ifwr_agg_e flags OR'd together
+ *
+ * @return 0 on success, -1 on error
+ */
+int ifwr_series_aggregate(ifwr_conn_t* conn, int series, int64_t window, unsigned aggs);
+
+/**
+ * @brief Only send points on a prepared series when something has changed.
+ * 		A point is left out when every field matches the last point sent,
+ * 		with floats allowed to drift within the deadbands. Histogram fields
+ * 		always count as changed. Does not apply to aggregated series.
+ *
+ * @param[in]	conn
+ * 		InfluxDB connection state
+ * @param[in]	series
+ * 		Handle from ifwr_series_prepare()
+ * @param[in]	abs
+ * 		Floats within this distance of the last value sent are unchanged
+ * @param[in]	rel
+ * 		Floats within this fraction of the last value sent are unchanged
+ * @param[in]	heartbeat
+ * 		Send anyway once this long has passed since the last point sent, in
+ * 		the units of the point timestamps (nanoseconds for IFWR_TS_LOCAL).
+ * 		0 for never.
+ *
+ * @return 0 on success, -1 on error
+ */
+int ifwr_series_deadband(ifwr_conn_t* conn, int series, double abs, double rel, int64_t heartbeat);
+
+/**
+ * @enum What ifwr_series_counter() sends for each counter field
+ */
+typedef enum
+{
+    IFWR_CTR_RAW    = 1 << 0,   /**< The counter itself, as "<key>" */
+    IFWR_CTR_DELTA  = 1 << 1,   /**< Change since the last point, "<key>_delta" */
+    IFWR_CTR_RATE   = 1 << 2,   /**< Change per second, "<key>_rate" (float) */
+    IFWR_CTR_ALL    = (1 << 3) - 1,
+} ifwr_ctr_e;
+
+/**
+ * @brief Treat the integer fields of a prepared series as monotonic counters,
+ * 		and work out deltas and per-second rates in the client. Wraps and
+ * 		resets are detected. The first point only carries raw values, and is
+ * 		not sent at all if raw values weren't asked for. Points without a
+ * 		timestamp use local time for rates. Counter series are not aggregated
+ * 		or filtered.
+ *
+ * @param[in]	conn
+ * 		InfluxDB connection state
+ * @param[in]	series
+ * 		Handle from ifwr_series_prepare()
+ * @param[in]	outputs
+ * 		ifwr_ctr_e flags OR'd together
+ * @param[in]	bits
+ * 		Width of the counters, e.g. 32 for counters that wrap at 2^32. 0 for 64.
+ *
+ * @return 0 on success, -1 on error
+ */
+int ifwr_series_counter(ifwr_conn_t* conn, int series, unsigned outputs, int bits);
+
+/**
+ * @brief Send every point on a prepared series to a different bucket, as
+ * 		ifwr_send_bucket() does
+ *
+ * @param[in]	bucket
+ * 		Bucket for the series, NULL for conn->bucket
+ *
+ * @return 0 on success, -1 on error
+ */
+int ifwr_series_bucket(ifwr_conn_t* conn, int series, const char* bucket);
+
+/**
+ * @brief Send every point on a prepared series in a given priority lane, as
+ * 		ifwr_send_prio() does. With conn->lazy_queue, high priority series
+ * 		also get a queue of their own, which ifwr_flush() empties first.
+ *
+ * @return 0 on success, -1 on error
+ */
+int ifwr_series_priority(ifwr_conn_t* conn, int series, ifwr_prio_e prio);
+
+/**
+ * @brief Track how many distinct series (measurement and tagset) each
+ * 		measurement has, and optionally guard against runaway cardinality.
+ * 		Applies to ifwr_send() and ifwr_series_prepare(). Points dropped by the
+ * 		guard fail with IFWR_ERR_CARDINALITY.
+ *
+ * @param[in]	conn
+ * 		InfluxDB connection state
+ * @param[in]	limit
+ * 		Series allowed per measurement, 0 to only count them
+ * @param[in]	action
+ * 		What to do with new series beyond the limit
+ * @param[in]	sample
+ * 		For IFWR_CARD_SAMPLE, let one in this many new series through
+ *
+ * @return 0 on success, -1 on error
+ */
+int ifwr_cardinality_limit(ifwr_conn_t* conn, uint64_t limit, ifwr_card_action_e action, int sample);
+
+/**
+ * @brief Estimated number of distinct series seen for a measurement (about
+ * 		1.6% standard error), including any that were dropped.
+ *
+ * @return The estimate, or -1 if the measurement isn't being tracked
+ */
+int64_t ifwr_cardinality(ifwr_conn_t* conn, const char* measurement);
+
+/**
+ * @brief Copy out the connection statistics
+ *
+ * @return 0 on success, -1 on error
+ */
+int ifwr_stats(ifwr_conn_t* conn, ifwr_stats_t* stats);
+
+/**
+ * @brief Send a copy of every request made on conn to another InfluxDB as
+ * 		well, e.g. for disaster recovery. Points are formatted (and batched)
+ * 		once, on conn. Each request body is copied once into a buffer shared
+ * 		by all the replicas, and each replica works through its own queue of
+ * 		them. A replica that fails is closed and reconnected, with back off,
+ * 		without holding up conn or the other replicas.
+ *
+ * 		Replicas never wait on the network in conn's send path. A blocking
+ * 		replica is switched to IFWR_IO_REACTOR on a reactor that conn polls
+ * 		whenever it sends, and is switched back when conn is closed. Either
+ * 		way responses are reported through the replica's own on_response.
+ * 		Reconnecting gives up after IFWR_REPL_TIMEOUT_MS, so a dead replica
+ * 		costs conn at most that long per attempt. IFWR_IO_URING replicas
+ * 		would have to be waited on, so they aren't allowed.
+ *
+ * @param[in]	conn
+ * 		HTTP connection that points are sent on
+ * @param[in]	replica
+ * 		Connected HTTP connection to copy requests to. It stays yours, but
+ * 		don't send on it or close it before conn is closed.
+ *
+ * @return Index of the replica for ifwr_replica_stats(), -1 on error
+ */
+int ifwr_replicate(ifwr_conn_t* conn, ifwr_conn_t* replica);
+
+/**
+ * @brief Copy out how a replica is doing
+ *
+ * @return 0 on success, -1 on error
+ */
+int ifwr_replica_stats(ifwr_conn_t* conn, int replica, ifwr_replica_stats_t* stats);
+
+/**
+ * @brief Copy out how one of conn->endpoints is doing
+ *
+ * @return 0 on success, -1 on error
+ */
+int ifwr_endpoint_stats(ifwr_conn_t* conn, int endpoint, ifwr_endpoint_stats_t* stats);
+
+/**
+ * @brief Send pre-formatted line protocol through the same path as
+ * 		ifwr_send(), so it is batched, packed or queued just the same.
+ *
+ * @param[in]  conn
+ * 		InfluxDB connection state
+ * @param[in] prec
+ * 		Timestamp precision of the lines ("s", "ms", "us" or "ns")
+ * @param[in] lines
+ * 		One or more newline terminated lines
+ * @param[in] len
+ * 		Length of lines in bytes
+ *
+ * @return Number of bytes accepted, -1 on error
+ */
+IFWR_HOT int ifwr_write_line(ifwr_conn_t* conn, const char* prec, const char* lines, int len);
+
+/**
+ * @brief Turn the tag on a shared memory ring record back into a precision
+ * 		string for ifwr_write_line(). Used by ifwr-daemon.
+ *
+ * @return The precision, or NULL if the tag is not valid
+ */
+const char* ifwr_shm_prec(uint16_t tag);
+
 /**
  * @brief Danger! Send whatever you provide to the InfluxDB endpoint.
  *
@@ -270,6 +966,39 @@ int ifwr_send(
 __attribute__((__format__ (__printf__, 3, 4)))
 int ifwr_write_raw(ifwr_conn_t* conn, const char* prec, const char* format, ... );
 
+/**
+ * @brief Send all points batched up by ifwr_send() and wait for InfluxDB to
+ * 		respond. Only useful when conn->batch_max is set, to push out partly
+ * 		filled datagrams, or to format and send a lazy record queue.
+ *
+ * @param[in]  conn
+ * 		InfluxDB connection state
+ *
+ * @return 0 on success (or nothing to send), -1 on failure. On an HTTP
+ * 		failure ifwr_http_err() has the details.
+ */
+int ifwr_flush(ifwr_conn_t* conn);
+
+/**
+ * @brief Change the tunables of a connected connection to those in settings,
+ * 		without losing anything that is batched or queued. These are
+ * 		batch_max, batch_sort, batch_coalesce, prio_delay_us, lb,
+ * 		lb_max_latency_ms, mem_budget, overflow, and block_timeout_ms. Other
+ * 		fields of settings are ignored, as they need a new connection.
+ * 		Shrinking batch_max flushes first. A new overflow policy applies
+ * 		to requests already queued from the next time the queue is over
+ * 		budget. Call it from the thread that flushes.
+ *
+ * @param[in]	conn
+ * 		Connected InfluxDB connection state
+ * @param[in]	settings
+ * 		New values. Only the public fields are read.
+ *
+ * @return 0 on success, -1 on error, in which case nothing was changed
+ * 		(unless a flush failed part way through resizing)
+ */
+int ifwr_reconfigure(ifwr_conn_t* conn, const ifwr_conn_t* settings);
+
 /**
  * @brief Get the result of a ifwr_write_raw(), or ifwr_send() functions.
  *
@@ -295,6 +1024,63 @@ int ifwr_http_err(ifwr_conn_t* conn, char** json_msg);
 
 
 
+/**
+ * @struct Opaque epoll based event loop for IFWR_IO_REACTOR connections
+ */
+typedef struct ifwr_reactor ifwr_reactor_t;
+
+/**
+ * @brief Create an event loop to drive non-blocking connections
+ *
+ * @return The reactor, or NULL if it could not be created
+ */
+ifwr_reactor_t* ifwr_reactor_new(void);
+
+/**
+ * @brief Attach a connected IFWR_IO_REACTOR connection to a reactor. With
+ * 		conn->endpoints set, the connection behind each endpoint is attached.
+ * 		Their responses reach on_response with that connection, which has the
+ * 		same user pointer.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int ifwr_reactor_add(ifwr_reactor_t* reactor, ifwr_conn_t* conn);
+
+/**
+ * @brief Return a file descriptor that becomes readable whenever the reactor
+ * 		has work to do. Add it to your own event loop and call ifwr_process()
+ * 		when it fires.
+ */
+int ifwr_reactor_fd(ifwr_reactor_t* reactor);
+
+/**
+ * @brief Wait up to timeout_ms (-1 forever, 0 not at all) for connections to
+ * 		become ready. Follow with ifwr_process().
+ *
+ * @return Number of ready events, -1 on failure
+ */
+int ifwr_poll(ifwr_reactor_t* reactor, int timeout_ms);
+
+/**
+ * @brief Resume pending writes and parse any responses that have arrived,
+ * 		calling each connection's on_response. Never blocks.
+ *
+ * 		A connection that fails is taken out of the reactor, and
+ * 		on_response is called with http_code 0. Its queued requests are
+ * 		dropped (counted in requests_dropped) and responses still owed are
+ * 		forgotten. Call ifwr_close(), ifwr_connect() and ifwr_reactor_add()
+ * 		to carry on with it. Endpoints reconnect by themselves.
+ *
+ * @return Number of responses processed, -1 on failure
+ */
+int ifwr_process(ifwr_reactor_t* reactor);
+
+/**
+ * @brief Free a reactor. Attached connections must be closed first.
+ */
+void ifwr_reactor_free(ifwr_reactor_t* reactor);
+
+
 /**
  * @brief Close the connection to InfluxDB
  *
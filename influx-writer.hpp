@@ -0,0 +1,263 @@
+/*
+ * influx-writer.hpp
+ *
+ * Typed measurement schemas for C++17. A schema is a type, so the static
+ * parts of each line (measurement name, separators and keys) are put together
+ * at compile time, and every value is formatted by an overload picked at
+ * compile time. There are no ifwr_ktv_t arrays, type switches or
+ * IFWR_TYPE_STOP walks. Lines come out the same as ifwr_send() would make
+ * them, and go through the C transport with ifwr_send_rendered().
+ *
+ *   static constexpr char weather[] = "weather";
+ *   static constexpr char city[] = "city";
+ *   static constexpr char temperature[] = "temperature";
+ *   static constexpr char pressure[] = "pressure";
+ *
+ *   using weather_t = ifwr::measurement<weather,
+ *           ifwr::tag<city>,
+ *           ifwr::field<temperature, int64_t>,
+ *           ifwr::field<pressure, double>>;
+ *
+ *   weather_t::send(&conn, IFWR_TS_LOCAL, 0, "Perth", 31, 1013.2);
+ *
+ * Tags come before fields. Values may be int64_t (and other integers),
+ * double, bool or const char*. Strings are not escaped, as with ifwr_send(),
+ * but negative integers keep their sign.
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#ifndef INFLUXWRITER_HPP_
+#define INFLUXWRITER_HPP_
+
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+#include "influx-writer.h"
+}
+
+namespace ifwr {
+
+/**
+ * @struct A tag column. Key must be a constexpr char array with linkage.
+ */
+template <const char* Key, typename T = const char*>
+struct tag
+{
+    static constexpr const char* key = Key;
+    static constexpr bool is_tag = true;
+    using type = T;
+};
+
+/**
+ * @struct A field column
+ */
+template <const char* Key, typename T>
+struct field
+{
+    static constexpr const char* key = Key;
+    static constexpr bool is_tag = false;
+    using type = T;
+};
+
+
+namespace detail {
+
+inline constexpr char empty[] = "";
+
+constexpr std::size_t length(const char* s)
+{
+    std::size_t n = 0;
+    while(s[n]){
+        n++;
+    }
+    return n;
+}
+
+//Fixed text between two values, e.g. ",city=" or " temperature="
+template <std::size_t N>
+struct segment
+{
+    char text[N];
+    static constexpr int size = N;
+};
+
+template <const char* Head, char Sep, const char* Key>
+constexpr auto make_segment()
+{
+    constexpr std::size_t head = length(Head);
+    constexpr std::size_t key = length(Key);
+    segment<head + 1 + key + 1> out{};
+
+    std::size_t n = 0;
+    for(std::size_t i = 0; i < head; i++){
+        out.text[n++] = Head[i];
+    }
+    out.text[n++] = Sep;
+    for(std::size_t i = 0; i < key; i++){
+        out.text[n++] = Key[i];
+    }
+    out.text[n++] = '=';
+    return out;
+}
+
+//Widest value other than a string, with room to spare
+constexpr int VALUE_MAX = 64;
+
+//The formatters below assume VALUE_MAX bytes are free
+template <typename T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, int> = 0>
+inline char* put(char* out, const char*, T value)
+{
+    out = std::to_chars(out, out + VALUE_MAX, static_cast<int64_t>(value)).ptr;
+    *out++ = 'i';
+    return out;
+}
+
+inline char* put(char* out, const char*, double value)
+{
+    //"%lf", as ifwr_send() does it
+    return std::to_chars(out, out + VALUE_MAX, value, std::chars_format::fixed, 6).ptr;
+}
+
+inline char* put(char* out, const char*, bool value)
+{
+    if(value){
+        std::memcpy(out, "True", 4);
+        return out + 4;
+    }
+    std::memcpy(out, "False", 5);
+    return out + 5;
+}
+
+//Strings are the only values that can run past the end
+inline char* put(char* out, const char* end, const char* value)
+{
+    const std::size_t len = value ? std::strlen(value) : 0;
+    if(out + len + 2 > end){
+        return nullptr;
+    }
+
+    *out++ = '"';
+    std::memcpy(out, value, len);
+    out += len;
+    *out++ = '"';
+    return out;
+}
+
+template <typename T>
+constexpr bool value_ok = std::is_integral_v<T> || std::is_same_v<T, double> ||
+        std::is_same_v<T, const char*>;
+
+} /* namespace detail */
+
+
+/**
+ * @struct A measurement schema. Never instantiated, everything is static.
+ */
+template <const char* Name, typename... Cols>
+struct measurement
+{
+    static constexpr int ncols = sizeof...(Cols);
+    static constexpr int ntags = (0 + ... + (Cols::is_tag ? 1 : 0));
+
+    static_assert(ncols > ntags, "A measurement needs at least one field");
+    static_assert((... && detail::value_ok<typename Cols::type>),
+            "Values must be integers, double, bool or const char*");
+
+private:
+    template <int I>
+    using col = std::tuple_element_t<I, std::tuple<Cols...>>;
+
+    template <int I>
+    static constexpr bool tags_first()
+    {
+        if constexpr (I + 1 >= ncols){
+            return true;
+        }
+        else{
+            return (col<I>::is_tag || !col<I + 1>::is_tag) && tags_first<I + 1>();
+        }
+    }
+    static_assert(tags_first<0>(), "Tags must come before fields");
+
+    //Everything before the value of column I
+    template <int I>
+    static constexpr auto prefix = detail::make_segment<
+            I == 0 ? Name : detail::empty,
+            I == ntags ? ' ' : ',',
+            col<I>::key>();
+
+    template <int I>
+    static char* put_col(char* out, const char* end, typename col<I>::type value)
+    {
+        constexpr auto& seg = prefix<I>;
+        if(!out || out + seg.size + detail::VALUE_MAX > end){
+            return nullptr;
+        }
+
+        std::memcpy(out, seg.text, seg.size);
+        return detail::put(out + seg.size, end, value);
+    }
+
+    template <int... Is>
+    static int format(std::integer_sequence<int, Is...>, char* buff, int buff_len,
+            typename Cols::type... values)
+    {
+        char* out = buff;
+        const char* const end = buff + buff_len;
+        ((out = put_col<Is>(out, end, values)), ...);
+        return out ? static_cast<int>(out - buff) : -1;
+    }
+
+public:
+    /**
+     * @brief Render "measurement,tagset fieldset" without a timestamp.
+     *
+     * @return Length of the line, -1 if it doesn't fit
+     */
+    static int format(char* buff, int buff_len, typename Cols::type... values)
+    {
+        return format(std::make_integer_sequence<int, ncols>(), buff, buff_len, values...);
+    }
+
+    /**
+     * @brief Like ifwr_send_prio(), with one value per column in order.
+     *
+     * @return Number of bytes written, -1 on error
+     */
+    static int send_prio(ifwr_conn_t* conn, ifwr_prio_e prio, const char* bucket,
+            ifwr_fmt_e ts_fmt, int64_t ts_val, typename Cols::type... values)
+    {
+        char line[IFWR_MAX_MSG];
+        const int len = format(line, IFWR_MAX_MSG, values...);
+        if(len < 0){
+            if(conn){
+                conn->__private.last_err = IFWR_ERR_MSGTOOBIG;
+            }
+            return -1;
+        }
+
+        return ifwr_send_rendered(conn, prio, bucket, line, len, IFWR_MAX_MSG, ts_fmt, ts_val);
+    }
+
+    /**
+     * @brief Like ifwr_send(), with one value per column in order.
+     *
+     * @return Number of bytes written, -1 on error
+     */
+    static int send(ifwr_conn_t* conn, ifwr_fmt_e ts_fmt, int64_t ts_val,
+            typename Cols::type... values)
+    {
+        return send_prio(conn, IFWR_PRIO_BULK, nullptr, ts_fmt, ts_val, values...);
+    }
+};
+
+} /* namespace ifwr */
+
+#endif /* INFLUXWRITER_HPP_ */
@@ -0,0 +1,462 @@
+/*
+ * lines.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#define _POSIX_C_SOURCE  200809L
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lines.h"
+#include "debug.h"
+
+
+struct lines_idx
+{
+    uint64_t ts;        //Sign flipped, so unsigned order is numeric order
+    uint64_t hash;      //Of the series key
+    uint32_t off;       //Start of the line in the batch
+    uint32_t len;       //Including the newline
+    uint32_t key_len;
+    uint32_t fields_end; //Offset of the space before the timestamp
+    uint32_t series;    //Dense series number, in order of first appearance
+    int32_t next;       //Later line with the same series and timestamp
+    bool dup;           //Folded into an earlier line
+    bool has_ts;
+};
+
+
+//A field as it appears in a line, e.g. v=1i
+typedef struct
+{
+    const char* str;
+    int len;
+    int key_len;
+} lines_field_t;
+
+
+static uint64_t lines_hash(const char* s, int len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(int i = 0; i < len; i++){
+        h ^= (uint8_t)s[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+//The series key runs up to the first unescaped space. The timestamp is the
+//last space separated token, if it is all digits.
+static void lines_parse(const char* line, int len, struct lines_idx* idx)
+{
+    int key_len = 0;
+    while(key_len < len && line[key_len] != ' ' && line[key_len] != '\n'){
+        key_len += line[key_len] == '\\' ? 2 : 1;
+    }
+    idx->key_len = key_len < len ? key_len : len;
+    idx->hash = lines_hash(line, idx->key_len);
+
+    int end = len;
+    while(end > 0 && (line[end - 1] == '\n' || line[end - 1] == '\r')){
+        end--;
+    }
+    int start = end;
+    while(start > idx->key_len && line[start - 1] >= '0' && line[start - 1] <= '9'){
+        start--;
+    }
+    const bool neg = start > idx->key_len && line[start - 1] == '-';
+
+    int64_t ts = INT64_MIN;
+    idx->has_ts = start < end && start - neg > idx->key_len && line[start - neg - 1] == ' ';
+    idx->fields_end = end;
+    if(idx->has_ts){
+        uint64_t v = 0;
+        for(int i = start; i < end; i++){
+            v = v * 10 + (line[i] - '0');
+        }
+        ts = neg ? -(int64_t)v : (int64_t)v;
+        idx->fields_end = start - neg - 1;
+    }
+
+    idx->ts = (uint64_t)ts ^ (1ULL << 63);
+}
+
+
+static int lines_grow(ifwr_lines_t* lines, int cap, int len)
+{
+    if(cap > lines->cap){
+        struct lines_idx* idx = realloc(lines->idx, cap * sizeof(struct lines_idx));
+        if(!idx){
+            return -1;
+        }
+        lines->idx = idx;
+
+        struct lines_idx* tmp = realloc(lines->tmp, cap * sizeof(struct lines_idx));
+        if(!tmp){
+            return -1;
+        }
+        lines->tmp = tmp;
+
+        int* table = realloc(lines->table, 2 * cap * sizeof(int));
+        if(!table){
+            return -1;
+        }
+        lines->table = table;
+        lines->cap = cap;
+    }
+
+    if(len > lines->scratch_cap){
+        char* scratch = realloc(lines->scratch, len);
+        if(!scratch){
+            return -1;
+        }
+        lines->scratch = scratch;
+        lines->scratch_cap = len;
+    }
+
+    return 0;
+}
+
+
+//Index every line. Returns the number of lines, -1 on allocation failure.
+static int lines_index(ifwr_lines_t* lines, const char* buff, int len)
+{
+    int count = 0;
+    for(int off = 0; off < len;){
+        const char* nl = memchr(buff + off, '\n', len - off);
+        const int line_len = nl ? (int)(nl - (buff + off)) + 1 : len - off;
+
+        if(count == lines->cap && lines_grow(lines, lines->cap ? lines->cap * 2 : 1024, len)){
+            return -1;
+        }
+
+        struct lines_idx* idx = &lines->idx[count++];
+        idx->off = off;
+        idx->len = line_len;
+        idx->next = -1;
+        idx->dup = false;
+        lines_parse(buff + off, line_len, idx);
+        off += line_len;
+    }
+
+    return count;
+}
+
+
+//Number each distinct series key in order of first appearance
+static int lines_number_series(ifwr_lines_t* lines, const char* buff, int count)
+{
+    int slots = 1;
+    while(slots < 2 * count){
+        slots <<= 1;
+    }
+    memset(lines->table, -1, slots * sizeof(int));
+
+    int series = 0;
+    for(int i = 0; i < count; i++){
+        struct lines_idx* idx = &lines->idx[i];
+        for(uint64_t s = idx->hash & (slots - 1);; s = (s + 1) & (slots - 1)){
+            const int first = lines->table[s];
+            if(first < 0){
+                lines->table[s] = i;
+                idx->series = series++;
+                break;
+            }
+
+            const struct lines_idx* other = &lines->idx[first];
+            if(other->hash == idx->hash && other->key_len == idx->key_len &&
+               memcmp(buff + other->off, buff + idx->off, idx->key_len) == 0){
+                idx->series = other->series;
+                break;
+            }
+        }
+    }
+
+    return series;
+}
+
+
+//Stable LSD radix sort on the timestamps, a byte at a time. Timestamps in a
+//batch are close together, so most of the high bytes are skipped.
+static void lines_sort_ts(ifwr_lines_t* lines, int count)
+{
+    struct lines_idx* src = lines->idx;
+    struct lines_idx* dst = lines->tmp;
+
+    for(int shift = 0; shift < 64; shift += 8){
+        int counts[257] = {0};
+        for(int i = 0; i < count; i++){
+            counts[((src[i].ts >> shift) & 0xff) + 1]++;
+        }
+        if(counts[((src[0].ts >> shift) & 0xff) + 1] == count){
+            continue;
+        }
+
+        for(int b = 0; b < 256; b++){
+            counts[b + 1] += counts[b];
+        }
+        for(int i = 0; i < count; i++){
+            dst[counts[(src[i].ts >> shift) & 0xff]++] = src[i];
+        }
+
+        struct lines_idx* t = src;
+        src = dst;
+        dst = t;
+    }
+
+    lines->idx = src;
+    lines->tmp = dst;
+}
+
+
+//Stable counting sort on the series number, which keeps the time order
+static void lines_group_series(ifwr_lines_t* lines, int count, int series)
+{
+    int* const starts = lines->table; //Free again, and at least count + 1 long
+    memset(starts, 0, (series + 1) * sizeof(int));
+    for(int i = 0; i < count; i++){
+        starts[lines->idx[i].series + 1]++;
+    }
+    for(int s = 0; s < series; s++){
+        starts[s + 1] += starts[s];
+    }
+    for(int i = 0; i < count; i++){
+        lines->tmp[starts[lines->idx[i].series]++] = lines->idx[i];
+    }
+
+    struct lines_idx* t = lines->idx;
+    lines->idx = lines->tmp;
+    lines->tmp = t;
+}
+
+
+int ifwr_lines_sort(ifwr_lines_t* lines, char* buff, int len)
+{
+    if(lines_grow(lines, lines->cap, len)){
+        return -1;
+    }
+
+    const int count = lines_index(lines, buff, len);
+    if(count < 0){
+        return -1;
+    }
+    if(count < 2){
+        return 0;
+    }
+
+    const int series = lines_number_series(lines, buff, count);
+    lines_sort_ts(lines, count);
+    if(series > 1){
+        lines_group_series(lines, count, series);
+    }
+
+    int out = 0;
+    for(int i = 0; i < count; i++){
+        memcpy(lines->scratch + out, buff + lines->idx[i].off, lines->idx[i].len);
+        out += lines->idx[i].len;
+    }
+    memcpy(buff, lines->scratch, out);
+
+    IFWR_DBG("Sorted %i lines in %i series\n", count, series);
+    return 0;
+}
+
+
+//Split a fieldset on unescaped commas outside of quoted strings. Returns the
+//number of fields, or -1 if there are more than max.
+static int lines_split_fields(const char* str, int len, lines_field_t* fields, int max)
+{
+    int count = 0;
+    int start = 0;
+    int key_len = -1;
+    bool quoted = false;
+    for(int i = 0; i <= len; i++){
+        if(i < len && str[i] == '\\'){
+            i++;
+            continue;
+        }
+        if(i < len && str[i] == '"'){
+            quoted = !quoted;
+            continue;
+        }
+        if(quoted){
+            continue;
+        }
+        if(i < len && str[i] == '=' && key_len < 0){
+            key_len = i - start;
+            continue;
+        }
+        if(i < len && str[i] != ','){
+            continue;
+        }
+
+        if(count == max){
+            return -1;
+        }
+        fields[count].str = str + start;
+        fields[count].len = i - start;
+        fields[count].key_len = key_len < 0 ? i - start : key_len;
+        count++;
+        start = i + 1;
+        key_len = -1;
+    }
+
+    return count;
+}
+
+
+//Write the union of the fields of a chain of lines, later values winning.
+//Returns the bytes written, or 0 if the lines have too many fields to merge.
+static int lines_merge(ifwr_lines_t* lines, const char* buff, int first, char* out)
+{
+    lines_field_t merged[IFWR_LINES_MAX_FIELDS];
+    lines_field_t fields[IFWR_LINES_MAX_FIELDS];
+    int nmerged = 0;
+
+    for(int i = first; i >= 0; i = lines->idx[i].next){
+        const struct lines_idx* idx = &lines->idx[i];
+        const char* str = buff + idx->off + idx->key_len + 1;
+        const int nfields = lines_split_fields(str, idx->fields_end - idx->key_len - 1, fields,
+                IFWR_LINES_MAX_FIELDS);
+        if(nfields < 0){
+            return 0;
+        }
+
+        for(int f = 0; f < nfields; f++){
+            int m = 0;
+            while(m < nmerged && (merged[m].key_len != fields[f].key_len ||
+                    memcmp(merged[m].str, fields[f].str, fields[f].key_len) != 0)){
+                m++;
+            }
+            if(m == IFWR_LINES_MAX_FIELDS){
+                return 0;
+            }
+            merged[m] = fields[f];
+            nmerged += m == nmerged;
+        }
+    }
+
+    //Same series key and timestamp as the first line, with the merged fields
+    const struct lines_idx* idx = &lines->idx[first];
+    const char* line = buff + idx->off;
+    int len = idx->key_len + 1;
+    memcpy(out, line, len);
+    for(int m = 0; m < nmerged; m++){
+        memcpy(out + len, merged[m].str, merged[m].len);
+        len += merged[m].len;
+        out[len++] = m + 1 < nmerged ? ',' : ' ';
+    }
+    memcpy(out + len, line + idx->fields_end + 1, idx->len - idx->fields_end - 1);
+    return len + idx->len - idx->fields_end - 1;
+}
+
+
+int ifwr_lines_coalesce(ifwr_lines_t* lines, char* buff, int len, int* merged)
+{
+    *merged = 0;
+    if(lines_grow(lines, lines->cap, len)){
+        return -1;
+    }
+
+    const int count = lines_index(lines, buff, len);
+    if(count < 0){
+        return -1;
+    }
+    if(count < 2){
+        return len;
+    }
+
+    //Chain up lines with the same series key and timestamp. Lines without a
+    //timestamp are left alone, the server may not give them the same time.
+    int slots = 1;
+    while(slots < 2 * count){
+        slots <<= 1;
+    }
+    memset(lines->table, -1, slots * sizeof(int));
+
+    bool found = false;
+    for(int i = 0; i < count; i++){
+        struct lines_idx* idx = &lines->idx[i];
+        if(!idx->has_ts){
+            continue;
+        }
+
+        const uint64_t h = idx->hash ^ (idx->ts * 0x9e3779b97f4a7c15ULL);
+        for(uint64_t s = h & (slots - 1);; s = (s + 1) & (slots - 1)){
+            const int first = lines->table[s];
+            if(first < 0){
+                lines->table[s] = i;
+                break;
+            }
+
+            struct lines_idx* other = &lines->idx[first];
+            if(other->ts == idx->ts && other->hash == idx->hash && other->key_len == idx->key_len &&
+               memcmp(buff + other->off, buff + idx->off, idx->key_len) == 0){
+                while(other->next >= 0){
+                    other = &lines->idx[other->next];
+                }
+                other->next = i;
+                idx->dup = true;
+                found = true;
+                break;
+            }
+        }
+    }
+
+    if(!found){
+        return len;
+    }
+
+    int out = 0;
+    for(int i = 0; i < count; i++){
+        const struct lines_idx* idx = &lines->idx[i];
+        if(idx->dup){
+            continue;
+        }
+
+        int written = 0;
+        if(idx->next >= 0 && (written = lines_merge(lines, buff, i, lines->scratch + out))){
+            for(int j = idx->next; j >= 0; j = lines->idx[j].next){
+                (*merged)++;
+            }
+            out += written;
+            continue;
+        }
+
+        //Too many fields to merge, so the rest of the chain goes out as is
+        for(int j = idx->next; j >= 0; j = lines->idx[j].next){
+            lines->idx[j].dup = false;
+        }
+
+        memcpy(lines->scratch + out, buff + idx->off, idx->len);
+        out += idx->len;
+    }
+
+    memcpy(buff, lines->scratch, out);
+
+    IFWR_DBG("Coalesced %i of %i lines\n", *merged, count);
+    return out;
+}
+
+
+void ifwr_lines_free(ifwr_lines_t* lines)
+{
+    free(lines->idx);
+    free(lines->tmp);
+    free(lines->table);
+    free(lines->scratch);
+    memset(lines, 0, sizeof(*lines));
+}
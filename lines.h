@@ -0,0 +1,70 @@
+/*
+ * lines.h
+ *
+ * Tools for reworking a batch of line protocol before it goes out. Lines are
+ * indexed by series key (measurement and tagset) and timestamp. Fields are
+ * only looked into when lines are merged. Index memory is kept between calls.
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#ifndef IFWR_LINES_H_
+#define IFWR_LINES_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//Most fields in a line built by ifwr_lines_coalesce()
+#define IFWR_LINES_MAX_FIELDS 256
+
+struct lines_idx;
+
+/**
+ * @struct Scratch space, reused from one batch to the next
+ */
+typedef struct ifwr_lines
+{
+    int cap;                //Lines the index arrays can hold
+    struct lines_idx* idx;
+    struct lines_idx* tmp;
+    int* table;             //Open addressed series table, 2 * cap slots
+    char* scratch;          //Where the reordered batch is built
+    int scratch_cap;
+} ifwr_lines_t;
+
+
+/**
+ * @brief Reorder a batch so that lines are grouped by series, in the order
+ * 		each series first appears, and sorted by timestamp within each series.
+ * 		Lines with equal timestamps keep their order. Lines without a
+ * 		timestamp sort first.
+ *
+ * @param[in,out]	buff
+ * 		Newline terminated lines, all with the same timestamp precision
+ *
+ * @return 0 on success, -1 if the index could not be allocated (buff is
+ * 		left as it was)
+ */
+int ifwr_lines_sort(ifwr_lines_t* lines, char* buff, int len);
+
+/**
+ * @brief Fold lines with the same series key and timestamp into the first of
+ * 		them, with the union of their fields. Where a field appears more than
+ * 		once, the last value wins, as it would on the server. Lines without a
+ * 		timestamp are never folded.
+ *
+ * @param[out]	merged
+ * 		How many lines were folded away
+ *
+ * @return New length of the batch, or -1 if the index could not be allocated
+ * 		(buff is left as it was)
+ */
+int ifwr_lines_coalesce(ifwr_lines_t* lines, char* buff, int len, int* merged);
+
+/**
+ * @brief Free the index and scratch memory
+ */
+void ifwr_lines_free(ifwr_lines_t* lines);
+
+#endif /* IFWR_LINES_H_ */
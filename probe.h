@@ -0,0 +1,99 @@
+/*
+ * probe.h
+ *
+ * USDT (user level statically defined tracing) probes, the same as
+ * <sys/sdt.h> would make, but without needing it installed. Each probe is a
+ * nop and an ELF note that says where its arguments are, so perf, bpftrace and
+ * friends can find and attach to them in production builds:
+ *
+ *   readelf -n app | grep -A4 stapsdt
+ *   bpftrace -e 'usdt:./app:influx_writer:response { @codes[arg0] = count(); }'
+ *
+ * Each probe also has a semaphore, which tracers bump while attached.
+ * Arguments that cost something to work out (timings, counts) are only worked
+ * out when IFWR_PROBE_ENABLED() says so. Arguments are all 64 bit integers.
+ *
+ * Probes are x86-64 and AArch64 only. Build with IFWR_NO_PROBES to leave them
+ * out altogether.
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#ifndef IFWR_PROBE_H_
+#define IFWR_PROBE_H_
+
+#include <stdint.h>
+
+/**
+ * @enum Why something was dropped, the first argument of the "drop" probe. The
+ * 		second is how many points, or datagrams and requests where noted.
+ */
+typedef enum
+{
+    IFWR_DROP_OVERFLOW = 1,     /**< Outgoing queue over conn->mem_budget */
+    IFWR_DROP_QFULL,            /**< Shared memory or lazy record ring full */
+    IFWR_DROP_CARDINALITY,      /**< New series over the cardinality limit */
+    IFWR_DROP_DGRAM,            /**< Datagrams the kernel wouldn't take */
+    IFWR_DROP_REPLICA,          /**< Requests a full replica queue let go */
+    IFWR_DROP_DISCONNECT,       /**< Queued requests lost with a failed connection */
+} ifwr_drop_e;
+
+
+#if !defined(IFWR_NO_PROBES) && defined(__GNUC__) && (defined(__x86_64__) || defined(__aarch64__))
+
+//One per probe name, at file scope
+#define IFWR_PROBE_DEFINE(name) \
+    __attribute__((section(".probes"), used, visibility("hidden"))) \
+    volatile unsigned short ifwr_probe_##name##_sem
+
+#define IFWR_PROBE_ENABLED(name) __builtin_expect(ifwr_probe_##name##_sem != 0, 0)
+
+//The note layout is the one described at
+//https://sourceware.org/systemtap/wiki/UserSpaceProbeImplementation
+#define IFWR_PROBE_NOTE(name, args) \
+    "990: nop\n" \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+    ".balign 4\n" \
+    ".4byte 992f-991f, 994f-993f, 3\n" \
+    "991: .asciz \"stapsdt\"\n" \
+    "992: .balign 4\n" \
+    "993: .8byte 990b\n" \
+    ".8byte _.stapsdt.base\n" \
+    ".8byte ifwr_probe_" #name "_sem\n" \
+    ".asciz \"influx_writer\"\n" \
+    ".asciz \"" #name "\"\n" \
+    ".asciz \"" args "\"\n" \
+    "994: .balign 4\n" \
+    ".popsection\n" \
+    ".ifndef _.stapsdt.base\n" \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+    ".weak _.stapsdt.base\n" \
+    ".hidden _.stapsdt.base\n" \
+    "_.stapsdt.base: .space 1\n" \
+    ".size _.stapsdt.base, 1\n" \
+    ".popsection\n" \
+    ".endif\n"
+
+#define IFWR_PROBE1(name, a) \
+    __asm__ __volatile__(IFWR_PROBE_NOTE(name, "-8@%0") \
+            :: "nor"((int64_t)(a)))
+#define IFWR_PROBE2(name, a, b) \
+    __asm__ __volatile__(IFWR_PROBE_NOTE(name, "-8@%0 -8@%1") \
+            :: "nor"((int64_t)(a)), "nor"((int64_t)(b)))
+#define IFWR_PROBE3(name, a, b, c) \
+    __asm__ __volatile__(IFWR_PROBE_NOTE(name, "-8@%0 -8@%1 -8@%2") \
+            :: "nor"((int64_t)(a)), "nor"((int64_t)(b)), "nor"((int64_t)(c)))
+
+#else
+
+#define IFWR_PROBE_DEFINE(name) extern volatile unsigned short ifwr_probe_##name##_sem
+#define IFWR_PROBE_ENABLED(name) 0
+
+#define IFWR_PROBE1(name, a) ((void)(a))
+#define IFWR_PROBE2(name, a, b) ((void)(a), (void)(b))
+#define IFWR_PROBE3(name, a, b, c) ((void)(a), (void)(b), (void)(c))
+
+#endif
+
+#endif /* IFWR_PROBE_H_ */
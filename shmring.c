@@ -0,0 +1,295 @@
+/*
+ * shmring.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#define _POSIX_C_SOURCE  200809L
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmring.h"
+#include "debug.h"
+
+
+/*
+ * Every record starts with one of these, 8 byte aligned. The consumer only
+ * trusts a record once the committed bit is set, and it zeroes everything it
+ * consumes so that stale bytes can never look like a committed record.
+ */
+typedef struct
+{
+    uint32_t state_len;
+    uint16_t tag;
+    uint16_t _pad;
+} shmring_rec_t;
+
+#define REC_COMMITTED   (1u << 31)
+#define REC_PAD         (1u << 30) //Filler to skip at the end of the ring
+#define REC_LEN_MASK    (REC_PAD - 1)
+
+#define REC_ALIGN(x)    (((x) + 7) & ~(uint64_t)7)
+#define REC_SIZE(len)   (sizeof(shmring_rec_t) + REC_ALIGN(len))
+
+
+//An fd of -1 gives a private, anonymous ring for use within one process
+static int shmring_map(ifwr_shmring_t* ring, int fd, size_t map_len)
+{
+    const int flags = MAP_SHARED | (fd < 0 ? MAP_ANONYMOUS : 0);
+    void* mem = mmap(NULL, map_len, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if(mem == MAP_FAILED){
+        IFWR_DBG("Could not map shared memory ring: %s\n", strerror(errno));
+        return -1;
+    }
+
+    ring->hdr = mem;
+    ring->data = (char*)mem + sizeof(ifwr_shmring_hdr_t);
+    ring->map_len = map_len;
+    return 0;
+}
+
+
+//0 if the capacity is too big
+static uint64_t shmring_capacity(uint64_t capacity)
+{
+    if(capacity > IFWR_SHMRING_MAX){
+        IFWR_ERR("Ring of %lu bytes is bigger than the limit of %lu\n",
+                (unsigned long)capacity, (unsigned long)IFWR_SHMRING_MAX);
+        errno = EINVAL;
+        return 0;
+    }
+
+    uint64_t cap = 4096;
+    while(cap < capacity){
+        cap <<= 1;
+    }
+
+    return cap;
+}
+
+
+static void shmring_init(ifwr_shmring_t* ring, uint64_t cap)
+{
+    ring->hdr->capacity = cap;
+    ring->hdr->head = 0;
+    ring->hdr->tail = 0;
+    ring->hdr->version = IFWR_SHMRING_VERSION;
+    __atomic_store_n(&ring->hdr->magic, IFWR_SHMRING_MAGIC, __ATOMIC_RELEASE);
+}
+
+
+int ifwr_shmring_create(ifwr_shmring_t* ring, const char* name, uint64_t capacity)
+{
+    const uint64_t cap = shmring_capacity(capacity);
+    if(!cap){
+        return -1;
+    }
+
+    //Producers may still be attached to a ring from a previous run, so carry
+    //on with it rather than leaving them writing into one nobody reads
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0660);
+    if(fd < 0 && errno == EEXIST){
+        if(ifwr_shmring_open(ring, name)){
+            IFWR_ERR("Shared memory \"%s\" exists and is not a ring, remove it first\n", name);
+            errno = EEXIST;
+            return -1;
+        }
+        IFWR_DBG("Success! Attached to existing %lu byte ring \"%s\"\n", (unsigned long)ring->hdr->capacity, name);
+        return 0;
+    }
+    if(fd < 0){
+        IFWR_DBG("Could not create shared memory \"%s\": %s\n", name, strerror(errno));
+        return -1;
+    }
+
+    const size_t map_len = sizeof(ifwr_shmring_hdr_t) + cap;
+    if(ftruncate(fd, map_len) < 0){
+        IFWR_DBG("Could not size shared memory \"%s\": %s\n", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    int ret = shmring_map(ring, fd, map_len);
+    close(fd);
+    if(ret){
+        shm_unlink(name);
+        return -1;
+    }
+
+    shmring_init(ring, cap);
+
+    IFWR_DBG("Success! Created %lu byte ring \"%s\"\n", (unsigned long)cap, name);
+    return 0;
+}
+
+
+int ifwr_shmring_create_anon(ifwr_shmring_t* ring, uint64_t capacity)
+{
+    const uint64_t cap = shmring_capacity(capacity);
+    if(!cap){
+        return -1;
+    }
+
+    if(shmring_map(ring, -1, sizeof(ifwr_shmring_hdr_t) + cap)){
+        return -1;
+    }
+
+    shmring_init(ring, cap);
+
+    IFWR_DBG("Success! Created %lu byte anonymous ring\n", (unsigned long)cap);
+    return 0;
+}
+
+
+int ifwr_shmring_open(ifwr_shmring_t* ring, const char* name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0){
+        IFWR_DBG("Could not open shared memory \"%s\": %s\n", name, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ifwr_shmring_hdr_t)){
+        IFWR_DBG("Shared memory \"%s\" is too small to be a ring\n", name);
+        close(fd);
+        return -1;
+    }
+
+    int ret = shmring_map(ring, fd, st.st_size);
+    close(fd);
+    if(ret){
+        return -1;
+    }
+
+    if(__atomic_load_n(&ring->hdr->magic, __ATOMIC_ACQUIRE) != IFWR_SHMRING_MAGIC ||
+       ring->hdr->version != IFWR_SHMRING_VERSION ||
+       ring->hdr->capacity > IFWR_SHMRING_MAX ||
+       (ring->hdr->capacity & (ring->hdr->capacity - 1)) ||
+       sizeof(ifwr_shmring_hdr_t) + ring->hdr->capacity > ring->map_len){
+        IFWR_DBG("Shared memory \"%s\" is not a version %i ring\n", name, IFWR_SHMRING_VERSION);
+        ifwr_shmring_close(ring, NULL);
+        return -1;
+    }
+
+    IFWR_DBG("Success! Opened ring \"%s\"\n", name);
+    return 0;
+}
+
+
+void* ifwr_shmring_reserve(ifwr_shmring_t* ring, uint32_t len, uint16_t tag, void** rec)
+{
+    ifwr_shmring_hdr_t* const hdr = ring->hdr;
+    const uint64_t cap = hdr->capacity;
+    const uint64_t need = REC_SIZE(len);
+
+    if(len > REC_LEN_MASK || need > cap / 2){
+        return NULL;
+    }
+
+    uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_RELAXED);
+    uint64_t total = 0;
+    for(;;){
+        //Records never wrap, so if it won't fit before the end, pad to the end
+        const uint64_t to_end = cap - (head & (cap - 1));
+        total = need <= to_end ? need : to_end + need;
+
+        const uint64_t tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+        if(head + total - tail > cap){
+            return NULL;
+        }
+
+        if(__atomic_compare_exchange_n(&hdr->head, &head, head + total, true,
+                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)){
+            break;
+        }
+    }
+
+    if(total != need){
+        const uint64_t to_end = total - need;
+        shmring_rec_t* pad = (shmring_rec_t*)(ring->data + (head & (cap - 1)));
+        __atomic_store_n(&pad->state_len, REC_COMMITTED | REC_PAD | (uint32_t)to_end, __ATOMIC_RELEASE);
+        head += to_end;
+    }
+
+    shmring_rec_t* r = (shmring_rec_t*)(ring->data + (head & (cap - 1)));
+    r->tag = tag;
+    *rec = r;
+    return r + 1;
+}
+
+
+void ifwr_shmring_commit(ifwr_shmring_t* ring, void* rec, uint32_t len)
+{
+    (void)ring;
+    shmring_rec_t* r = rec;
+    __atomic_store_n(&r->state_len, REC_COMMITTED | len, __ATOMIC_RELEASE);
+}
+
+
+const void* ifwr_shmring_peek(ifwr_shmring_t* ring, uint32_t* len, uint16_t* tag)
+{
+    ifwr_shmring_hdr_t* const hdr = ring->hdr;
+    const uint64_t cap = hdr->capacity;
+
+    for(;;){
+        const uint64_t tail = hdr->tail;
+        if(tail == __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE)){
+            return NULL;
+        }
+
+        shmring_rec_t* r = (shmring_rec_t*)(ring->data + (tail & (cap - 1)));
+        const uint32_t state_len = __atomic_load_n(&r->state_len, __ATOMIC_ACQUIRE);
+        if(!(state_len & REC_COMMITTED)){
+            return NULL; //Reserved, but the producer is still copying
+        }
+
+        if(state_len & REC_PAD){
+            const uint64_t to_end = state_len & REC_LEN_MASK;
+            memset(r, 0, sizeof(*r));
+            __atomic_store_n(&hdr->tail, tail + to_end, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        *len = state_len & REC_LEN_MASK;
+        *tag = r->tag;
+        return r + 1;
+    }
+}
+
+
+void ifwr_shmring_release(ifwr_shmring_t* ring)
+{
+    ifwr_shmring_hdr_t* const hdr = ring->hdr;
+    const uint64_t tail = hdr->tail;
+
+    shmring_rec_t* r = (shmring_rec_t*)(ring->data + (tail & (hdr->capacity - 1)));
+    const uint64_t size = REC_SIZE(r->state_len & REC_LEN_MASK);
+    memset(r, 0, size);
+    __atomic_store_n(&hdr->tail, tail + size, __ATOMIC_RELEASE);
+}
+
+
+void ifwr_shmring_close(ifwr_shmring_t* ring, const char* unlink_name)
+{
+    if(ring->hdr){
+        munmap(ring->hdr, ring->map_len);
+    }
+    if(unlink_name){
+        shm_unlink(unlink_name);
+    }
+
+    memset(ring, 0, sizeof(*ring));
+}
@@ -0,0 +1,116 @@
+/*
+ * shmring.h
+ *
+ * A multi-producer, single-consumer ring of variable length records that
+ * lives in POSIX shared memory, so that many processes can hand records to one
+ * writer daemon. Producers reserve space with a single compare-and-swap and
+ * publish with a single store. Nothing on the producer side ever blocks.
+ * A producer that dies between reserving and committing will stall the ring.
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#ifndef IFWR_SHMRING_H_
+#define IFWR_SHMRING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define IFWR_SHMRING_MAGIC   0x52574649 //"IFWR"
+#define IFWR_SHMRING_VERSION 1
+
+//Largest ring. The pad record at the end of the ring must fit its length field.
+#define IFWR_SHMRING_MAX     (1ull << 30)
+
+/**
+ * @struct Layout at the start of the shared memory. Head and tail live on
+ * 		their own cache lines so producers and the consumer don't fight.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;  //Bytes of record space, always a power of two
+    char _pad0[64 - 16];
+
+    uint64_t head;      //Next byte to be reserved by a producer
+    char _pad1[64 - 8];
+
+    uint64_t tail;      //Next byte to be consumed
+    char _pad2[64 - 8];
+} ifwr_shmring_hdr_t;
+
+/**
+ * @struct Per-process handle on a ring
+ */
+typedef struct ifwr_shmring
+{
+    ifwr_shmring_hdr_t* hdr;
+    char* data;
+    size_t map_len;
+} ifwr_shmring_t;
+
+
+/**
+ * @brief Create a ring with the given name, e.g. "/ifwr". Capacity is rounded
+ * 		up to a power of two, and can be at most IFWR_SHMRING_MAX. If a
+ * 		ring with the name is already there, it is attached to instead, so
+ * 		producers still attached to it carry on. Its capacity is kept.
+ *
+ * @return 0 on success, -1 on failure. errno is EEXIST if the name is taken
+ * 		by something that isn't a ring, EINVAL if the capacity is too big.
+ */
+int ifwr_shmring_create(ifwr_shmring_t* ring, const char* name, uint64_t capacity);
+
+/**
+ * @brief Create a ring that is only visible inside this process, for handing
+ * 		records between threads.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int ifwr_shmring_create_anon(ifwr_shmring_t* ring, uint64_t capacity);
+
+/**
+ * @brief Attach to a ring someone else has created
+ *
+ * @return 0 on success, -1 on failure
+ */
+int ifwr_shmring_open(ifwr_shmring_t* ring, const char* name);
+
+/**
+ * @brief Producer: reserve space for a record of len bytes
+ *
+ * @param[in] tag
+ * 		Small value stored alongside the record, for the consumer's use
+ * @param[out] rec
+ * 		Opaque handle to pass to ifwr_shmring_commit()
+ *
+ * @return Pointer to len bytes to fill in, or NULL if the ring is full
+ */
+void* ifwr_shmring_reserve(ifwr_shmring_t* ring, uint32_t len, uint16_t tag, void** rec);
+
+/**
+ * @brief Producer: publish a record filled in after ifwr_shmring_reserve()
+ */
+void ifwr_shmring_commit(ifwr_shmring_t* ring, void* rec, uint32_t len);
+
+/**
+ * @brief Consumer: look at the oldest published record without removing it
+ *
+ * @return Pointer to the record payload, or NULL if there is nothing ready
+ */
+const void* ifwr_shmring_peek(ifwr_shmring_t* ring, uint32_t* len, uint16_t* tag);
+
+/**
+ * @brief Consumer: drop the record returned by ifwr_shmring_peek()
+ */
+void ifwr_shmring_release(ifwr_shmring_t* ring);
+
+/**
+ * @brief Detach from the ring. The creator can also unlink the name.
+ */
+void ifwr_shmring_close(ifwr_shmring_t* ring, const char* unlink_name);
+
+#endif /* IFWR_SHMRING_H_ */
@@ -0,0 +1,158 @@
+/*
+ * tsc.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#define _POSIX_C_SOURCE  200809L
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "tsc.h"
+#include "debug.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+
+static uint64_t tsc_read(void)
+{
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static bool tsc_invariant(void)
+{
+    unsigned a, b, c, d;
+    if(!__get_cpuid(0x80000007, &a, &b, &c, &d)){
+        return false;
+    }
+    return d & (1 << 8);
+}
+
+#else
+
+static uint64_t tsc_read(void)
+{
+    return 0;
+}
+
+static bool tsc_invariant(void)
+{
+    return false;
+}
+
+#endif
+
+//Measure for at least this long before trusting the first calibration
+#define CALIBRATE_NS (10 * 1000 * 1000)
+
+
+static int realtime_ns(int64_t* ns)
+{
+    struct timespec ts;
+    if(clock_gettime(CLOCK_REALTIME, &ts) < 0){
+        return -1;
+    }
+
+    *ns = ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+    return 0;
+}
+
+
+int ifwr_tsc_init(ifwr_tsc_t* tsc, int64_t resync_ns)
+{
+    memset(tsc, 0, sizeof(*tsc));
+
+    if(!tsc_invariant()){
+        IFWR_DBG("No invariant TSC on this CPU\n");
+        return -1;
+    }
+
+    if(realtime_ns(&tsc->base_ns) < 0){
+        return -1;
+    }
+    tsc->base_tsc = tsc_read();
+    tsc->resync_ns = resync_ns ? resync_ns : IFWR_TSC_RESYNC_NS;
+
+    IFWR_DBG("Success! Calibrating the TSC against CLOCK_REALTIME\n");
+    return 0;
+}
+
+
+//Called with the sequence lock held. Returns the real time.
+static int tsc_resync(ifwr_tsc_t* tsc, uint64_t now_tsc, int64_t* ns)
+{
+    int64_t real = 0;
+    if(realtime_ns(&real) < 0){
+        return -1;
+    }
+
+    const uint64_t ticks = now_tsc - tsc->base_tsc;
+    const int64_t elapsed = real - tsc->base_ns;
+    if(tsc->ns_per_tick == 0 && elapsed < CALIBRATE_NS){
+        *ns = real; //Keep measuring from the same base
+        return 0;
+    }
+
+    //Readers load these without the lock, so they are stored atomically too
+    if(tsc->ns_per_tick != 0){
+        const int64_t predicted = tsc->base_ns + (int64_t)(ticks * tsc->ns_per_tick);
+        __atomic_store_n(&tsc->err_ns, real - predicted, __ATOMIC_RELAXED);
+    }
+
+    if(ticks && elapsed > 0){
+        double ns_per_tick = (double)elapsed / ticks;
+        __atomic_store(&tsc->ns_per_tick, &ns_per_tick, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&tsc->base_tsc, now_tsc, __ATOMIC_RELAXED);
+    __atomic_store_n(&tsc->base_ns, real, __ATOMIC_RELAXED);
+
+    *ns = real;
+    return 0;
+}
+
+
+int ifwr_tsc_now(ifwr_tsc_t* tsc, int64_t* ns)
+{
+    for(;;){
+        const uint32_t seq = __atomic_load_n(&tsc->seq, __ATOMIC_ACQUIRE);
+        if(seq & 1){
+            return realtime_ns(ns); //Someone else is re-syncing, don't wait
+        }
+
+        const uint64_t base_tsc = __atomic_load_n(&tsc->base_tsc, __ATOMIC_RELAXED);
+        const int64_t base_ns = __atomic_load_n(&tsc->base_ns, __ATOMIC_RELAXED);
+        double ns_per_tick;
+        __atomic_load(&tsc->ns_per_tick, &ns_per_tick, __ATOMIC_RELAXED);
+        const uint64_t now_tsc = tsc_read();
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&tsc->seq, __ATOMIC_RELAXED) != seq){
+            continue;
+        }
+
+        const int64_t offset = (int64_t)((now_tsc - base_tsc) * ns_per_tick);
+        if(ns_per_tick != 0 && offset < tsc->resync_ns){
+            *ns = base_ns + offset;
+            return 0;
+        }
+
+        uint32_t expect = seq;
+        if(!__atomic_compare_exchange_n(&tsc->seq, &expect, seq + 1, false,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+            return realtime_ns(ns);
+        }
+
+        const int ret = tsc_resync(tsc, now_tsc, ns);
+        __atomic_store_n(&tsc->seq, seq + 2, __ATOMIC_RELEASE);
+        return ret;
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ * tsc.h
+ *
+ * Wall clock time from the CPU timestamp counter. The counter is calibrated
+ * against CLOCK_REALTIME and re-synced periodically, so a timestamp costs a
+ * rdtsc and a multiply instead of a clock_gettime(). Only available on x86
+ * CPUs with an invariant TSC. Safe to read from many threads at once.
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#ifndef IFWR_TSC_H_
+#define IFWR_TSC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//Default time between re-syncs with CLOCK_REALTIME
+#define IFWR_TSC_RESYNC_NS (1000LL * 1000 * 1000)
+
+/**
+ * @struct Calibration state, guarded by a sequence lock
+ */
+typedef struct ifwr_tsc
+{
+    uint32_t seq;           //Odd while a re-sync is updating the rest
+    uint64_t base_tsc;      //Counter value at base_ns
+    int64_t base_ns;
+    double ns_per_tick;     //0 until the first calibration is done
+    int64_t resync_ns;
+    int64_t err_ns;         //How far off the counter was at the last re-sync
+} ifwr_tsc_t;
+
+
+/**
+ * @brief Set up the TSC clock.
+ *
+ * @param[in]	resync_ns
+ * 		How often to re-sync with CLOCK_REALTIME, 0 for IFWR_TSC_RESYNC_NS
+ *
+ * @return 0 on success, -1 if this CPU doesn't have an invariant TSC
+ */
+int ifwr_tsc_init(ifwr_tsc_t* tsc, int64_t resync_ns);
+
+/**
+ * @brief Current time in nanoseconds since the epoch
+ *
+ * @return 0 on success, -1 if the clock could not be read
+ */
+int ifwr_tsc_now(ifwr_tsc_t* tsc, int64_t* ns);
+
+#endif /* IFWR_TSC_H_ */
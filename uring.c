@@ -0,0 +1,224 @@
+/*
+ * uring.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#define _POSIX_C_SOURCE  200809L
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "uring.h"
+#include "debug.h"
+
+
+//The kernel and user space share these rings, so every head/tail access needs
+//the right memory ordering.
+#define URING_LOAD_ACQ(p)       __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define URING_STORE_REL(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+
+static int sys_uring_setup(unsigned entries, struct io_uring_params* p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+int ifwr_uring_init(ifwr_uring_t* ring, unsigned entries)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+
+    struct io_uring_params p = {0};
+    int fd = sys_uring_setup(entries, &p);
+    if(fd < 0){
+        IFWR_DBG("io_uring_setup() failed: %s\n", strerror(errno));
+        return -1;
+    }
+    ring->fd = fd;
+    ring->entries = p.sq_entries;
+
+    ring->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        if(ring->cq_sz > ring->sq_sz){
+            ring->sq_sz = ring->cq_sz;
+        }
+        ring->cq_sz = ring->sq_sz;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ptr == MAP_FAILED){
+        IFWR_DBG("Could not map io_uring SQ ring: %s\n", strerror(errno));
+        ring->sq_ptr = NULL;
+        ifwr_uring_free(ring);
+        return -1;
+    }
+
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else{
+        ring->cq_ptr = mmap(NULL, ring->cq_sz, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(ring->cq_ptr == MAP_FAILED){
+            IFWR_DBG("Could not map io_uring CQ ring: %s\n", strerror(errno));
+            ring->cq_ptr = NULL;
+            ifwr_uring_free(ring);
+            return -1;
+        }
+    }
+
+    ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED){
+        IFWR_DBG("Could not map io_uring SQEs: %s\n", strerror(errno));
+        ring->sqes = NULL;
+        ifwr_uring_free(ring);
+        return -1;
+    }
+
+    char* sq = ring->sq_ptr;
+    ring->sq_head  = (unsigned*)(sq + p.sq_off.head);
+    ring->sq_tail  = (unsigned*)(sq + p.sq_off.tail);
+    ring->sq_mask  = (unsigned*)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+    ring->sq_local_tail = *ring->sq_tail;
+
+    char* cq = ring->cq_ptr;
+    ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ring->cqes    = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    IFWR_DBG("Success! io_uring set up with %u entries\n", ring->entries);
+    return 0;
+}
+
+
+int ifwr_uring_register_sparse(ifwr_uring_t* ring, unsigned count)
+{
+    struct io_uring_rsrc_register reg = { .nr = count, .flags = IORING_RSRC_REGISTER_SPARSE };
+    if(sys_uring_register(ring->fd, IORING_REGISTER_BUFFERS2, &reg, sizeof(reg)) < 0){
+        IFWR_DBG("Could not register %u empty io_uring buffers: %s\n", count, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int ifwr_uring_update_buffers(ifwr_uring_t* ring, unsigned offset, const struct iovec* iovs, unsigned count)
+{
+    struct io_uring_rsrc_update2 up = { .offset = offset, .data = (uint64_t)(uintptr_t)iovs, .nr = count };
+    if(sys_uring_register(ring->fd, IORING_REGISTER_BUFFERS_UPDATE, &up, sizeof(up)) < 0){
+        IFWR_DBG("Could not update %u io_uring buffers at %u: %s\n", count, offset, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+struct io_uring_sqe* ifwr_uring_get_sqe(ifwr_uring_t* ring)
+{
+    const unsigned head = URING_LOAD_ACQ(ring->sq_head);
+    if(ring->sq_local_tail - head >= ring->entries){
+        return NULL;
+    }
+
+    const unsigned idx = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    ring->sq_local_tail++;
+    return sqe;
+}
+
+
+int ifwr_uring_submit(ifwr_uring_t* ring, unsigned min_complete)
+{
+    const unsigned to_submit = ring->sq_local_tail - *ring->sq_tail;
+    URING_STORE_REL(ring->sq_tail, ring->sq_local_tail);
+
+    const unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    int ret;
+    do {
+        ret = sys_uring_enter(ring->fd, to_submit, min_complete, flags);
+    } while(ret < 0 && errno == EINTR);
+
+    if(ret < 0){
+        IFWR_DBG("io_uring_enter() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return ret;
+}
+
+
+int ifwr_uring_reap(ifwr_uring_t* ring, bool wait, uint64_t* user_data, int* res)
+{
+    for(;;){
+        const unsigned head = *ring->cq_head;
+        if(head != URING_LOAD_ACQ(ring->cq_tail)){
+            const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            *user_data = cqe->user_data;
+            *res = cqe->res;
+            URING_STORE_REL(ring->cq_head, head + 1);
+            return 1;
+        }
+
+        if(!wait){
+            return 0;
+        }
+
+        if(sys_uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR){
+            IFWR_DBG("io_uring_enter() failed waiting for completion: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+}
+
+
+void ifwr_uring_free(ifwr_uring_t* ring)
+{
+    if(ring->sqes){
+        munmap(ring->sqes, ring->sqes_sz);
+    }
+    if(ring->cq_ptr && ring->cq_ptr != ring->sq_ptr){
+        munmap(ring->cq_ptr, ring->cq_sz);
+    }
+    if(ring->sq_ptr){
+        munmap(ring->sq_ptr, ring->sq_sz);
+    }
+    if(ring->fd >= 0){
+        close(ring->fd);
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
@@ -0,0 +1,96 @@
+/*
+ * uring.h
+ *
+ * A tiny, self contained io_uring helper. Just enough to submit linked
+ * socket writes/reads from registered buffers without pulling in liburing.
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: mgrosvenor
+ */
+
+#ifndef IFWR_URING_H_
+#define IFWR_URING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+
+/**
+ * @struct Memory mapped submission and completion queue state
+ */
+typedef struct ifwr_uring
+{
+    int fd;
+    unsigned entries;
+
+    void* sq_ptr;
+    size_t sq_sz;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    size_t sqes_sz;
+    unsigned sq_local_tail; //SQEs handed out but not yet submitted
+
+    void* cq_ptr;
+    size_t cq_sz;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+} ifwr_uring_t;
+
+
+/**
+ * @brief Set up a ring with (at least) the given number of entries
+ *
+ * @return 0 on success, -1 if io_uring is not available on this system
+ */
+int ifwr_uring_init(ifwr_uring_t* ring, unsigned entries);
+
+/**
+ * @brief Make a table of count empty fixed buffer slots, to be filled in by
+ *      ifwr_uring_update_buffers(). Needs Linux 5.19 or later.
+ */
+int ifwr_uring_register_sparse(ifwr_uring_t* ring, unsigned count);
+
+/**
+ * @brief Point fixed buffer slots offset onwards at iovs, for use with
+ *      READ_FIXED/WRITE_FIXED. A slot must not be replaced while an SQE
+ *      that uses it is in flight.
+ */
+int ifwr_uring_update_buffers(ifwr_uring_t* ring, unsigned offset, const struct iovec* iovs, unsigned count);
+
+/**
+ * @brief Grab the next free SQE (zeroed). Returns NULL if the SQ is full.
+ */
+struct io_uring_sqe* ifwr_uring_get_sqe(ifwr_uring_t* ring);
+
+/**
+ * @brief Submit all SQEs handed out so far, optionally waiting for
+ *      min_complete completions in the same system call.
+ *
+ * @return number of SQEs consumed, -1 on error
+ */
+int ifwr_uring_submit(ifwr_uring_t* ring, unsigned min_complete);
+
+/**
+ * @brief Pop the next completion.
+ *
+ * @param[in] wait
+ *      Block in the kernel until a completion arrives if none are ready
+ *
+ * @return 1 if a completion was returned, 0 if none ready, -1 on error
+ */
+int ifwr_uring_reap(ifwr_uring_t* ring, bool wait, uint64_t* user_data, int* res);
+
+/**
+ * @brief Tear down the ring and unmap all of its memory
+ */
+void ifwr_uring_free(ifwr_uring_t* ring);
+
+#endif /* IFWR_URING_H_ */